@@ -0,0 +1,386 @@
+//throughput and latency benchmark of osf-libusbcpp
+//
+//runs against a loopback device, which returns everything written to its
+//bulk OUT endpoint on its bulk IN endpoint. without --device a simulated
+//loopback device is used, real devices need a loopback firmware.
+//
+//usage: osf-libusbcpp-benchmark [options]
+//  --device VID:PID      use a real device instead of the simulation
+//  --interface N         interface to claim (default 0)
+//  --out EP --in EP      bulk endpoints (default 0x01 and 0x81)
+//  --duration MS         time spent per measurement (default 500)
+//  --bandwidth B         simulated bandwidth in bytes per second (default 40e6)
+//  --latency US          simulated latency per transfer (default 125)
+#include <osf/libusbcpp.hpp>
+#include <osf/libusbcpp/sim_backend.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace osf::libusbcpp;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+struct options
+{
+    bool simulated = true;
+    std::uint16_t vendor_id = 0;
+    std::uint16_t product_id = 0;
+    int interface_number = 0;
+    unsigned char out_ep = 0x01;
+    unsigned char in_ep = 0x81;
+    std::chrono::milliseconds duration{500};
+    double bandwidth = 40e6;
+    std::chrono::microseconds latency{125};
+};
+
+bool parse(int argc, char **argv, options &opt)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--device")
+        {
+            unsigned vid, pid;
+            if (std::sscanf(value, "%x:%x", &vid, &pid) != 2)
+            {
+                return false;
+            }
+            opt.simulated = false;
+            opt.vendor_id = static_cast<std::uint16_t>(vid);
+            opt.product_id = static_cast<std::uint16_t>(pid);
+        }
+        else if (arg == "--interface")
+        {
+            opt.interface_number = std::atoi(value);
+        }
+        else if (arg == "--out")
+        {
+            opt.out_ep = static_cast<unsigned char>(std::strtoul(value, nullptr, 0));
+        }
+        else if (arg == "--in")
+        {
+            opt.in_ep = static_cast<unsigned char>(std::strtoul(value, nullptr, 0));
+        }
+        else if (arg == "--duration")
+        {
+            opt.duration = std::chrono::milliseconds(std::atoi(value));
+        }
+        else if (arg == "--bandwidth")
+        {
+            opt.bandwidth = std::atof(value);
+        }
+        else if (arg == "--latency")
+        {
+            opt.latency = std::chrono::microseconds(std::atoi(value));
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//latencies in microseconds
+struct percentiles
+{
+    double p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+};
+percentiles compute_percentiles(std::vector<double> &samples)
+{
+    percentiles out{};
+    if (samples.empty())
+    {
+        return out;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))];
+    };
+    out.p50 = at(0.5);
+    out.p90 = at(0.9);
+    out.p99 = at(0.99);
+    out.p999 = at(0.999);
+    out.max = samples.back();
+    return out;
+}
+
+double micros(clock_type::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void print_header(const char *title, const char *variable)
+{
+    std::printf("\n%s\n", title);
+    std::printf("%10s %8s %12s %10s %10s %10s %10s %10s %8s\n", "size", variable, "MB/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us", "errors");
+}
+
+void print_row(std::size_t size, std::size_t depth, std::size_t bytes, clock_type::duration elapsed, std::vector<double> &latencies, std::size_t errors)
+{
+    auto p = compute_percentiles(latencies);
+    double rate = bytes / std::chrono::duration<double>(elapsed).count() / 1e6;
+    std::printf("%10zu %8zu %12.2f %10.1f %10.1f %10.1f %10.1f %10.1f %8zu\n", size, depth, rate, p.p50, p.p90, p.p99, p.p999, p.max, errors);
+}
+
+//blocking bulk_transfer: write one buffer and read it back
+void bench_sync(device_handle &dev, const options &opt, std::size_t size)
+{
+    std::vector<unsigned char> out(size), in(size);
+    std::vector<double> latencies;
+    std::size_t bytes = 0, errors = 0;
+    auto start = clock_type::now();
+    auto stop = start + opt.duration;
+    while (clock_type::now() < stop)
+    {
+        auto t0 = clock_type::now();
+        bool ok = true;
+        dev.bulk_transfer(endpoint_address(opt.out_ep), out.data(), out.data() + size, std::chrono::milliseconds(1000))(
+            [](unsigned char *) {}, [&](auto) { ok = false; });
+        unsigned char *received = in.data();
+        while (ok && received != in.data() + size)
+        {
+            dev.bulk_transfer(endpoint_address(opt.in_ep), received, in.data() + size, std::chrono::milliseconds(1000))(
+                [&](unsigned char *end) { received = end; }, [&](auto) { ok = false; });
+        }
+        if (!ok)
+        {
+            ++errors;
+            continue;
+        }
+        latencies.push_back(micros(clock_type::now() - t0));
+        bytes += 2 * size;
+    }
+    print_row(size, 1, bytes, clock_type::now() - start, latencies, errors);
+}
+
+//asynchronous transfers: keep depth transfers in flight in each direction
+void bench_async(context &ctx, device_handle &dev, const options &opt, std::size_t size, std::size_t depth)
+{
+    struct slot
+    {
+        transfer t;
+        std::vector<unsigned char> buffer;
+        clock_type::time_point submitted{};
+    };
+    std::vector<slot> slots;
+    slots.reserve(2 * depth);
+    std::vector<double> latencies;
+    std::size_t bytes = 0, errors = 0, pending = 0;
+    bool running = true;
+    for (std::size_t i = 0; i < 2 * depth; ++i)
+    {
+        bool is_out = i < depth;
+        slots.push_back(slot{dev.async_bulk_transfer(endpoint_address(is_out ? opt.out_ep : opt.in_ep)), std::vector<unsigned char>(size)});
+        auto &s = slots.back();
+        s.t.set_buffer(s.buffer.data(), s.buffer.data() + size);
+        s.t.set_timeout(std::chrono::milliseconds(1000));
+        s.t.set_callback([&, i](transfer &t) {
+            auto &self = slots[i];
+            --pending;
+            if (t.get_status() == LIBUSB_TRANSFER_COMPLETED)
+            {
+                latencies.push_back(micros(clock_type::now() - self.submitted));
+                bytes += t.end() - t.begin();
+            }
+            else if (t.get_status() != LIBUSB_TRANSFER_CANCELLED)
+            {
+                ++errors;
+            }
+            if (running)
+            {
+                self.submitted = clock_type::now();
+                if (t.submit() == 0)
+                {
+                    ++pending;
+                }
+            }
+        });
+    }
+    auto start = clock_type::now();
+    for (auto &s : slots)
+    {
+        s.submitted = clock_type::now();
+        if (s.t.submit() == 0)
+        {
+            ++pending;
+        }
+    }
+    while (clock_type::now() < start + opt.duration)
+    {
+        handle_events(ctx);
+    }
+    running = false;
+    auto elapsed = clock_type::now() - start;
+    for (auto &s : slots)
+    {
+        s.t.cancel();
+    }
+    while (pending != 0)
+    {
+        handle_events(ctx);
+    }
+    print_row(size, depth, bytes, elapsed, latencies, errors);
+}
+
+//completion callback with its type known at compile time
+struct counting_callback
+{
+    std::size_t *completions;
+    std::size_t *pending;
+    const bool *running;
+    template <typename T>
+    void operator()(T &t)
+    {
+        ++*completions;
+        if (!*running || t.submit() != 0)
+        {
+            --*pending;
+        }
+    }
+};
+
+//cost of one completion round trip through libusbcpp without any i/o:
+//submit, handle_events, the transfer callback and resubmission
+//typed selects basic_transfer<counting_callback> over the std::function transfer
+double bench_dispatch(const options &opt, std::size_t depth, bool typed)
+{
+    sim::backend bus;
+    sim::device_config cfg{};
+    cfg.vendor_id = 0x1209;
+    cfg.product_id = 0x0002;
+    sim::endpoint_config ep{};
+    ep.address = 0x81;
+    sim::interface_config intf{};
+    intf.endpoints.push_back(ep);
+    cfg.interfaces.push_back(intf);
+    bus.add_device(cfg);
+    context ctx{bus};
+    auto handles = open_if(ctx, [](const libusb_device_descriptor &) { return true; });
+    auto &dev = handles.front();
+
+    std::vector<unsigned char> buffer(64);
+    std::size_t completions = 0, pending = 0;
+    bool running = true;
+    counting_callback cb{&completions, &pending, &running};
+    std::vector<transfer> dynamic_transfers;
+    std::vector<basic_transfer<counting_callback>> typed_transfers;
+    dynamic_transfers.reserve(depth);
+    typed_transfers.reserve(depth);
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+        if (typed)
+        {
+            typed_transfers.push_back(dev.async_bulk_transfer(endpoint_address(0x81), cb));
+            typed_transfers.back().set_buffer(buffer.data(), buffer.data() + buffer.size());
+        }
+        else
+        {
+            dynamic_transfers.push_back(dev.async_bulk_transfer(endpoint_address(0x81)));
+            dynamic_transfers.back().set_buffer(buffer.data(), buffer.data() + buffer.size());
+            dynamic_transfers.back().set_callback([cb](transfer &t) mutable { cb(t); });
+        }
+    }
+    auto start = clock_type::now();
+    for (auto &t : dynamic_transfers)
+    {
+        pending += t.submit() == 0;
+    }
+    for (auto &t : typed_transfers)
+    {
+        pending += t.submit() == 0;
+    }
+    while (clock_type::now() < start + opt.duration)
+    {
+        handle_events(ctx);
+    }
+    running = false;
+    auto elapsed = clock_type::now() - start;
+    while (pending != 0)
+    {
+        handle_events(ctx);
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / std::max<std::size_t>(completions, 1);
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    options opt{};
+    if (!parse(argc, argv, opt))
+    {
+        std::fprintf(stderr, "usage: %s [--device VID:PID] [--interface N] [--out EP] [--in EP] [--duration MS] [--bandwidth B] [--latency US]\n", argv[0]);
+        return 2;
+    }
+
+    sim::backend bus;
+    if (opt.simulated)
+    {
+        bus.add_device(sim::loopback_device(0x1209, 0x0001, opt.bandwidth, opt.latency));
+        opt.vendor_id = 0x1209;
+        opt.product_id = 0x0001;
+        opt.interface_number = 0;
+        opt.out_ep = 0x01;
+        opt.in_ep = 0x81;
+    }
+    context ctx{opt.simulated ? static_cast<backend &>(bus) : default_backend()};
+    if (!ctx)
+    {
+        std::fprintf(stderr, "could not initialize libusb\n");
+        return 1;
+    }
+    auto handles = open_if(ctx, [&](const libusb_device_descriptor &desc) {
+        return desc.idVendor == opt.vendor_id && desc.idProduct == opt.product_id;
+    });
+    if (handles.empty())
+    {
+        std::fprintf(stderr, "could not open %04x:%04x\n", opt.vendor_id, opt.product_id);
+        return 1;
+    }
+    auto &dev = handles.front();
+    if (int r = dev.claim(opt.interface_number); r != 0)
+    {
+        std::fprintf(stderr, "could not claim interface %d: %d\n", opt.interface_number, r);
+        return 1;
+    }
+    std::printf("device %04x:%04x (%s), %lld ms per measurement\n", opt.vendor_id, opt.product_id,
+                opt.simulated ? "simulated loopback" : "real", static_cast<long long>(opt.duration.count()));
+
+    const std::size_t sizes[] = {512, 4096, 16384, 65536, 262144, 1048576};
+    const std::size_t depths[] = {1, 2, 4, 8, 16, 32};
+
+    print_header("sync bulk_transfer, write and read back, latency per round trip", "depth");
+    for (auto size : sizes)
+    {
+        bench_sync(dev, opt, size);
+    }
+
+    print_header("async transfer, latency from submit to callback", "depth");
+    for (auto size : sizes)
+    {
+        for (auto depth : depths)
+        {
+            bench_async(ctx, dev, opt, size, depth);
+        }
+    }
+
+    std::printf("\ncallback dispatch overhead in ns per completion (simulated, no i/o)\n%8s %14s %14s\n", "depth", "std::function", "typed");
+    for (auto depth : depths)
+    {
+        double dynamic_ns = bench_dispatch(opt, depth, false);
+        double typed_ns = bench_dispatch(opt, depth, true);
+        std::printf("%8zu %14.1f %14.1f\n", depth, dynamic_ns, typed_ns);
+    }
+    return 0;
+}
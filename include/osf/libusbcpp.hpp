@@ -3,12 +3,36 @@
 #include <vector>
 #include <variant>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <cstdint>
 #include "libusb.h"
 #include "libusbcpp/device.hpp"
 #include "libusbcpp/descriptor.hpp"
+#include "libusbcpp/descriptor_index.hpp"
 #include "libusbcpp/transfer.hpp"
-#include "error.hpp"
-#include "bulk_in_pipe.hpp"
+#include "libusbcpp/backend.hpp"
+#include "libusbcpp/error.hpp"
+#include "libusbcpp/stats.hpp"
+#include "libusbcpp/bulk_in_pipe.hpp"
+#include "libusbcpp/bulk_out_pipe.hpp"
+#include "libusbcpp/bulk_streams.hpp"
+#include "libusbcpp/transfer_pool.hpp"
+#include "libusbcpp/buffer_arena.hpp"
+#include "libusbcpp/buffer_view.hpp"
+#include "libusbcpp/queue.hpp"
+#include "libusbcpp/coroutine.hpp"
+#include "libusbcpp/iso_in_pipe.hpp"
+#include "libusbcpp/interrupt_poller.hpp"
+#include "libusbcpp/device_registry.hpp"
+#include "libusbcpp/device_query.hpp"
+#include "libusbcpp/device_match_table.hpp"
+#include "libusbcpp/stream_aggregator.hpp"
+#include "libusbcpp/trace_recorder.hpp"
+#include "libusbcpp/control_queue.hpp"
 
 namespace osf
 {
@@ -17,66 +41,93 @@ namespace libusbcpp
 class bulk_transfer;
 class context;
 
-class device_list
+//handle to the libusb library
+//this object is in a valid state only if it converts to true
+//everything obtained from a context uses the backend it was created with
+//events are either handled by calling handle_events, by an event thread the
+//context owns (start_event_thread) or by an external event loop which polls
+//the file descriptors of get_pollfds
+//with enable_device_registry the context follows the bus through hotplug
+//events and open_if looks the devices up without enumerating the bus
+//with device_discovery::disabled the bus is not enumerated at all and
+//devices are only reached through wrap_sys_device
+enum class device_discovery
+{
+    enabled,
+    disabled
+};
+class context
 {
-    libusb_device **devs = nullptr;
-    std::size_t length = 0;
-    friend class context;
-    device_list(libusb_device **d, std::size_t l) : devs{d}, length{l} {}
+    backend *be = nullptr;
+    libusb_context *ctx = nullptr; //a libusb session
+    std::thread event_thread;
+    std::atomic<bool> events_running{false};
+    std::function<void(int, short)> on_pollfd_added;
+    std::function<void(int)> on_pollfd_removed;
+    std::unique_ptr<device_registry> registry;
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+    detail::context_counters counters;
+#endif
 
-public:
-    device_list(const device_list &) = delete;
-    device_list &operator=(const device_list &) = delete;
-    device_list(device_list &&other)
+    //handles events with the completions attributed to this context
+    int handle_events_timeout(timeval *tv)
     {
-        std::swap(devs, other.devs);
-        std::swap(length, other.length);
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        detail::handling_scope scope{counters};
+#endif
+        return tv == nullptr ? be->handle_events(ctx) : be->handle_events_timeout_completed(ctx, tv, nullptr);
     }
-    device_list &operator=(device_list &&other)
+
+    static void LIBUSB_CALL pollfd_added(int fd, short events, void *user_data)
     {
-        length = 0;
-        devs = nullptr;
-        std::swap(devs, other.devs);
-        std::swap(length, other.length);
+        auto *self = static_cast<context *>(user_data);
+        if (self->on_pollfd_added)
+        {
+            self->on_pollfd_added(fd, events);
+        }
     }
-    ~device_list()
+    static void LIBUSB_CALL pollfd_removed(int fd, void *user_data)
     {
-        if (devs != nullptr)
+        auto *self = static_cast<context *>(user_data);
+        if (self->on_pollfd_removed)
         {
-            libusb_free_device_list(devs, 1); //free the list, unref the devices in it
+            self->on_pollfd_removed(fd);
         }
     }
-    device_list_iterator begin();
-    device_list_iterator end();
-};
-
-device_list_iterator device_list::begin()
-{
-    return device_list_iterator{&devs[0]};
-}
-device_list_iterator device_list::end()
-{
-    return device_list_iterator{&devs[length]};
-}
 
-//handle to the libusb library
-//this object is in a valid state only if it converts to true
-class context
-{
-    libusb_context *ctx = nullptr; //a libusb session
 public:
-    context()
+    context() : context(default_backend()) {}
+    explicit context(backend &b) : be{&b}
+    {
+        if (int r = be->init(&ctx); r < 0) //initialize the library for the session we just declared
+        {
+            ctx = nullptr;
+        }
+    }
+    explicit context(device_discovery discovery) : context(default_backend(), discovery) {}
+    //note: before libusb 1.0.27 LIBUSB_OPTION_NO_DEVICE_DISCOVERY can only be set as
+    //a default, there a disabled discovery also applies to every context created later
+    context(backend &b, device_discovery discovery) : be{&b}
     {
-        if (int r = libusb_init(&ctx); r < 0) //initialize the library for the session we just declared
+        int r = discovery == device_discovery::disabled ? be->init_without_device_discovery(&ctx) : be->init(&ctx);
+        if (r < 0)
         {
             ctx = nullptr;
         }
     }
+    context(const context &) = delete;
+    context &operator=(const context &) = delete;
     ~context()
     {
+        stop_event_thread();
+        registry.reset();
         if (ctx)
         {
-            libusb_exit(ctx);
+            if (on_pollfd_added || on_pollfd_removed)
+            {
+                be->set_pollfd_notifiers(ctx, nullptr, nullptr, nullptr);
+            }
+            be->exit(ctx);
         }
     }
 
@@ -88,25 +139,172 @@ public:
 
     void set_verbosity(const int level)
     {
-        libusb_set_debug(ctx, level);
+        be->set_debug(ctx, level);
+    }
+
+    //opens the device behind a file descriptor of a usbfs node (on linux),
+    //e.g. one handed over by udev or a broker, without any enumeration.
+    //the descriptor has to stay open until the handle is closed
+    sum_type<device_handle, error> wrap_sys_device(std::intptr_t sys_dev)
+    {
+        libusb_device_handle *dev;
+        if (int r = be->wrap_sys_device(ctx, sys_dev, &dev); r == 0)
+        {
+            return device_handle{be, dev};
+        }
+        else
+        {
+            return error(r);
+        }
     }
 
     device_list get_device_list()
     {
         libusb_device **devs;
-        std::size_t length = libusb_get_device_list(ctx, &devs);
-        return device_list{devs, length};
+        std::size_t length = be->get_device_list(ctx, &devs);
+        return device_list{be, devs, length};
+    }
+
+    //enumerates the bus once and keeps the result up to date from hotplug
+    //events, which requires the events of this context to be handled.
+    //returns 0 on success, LIBUSB_ERROR_BUSY if the registry is enabled already
+    //or LIBUSB_ERROR_NOT_SUPPORTED if the platform has no hotplug support
+    int enable_device_registry()
+    {
+        if (registry)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        auto r = std::make_unique<device_registry>(*be, ctx);
+        if (int err = r->start(); err != 0)
+        {
+            return err;
+        }
+        registry = std::move(r);
+        return 0;
+    }
+    //nullptr unless enable_device_registry succeeded
+    const device_registry *get_device_registry() const noexcept
+    {
+        return registry.get();
+    }
+
+    //handles the events of this context on a thread owned by the context,
+    //so the transfer callbacks run on that thread from now on
+    //returns 0 on success or LIBUSB_ERROR_BUSY if the thread is running already
+    int start_event_thread()
+    {
+        if (event_thread.joinable())
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        events_running.store(true, std::memory_order_release);
+        event_thread = std::thread([this] {
+            while (events_running.load(std::memory_order_acquire))
+            {
+                timeval tv{1, 0};
+                handle_events_timeout(&tv);
+            }
+        });
+        return 0;
+    }
+    //wakes the event thread up and waits until it exited
+    //transfers which are still submitted only complete once events are handled again
+    void stop_event_thread()
+    {
+        if (!event_thread.joinable())
+        {
+            return;
+        }
+        events_running.store(false, std::memory_order_release);
+        be->interrupt_event_handler(ctx);
+        event_thread.join();
+    }
+    bool has_event_thread() const noexcept
+    {
+        return event_thread.joinable();
+    }
+
+    //the file descriptors which have to be polled for the given events
+    //to drive this context from an external event loop (epoll and the like):
+    //call handle_events with a zero timeout whenever one of them is ready.
+    //unless pollfds_handle_timeouts is true the loop also has to wake up
+    //after get_next_timeout to let libusb time out transfers
+    std::vector<libusb_pollfd> get_pollfds()
+    {
+        std::vector<libusb_pollfd> out;
+        const libusb_pollfd **list = be->get_pollfds(ctx);
+        if (list == nullptr)
+        {
+            return out;
+        }
+        for (auto p = list; *p != nullptr; ++p)
+        {
+            out.push_back(**p);
+        }
+        be->free_pollfds(list);
+        return out;
+    }
+    //added is called with the fd and its poll events, removed with the fd
+    //whenever libusb changes its set of file descriptors, which happens
+    //from within libusb calls, e.g. while handling events or opening a device
+    void set_pollfd_notifiers(std::function<void(int, short)> added, std::function<void(int)> removed)
+    {
+        on_pollfd_added = std::move(added);
+        on_pollfd_removed = std::move(removed);
+        be->set_pollfd_notifiers(ctx, &pollfd_added, &pollfd_removed, static_cast<void *>(this));
+    }
+    //true if the timeouts are handled through the pollfds (timerfd)
+    bool pollfds_handle_timeouts()
+    {
+        return be->pollfds_handle_timeouts(ctx) != 0;
+    }
+    //returns 1 and sets t to the time until the next timeout, 0 if no timeout
+    //is pending or a libusb error code
+    int get_next_timeout(std::chrono::microseconds &t)
+    {
+        timeval tv{0, 0};
+        int r = be->get_next_timeout(ctx, &tv);
+        if (r == 1)
+        {
+            t = std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+        }
+        return r;
+    }
+
+    //the completions the event handling of this context delivered,
+    //zeros unless OSF_LIBUSBCPP_ENABLE_STATS is defined
+    context_stats get_stats() const
+    {
+        context_stats s;
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        counters.transfers.read(s.transfers);
+        s.event_loops = counters.event_loops.load(std::memory_order_relaxed);
+#endif
+        return s;
     }
 
     friend int handle_events(context &ctx)
     {
-        return libusb_handle_events(ctx.ctx);
+        return ctx.handle_events_timeout(nullptr);
+    }
+    //waits at most timeout for events, a zero timeout only handles what is pending
+    friend int handle_events(context &ctx, std::chrono::microseconds timeout)
+    {
+        timeval tv{static_cast<decltype(tv.tv_sec)>(timeout.count() / 1000000), static_cast<decltype(tv.tv_usec)>(timeout.count() % 1000000)};
+        return ctx.handle_events_timeout(&tv);
     }
 };
 
+//opens every device whose libusb_device_descriptor satisfies pred
+//uses the device registry of the context if it is enabled
 template <typename T>
 std::vector<device_handle> open_if(context &ctx, T pred)
 {
+    if (auto *registry = ctx.get_device_registry())
+    {
+        return registry->open_if(pred);
+    }
     constexpr auto ignore_error = [](auto) {};
     std::vector<device_handle> out{};
     for (auto dev : ctx.get_device_list())
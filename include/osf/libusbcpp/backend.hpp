@@ -0,0 +1,296 @@
+#pragma once
+#include "libusb.h"
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace osf
+{
+namespace libusbcpp
+{
+//the set of libusb functions this library is built on
+//every wrapper class calls libusb through the backend of the context it
+//was obtained from, which allows replacing the usb stack with
+//a simulation (see sim_backend.hpp) without touching the wrappers.
+//the functions have the exact semantics of their libusb counterparts
+class backend
+{
+public:
+    virtual ~backend() = default;
+
+    virtual int init(libusb_context **ctx) = 0;
+    //libusb_init_context with LIBUSB_OPTION_NO_DEVICE_DISCOVERY, the option only applies to the new context
+    virtual int init_without_device_discovery(libusb_context **ctx) = 0;
+    virtual void exit(libusb_context *ctx) = 0;
+    virtual void set_debug(libusb_context *ctx, int level) = 0;
+    //only for the options which take no argument
+    virtual int set_option(libusb_context *ctx, libusb_option option) = 0;
+    virtual ssize_t get_device_list(libusb_context *ctx, libusb_device ***list) = 0;
+    virtual void free_device_list(libusb_device **list, int unref_devices) = 0;
+    virtual int has_capability(std::uint32_t capability) = 0;
+    virtual int hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle) = 0;
+    virtual void hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle) = 0;
+
+    virtual libusb_device *ref_device(libusb_device *dev) = 0;
+    virtual void unref_device(libusb_device *dev) = 0;
+    virtual int get_device_descriptor(libusb_device *dev, libusb_device_descriptor *desc) = 0;
+    virtual std::uint8_t get_bus_number(libusb_device *dev) = 0;
+    virtual std::uint8_t get_device_address(libusb_device *dev) = 0;
+    virtual int get_port_numbers(libusb_device *dev, std::uint8_t *port_numbers, int port_numbers_len) = 0;
+    virtual int get_active_config_descriptor(libusb_device *dev, libusb_config_descriptor **config) = 0;
+    virtual int get_max_packet_size(libusb_device *dev, unsigned char endpoint) = 0;
+    virtual int get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint) = 0;
+    virtual void free_config_descriptor(libusb_config_descriptor *config) = 0;
+    virtual int open(libusb_device *dev, libusb_device_handle **dev_handle) = 0;
+    virtual int wrap_sys_device(libusb_context *ctx, std::intptr_t sys_dev, libusb_device_handle **dev_handle) = 0;
+
+    virtual void close(libusb_device_handle *dev_handle) = 0;
+    virtual libusb_device *get_device(libusb_device_handle *dev_handle) = 0;
+    virtual int claim_interface(libusb_device_handle *dev_handle, int interface_number) = 0;
+    virtual int release_interface(libusb_device_handle *dev_handle, int interface_number) = 0;
+    virtual int alloc_streams(libusb_device_handle *dev_handle, std::uint32_t num_streams, unsigned char *endpoints, int num_endpoints) = 0;
+    virtual int free_streams(libusb_device_handle *dev_handle, unsigned char *endpoints, int num_endpoints) = 0;
+    virtual int bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) = 0;
+    virtual int interrupt_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) = 0;
+    virtual int control_transfer(libusb_device_handle *dev_handle, std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, unsigned char *data, std::uint16_t length, unsigned int timeout) = 0;
+    virtual unsigned char *dev_mem_alloc(libusb_device_handle *dev_handle, std::size_t length) = 0;
+    virtual int dev_mem_free(libusb_device_handle *dev_handle, unsigned char *buffer, std::size_t length) = 0;
+
+    virtual libusb_transfer *alloc_transfer(int iso_packets) = 0;
+    virtual void free_transfer(libusb_transfer *transfer) = 0;
+    virtual int submit_transfer(libusb_transfer *transfer) = 0;
+    virtual int cancel_transfer(libusb_transfer *transfer) = 0;
+    virtual void transfer_set_stream_id(libusb_transfer *transfer, std::uint32_t stream_id) = 0;
+    virtual std::uint32_t transfer_get_stream_id(libusb_transfer *transfer) = 0;
+
+    virtual int handle_events(libusb_context *ctx) = 0;
+    virtual int handle_events_timeout_completed(libusb_context *ctx, timeval *tv, int *completed) = 0;
+    virtual void interrupt_event_handler(libusb_context *ctx) = 0;
+
+    virtual const libusb_pollfd **get_pollfds(libusb_context *ctx) = 0;
+    virtual void free_pollfds(const libusb_pollfd **pollfds) = 0;
+    virtual void set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb, libusb_pollfd_removed_cb removed_cb, void *user_data) = 0;
+    virtual int get_next_timeout(libusb_context *ctx, timeval *tv) = 0;
+    virtual int pollfds_handle_timeouts(libusb_context *ctx) = 0;
+};
+
+//forwards every call to the real libusb
+class libusb_backend final : public backend
+{
+public:
+    int init(libusb_context **ctx) override
+    {
+        return libusb_init(ctx);
+    }
+    int init_without_device_discovery(libusb_context **ctx) override
+    {
+#if LIBUSB_API_VERSION >= 0x0100010A
+        libusb_init_option option{};
+        option.option = LIBUSB_OPTION_NO_DEVICE_DISCOVERY;
+        return libusb_init_context(ctx, &option, 1);
+#else
+        //before libusb 1.0.27 the option can only be set as the default of the contexts
+        //created later and there is no way to clear it again
+        if (int r = libusb_set_option(nullptr, LIBUSB_OPTION_NO_DEVICE_DISCOVERY); r < 0)
+        {
+            return r;
+        }
+        return libusb_init(ctx);
+#endif
+    }
+    void exit(libusb_context *ctx) override
+    {
+        libusb_exit(ctx);
+    }
+    void set_debug(libusb_context *ctx, int level) override
+    {
+        libusb_set_debug(ctx, level);
+    }
+    int set_option(libusb_context *ctx, libusb_option option) override
+    {
+        return libusb_set_option(ctx, option);
+    }
+    ssize_t get_device_list(libusb_context *ctx, libusb_device ***list) override
+    {
+        return libusb_get_device_list(ctx, list);
+    }
+    void free_device_list(libusb_device **list, int unref_devices) override
+    {
+        libusb_free_device_list(list, unref_devices);
+    }
+    int has_capability(std::uint32_t capability) override
+    {
+        return libusb_has_capability(capability);
+    }
+    int hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle) override
+    {
+        return libusb_hotplug_register_callback(ctx, events, flags, vendor_id, product_id, dev_class, cb_fn, user_data, callback_handle);
+    }
+    void hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle) override
+    {
+        libusb_hotplug_deregister_callback(ctx, callback_handle);
+    }
+
+    libusb_device *ref_device(libusb_device *dev) override
+    {
+        return libusb_ref_device(dev);
+    }
+    void unref_device(libusb_device *dev) override
+    {
+        libusb_unref_device(dev);
+    }
+    int get_device_descriptor(libusb_device *dev, libusb_device_descriptor *desc) override
+    {
+        return libusb_get_device_descriptor(dev, desc);
+    }
+    std::uint8_t get_bus_number(libusb_device *dev) override
+    {
+        return libusb_get_bus_number(dev);
+    }
+    std::uint8_t get_device_address(libusb_device *dev) override
+    {
+        return libusb_get_device_address(dev);
+    }
+    int get_port_numbers(libusb_device *dev, std::uint8_t *port_numbers, int port_numbers_len) override
+    {
+        return libusb_get_port_numbers(dev, port_numbers, port_numbers_len);
+    }
+    int get_active_config_descriptor(libusb_device *dev, libusb_config_descriptor **config) override
+    {
+        return libusb_get_active_config_descriptor(dev, config);
+    }
+    int get_max_packet_size(libusb_device *dev, unsigned char endpoint) override
+    {
+        return libusb_get_max_packet_size(dev, endpoint);
+    }
+    int get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint) override
+    {
+        return libusb_get_max_iso_packet_size(dev, endpoint);
+    }
+    void free_config_descriptor(libusb_config_descriptor *config) override
+    {
+        libusb_free_config_descriptor(config);
+    }
+    int open(libusb_device *dev, libusb_device_handle **dev_handle) override
+    {
+        return libusb_open(dev, dev_handle);
+    }
+    int wrap_sys_device(libusb_context *ctx, std::intptr_t sys_dev, libusb_device_handle **dev_handle) override
+    {
+        return libusb_wrap_sys_device(ctx, sys_dev, dev_handle);
+    }
+
+    void close(libusb_device_handle *dev_handle) override
+    {
+        libusb_close(dev_handle);
+    }
+    libusb_device *get_device(libusb_device_handle *dev_handle) override
+    {
+        return libusb_get_device(dev_handle);
+    }
+    int claim_interface(libusb_device_handle *dev_handle, int interface_number) override
+    {
+        return libusb_claim_interface(dev_handle, interface_number);
+    }
+    int release_interface(libusb_device_handle *dev_handle, int interface_number) override
+    {
+        return libusb_release_interface(dev_handle, interface_number);
+    }
+    int alloc_streams(libusb_device_handle *dev_handle, std::uint32_t num_streams, unsigned char *endpoints, int num_endpoints) override
+    {
+        return libusb_alloc_streams(dev_handle, num_streams, endpoints, num_endpoints);
+    }
+    int free_streams(libusb_device_handle *dev_handle, unsigned char *endpoints, int num_endpoints) override
+    {
+        return libusb_free_streams(dev_handle, endpoints, num_endpoints);
+    }
+    int bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) override
+    {
+        return libusb_bulk_transfer(dev_handle, endpoint, data, length, actual_length, timeout);
+    }
+    int interrupt_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) override
+    {
+        return libusb_interrupt_transfer(dev_handle, endpoint, data, length, actual_length, timeout);
+    }
+    int control_transfer(libusb_device_handle *dev_handle, std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, unsigned char *data, std::uint16_t length, unsigned int timeout) override
+    {
+        return libusb_control_transfer(dev_handle, request_type, request, value, index, data, length, timeout);
+    }
+    unsigned char *dev_mem_alloc(libusb_device_handle *dev_handle, std::size_t length) override
+    {
+        return libusb_dev_mem_alloc(dev_handle, length);
+    }
+    int dev_mem_free(libusb_device_handle *dev_handle, unsigned char *buffer, std::size_t length) override
+    {
+        return libusb_dev_mem_free(dev_handle, buffer, length);
+    }
+
+    libusb_transfer *alloc_transfer(int iso_packets) override
+    {
+        return libusb_alloc_transfer(iso_packets);
+    }
+    void free_transfer(libusb_transfer *transfer) override
+    {
+        libusb_free_transfer(transfer);
+    }
+    int submit_transfer(libusb_transfer *transfer) override
+    {
+        return libusb_submit_transfer(transfer);
+    }
+    int cancel_transfer(libusb_transfer *transfer) override
+    {
+        return libusb_cancel_transfer(transfer);
+    }
+    void transfer_set_stream_id(libusb_transfer *transfer, std::uint32_t stream_id) override
+    {
+        libusb_transfer_set_stream_id(transfer, stream_id);
+    }
+    std::uint32_t transfer_get_stream_id(libusb_transfer *transfer) override
+    {
+        return libusb_transfer_get_stream_id(transfer);
+    }
+
+    int handle_events(libusb_context *ctx) override
+    {
+        return libusb_handle_events(ctx);
+    }
+    int handle_events_timeout_completed(libusb_context *ctx, timeval *tv, int *completed) override
+    {
+        return libusb_handle_events_timeout_completed(ctx, tv, completed);
+    }
+    void interrupt_event_handler(libusb_context *ctx) override
+    {
+        libusb_interrupt_event_handler(ctx);
+    }
+
+    const libusb_pollfd **get_pollfds(libusb_context *ctx) override
+    {
+        return libusb_get_pollfds(ctx);
+    }
+    void free_pollfds(const libusb_pollfd **pollfds) override
+    {
+        libusb_free_pollfds(pollfds);
+    }
+    void set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb, libusb_pollfd_removed_cb removed_cb, void *user_data) override
+    {
+        libusb_set_pollfd_notifiers(ctx, added_cb, removed_cb, user_data);
+    }
+    int get_next_timeout(libusb_context *ctx, timeval *tv) override
+    {
+        return libusb_get_next_timeout(ctx, tv);
+    }
+    int pollfds_handle_timeouts(libusb_context *ctx) override
+    {
+        return libusb_pollfds_handle_timeouts(ctx);
+    }
+};
+
+//the backend used by default constructed contexts
+inline backend &default_backend()
+{
+    static libusb_backend b;
+    return b;
+}
+
+} // namespace libusbcpp
+} // namespace osf
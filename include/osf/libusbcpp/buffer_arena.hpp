@@ -0,0 +1,177 @@
+#pragma once
+#include "libusb.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+#include "backend.hpp"
+#include "device.hpp"
+#include "detail/free_list.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//one block of transfer buffers sliced into equally sized slabs
+//the block comes from libusb_dev_mem_alloc when the platform supports it,
+//on linux that memory is mapped from usbfs and used by the kernel directly,
+//which saves copying every transfer between user and kernel memory.
+//otherwise the block falls back to page aligned heap memory.
+//slabs are aligned to 64 bytes, slabs whose size is a multiple of
+//page_size are page aligned. acquiring and releasing slabs is lock free.
+//note: the arena must be destroyed before its device_handle and
+//has to outlive its slabs
+class buffer_arena
+{
+public:
+    static constexpr std::size_t page_size = 4096;
+
+private:
+    backend *be;
+    libusb_device_handle *dev;
+    unsigned char *memory = nullptr;
+    std::size_t length = 0;
+    std::size_t slab_size;
+    std::size_t stride;
+    bool device_memory = false;
+    detail::index_free_list free_list;
+    std::atomic<std::size_t> available;
+
+    static std::size_t round_up(std::size_t n, std::size_t to) noexcept
+    {
+        return (n + to - 1) / to * to;
+    }
+    void release(std::size_t i) noexcept
+    {
+        free_list.push(i);
+        available.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    //move only handle to one slab of the arena
+    class slab
+    {
+        friend class buffer_arena;
+        buffer_arena *arena = nullptr;
+        std::size_t index = 0;
+        slab(buffer_arena *a, std::size_t i) noexcept : arena{a}, index{i} {}
+
+    public:
+        slab() noexcept = default;
+        slab(const slab &) = delete;
+        slab &operator=(const slab &) = delete;
+        slab(slab &&other) noexcept : arena{other.arena}, index{other.index}
+        {
+            other.arena = nullptr;
+        }
+        slab &operator=(slab &&other) noexcept
+        {
+            reset();
+            arena = other.arena;
+            index = other.index;
+            other.arena = nullptr;
+            return *this;
+        }
+        ~slab()
+        {
+            reset();
+        }
+        //returns the slab to the arena
+        void reset() noexcept
+        {
+            if (arena != nullptr)
+            {
+                arena->release(index);
+                arena = nullptr;
+            }
+        }
+        //false if the arena was exhausted
+        explicit operator bool() const noexcept
+        {
+            return arena != nullptr;
+        }
+        unsigned char *begin() const noexcept
+        {
+            return arena->memory + index * arena->stride;
+        }
+        unsigned char *end() const noexcept
+        {
+            return begin() + arena->slab_size;
+        }
+        std::size_t size() const noexcept
+        {
+            return arena->slab_size;
+        }
+    };
+
+    buffer_arena(device_handle &handle, std::size_t slab_size, std::size_t slab_count)
+        : be{handle.be}, dev{handle.dev}, slab_size{slab_size}, stride{round_up(slab_size, 64)}, free_list{slab_count}, available{slab_count}
+    {
+        length = round_up(stride * slab_count, page_size);
+        if (length == 0)
+        {
+            return;
+        }
+        memory = be->dev_mem_alloc(dev, length);
+        device_memory = memory != nullptr;
+        if (!device_memory)
+        {
+            memory = static_cast<unsigned char *>(std::aligned_alloc(page_size, length));
+        }
+    }
+    buffer_arena(const buffer_arena &) = delete;
+    buffer_arena &operator=(const buffer_arena &) = delete;
+    ~buffer_arena()
+    {
+        if (device_memory)
+        {
+            be->dev_mem_free(dev, memory, length);
+        }
+        else
+        {
+            std::free(memory);
+        }
+    }
+
+    //true if the memory could be allocated
+    explicit operator bool() const noexcept
+    {
+        return memory != nullptr;
+    }
+    //true if the slabs are device memory which the kernel uses without copying
+    bool is_device_memory() const noexcept
+    {
+        return device_memory;
+    }
+
+    //takes a slab out of the arena, the slab is empty if none is left
+    slab acquire() noexcept
+    {
+        if (memory == nullptr)
+        {
+            return slab{};
+        }
+        std::size_t i = free_list.pop();
+        if (i == detail::index_free_list::npos)
+        {
+            return slab{};
+        }
+        available.fetch_sub(1, std::memory_order_relaxed);
+        return slab{this, i};
+    }
+
+    std::size_t get_slab_size() const noexcept
+    {
+        return slab_size;
+    }
+    std::size_t size() const noexcept
+    {
+        return free_list.size();
+    }
+    //number of slabs which are not handed out, only a snapshot while other threads use the arena
+    std::size_t get_available() const noexcept
+    {
+        return available.load(std::memory_order_relaxed);
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
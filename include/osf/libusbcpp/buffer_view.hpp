@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+//non owning read only view of contiguous bytes, like std::span<const unsigned char>
+//note: this view is only valid as long as the memory it views is
+class buffer_view
+{
+    const unsigned char *first = nullptr;
+    const unsigned char *last = nullptr;
+
+public:
+    buffer_view() noexcept = default;
+    buffer_view(const unsigned char *begin, const unsigned char *end) noexcept : first{begin}, last{end} {}
+    buffer_view(const unsigned char *data, std::size_t size) noexcept : first{data}, last{data + size} {}
+
+    const unsigned char *begin() const noexcept
+    {
+        return first;
+    }
+    const unsigned char *end() const noexcept
+    {
+        return last;
+    }
+    const unsigned char *data() const noexcept
+    {
+        return first;
+    }
+    std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(last - first);
+    }
+    bool empty() const noexcept
+    {
+        return first == last;
+    }
+    const unsigned char &operator[](std::size_t i) const noexcept
+    {
+        return first[i];
+    }
+    buffer_view subview(std::size_t offset, std::size_t count) const noexcept
+    {
+        return buffer_view{first + offset, first + offset + count};
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -1,11 +1,276 @@
 #pragma once
+#include "libusb.h"
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+#include "buffer_arena.hpp"
+#include "buffer_view.hpp"
+#include "detail/pipe_base.hpp"
 
 namespace osf
 {
 namespace libusbcpp
 {
-class bulk_in_pipe
+//continuously reads from one bulk IN endpoint
+//the pipe keeps a fixed number of transfers submitted at all times,
+//every transfer is resubmitted as soon as its data was handed to the consumer
+//so the host controller always has a buffer ready and the bus never idles.
+//completed buffers are delivered strictly in submission order.
+//the buffers are slabs of a buffer_arena, so they are device memory
+//which the kernel fills without copying when the platform supports it.
+//data is consumed either by a callback which gets the received range and
+//returns before the transfer is resubmitted, or by a reader which gets
+//a lease on the buffer and may keep it as long as it likes, see set_reader.
+//callbacks run on the thread which calls handle_events on the context
+//note: all leases have to be released before the pipe may be destroyed.
+//the destructor cancels the transfers and blocks until libusb handed all of
+//them back, so either another thread handles the events meanwhile (see
+//context::start_event_thread) or the pipe is drained first: stop() and
+//handle the events until in_flight() returns 0. it must not be destroyed
+//from one of its own callbacks
+class bulk_in_pipe : public detail::pipe_base<bulk_in_pipe>
 {
+    friend class detail::pipe_base<bulk_in_pipe>;
+    using slot_transfer = basic_transfer<slot_callback>;
+    struct slot
+    {
+        slot_transfer t;
+        buffer_arena::slab buffer;
+        bool done = false;
+        bool reusable = false;
+    };
+
+public:
+    //move only read only view of a received buffer
+    //the buffer stays untouched until the lease is released,
+    //releasing it hands the transfer back to the pipe for resubmission.
+    //leases may be released from any thread
+    class lease
+    {
+        friend class bulk_in_pipe;
+        bulk_in_pipe *pipe = nullptr;
+        std::size_t index = 0;
+        buffer_view view{};
+        lease(bulk_in_pipe *p, std::size_t i, buffer_view v) noexcept : pipe{p}, index{i}, view{v} {}
+
+    public:
+        lease() noexcept = default;
+        lease(const lease &) = delete;
+        lease &operator=(const lease &) = delete;
+        lease(lease &&other) noexcept : pipe{other.pipe}, index{other.index}, view{other.view}
+        {
+            other.pipe = nullptr;
+        }
+        lease &operator=(lease &&other) noexcept
+        {
+            release();
+            pipe = other.pipe;
+            index = other.index;
+            view = other.view;
+            other.pipe = nullptr;
+            return *this;
+        }
+        ~lease()
+        {
+            release();
+        }
+        void release() noexcept
+        {
+            if (pipe != nullptr)
+            {
+                pipe->recycle(index);
+                pipe = nullptr;
+            }
+        }
+        explicit operator bool() const noexcept
+        {
+            return pipe != nullptr;
+        }
+        buffer_view get() const noexcept
+        {
+            return view;
+        }
+        const unsigned char *begin() const noexcept
+        {
+            return view.begin();
+        }
+        const unsigned char *end() const noexcept
+        {
+            return view.end();
+        }
+        const unsigned char *data() const noexcept
+        {
+            return view.data();
+        }
+        std::size_t size() const noexcept
+        {
+            return view.size();
+        }
+    };
+
+private:
+    buffer_arena arena;
+    std::vector<slot> slots;
+    std::size_t transfer_size;
+    std::atomic<std::size_t> leased{0};
+    std::atomic<std::size_t> overruns{0};
+    std::function<void(const unsigned char *, const unsigned char *)> consumer;
+    std::function<void(lease)> reader;
+
+    void deliver(std::size_t i)
+    {
+        auto &t = slots[i].t;
+        auto status = t.get_status();
+        slots[i].reusable = status == LIBUSB_TRANSFER_COMPLETED || status == LIBUSB_TRANSFER_TIMED_OUT;
+        bool failed = !slots[i].reusable && status != LIBUSB_TRANSFER_CANCELLED;
+        if (t.begin() != t.end() && reader)
+        {
+            leased.fetch_add(1, std::memory_order_relaxed);
+            reader(lease{this, i, buffer_view{t.begin(), t.end()}});
+        }
+        else
+        {
+            if (t.begin() != t.end() && consumer)
+            {
+                consumer(t.begin(), t.end());
+            }
+            give_back(i);
+        }
+        if (failed)
+        {
+            fail(status);
+        }
+    }
+    void recycle(std::size_t i) noexcept
+    {
+        leased.fetch_sub(1, std::memory_order_relaxed);
+        give_back(i);
+    }
+    void give_back(std::size_t i) noexcept
+    {
+        if (slots[i].reusable)
+        {
+            resubmit(i);
+        }
+    }
+
+public:
+    //transfer_size should be a multiple of the endpoints max packet size
+    bulk_in_pipe(device_handle &dev, endpoint_address ep, std::size_t transfer_count, std::size_t transfer_size)
+        : bulk_in_pipe(dev, ep, 0, transfer_count, transfer_size)
+    {
+    }
+    //reads one of the streams allocated with device_handle::alloc_streams, 0 reads the endpoint itself.
+    //with one pipe per stream id every stream has its own transfers and delivery order
+    bulk_in_pipe(device_handle &dev, endpoint_address ep, std::uint32_t stream_id, std::size_t transfer_count, std::size_t transfer_size)
+        : pipe_base(transfer_count), arena(dev, transfer_size, transfer_count), transfer_size{transfer_size}
+    {
+        slots.reserve(transfer_count);
+        for (std::size_t i = 0; i < transfer_count; ++i)
+        {
+            slots.push_back(slot{stream_id == 0 ? dev.async_bulk_transfer(ep, slot_callback{this, i}) : dev.async_bulk_stream_transfer(ep, stream_id, slot_callback{this, i}),
+                                 arena.acquire()});
+            auto &s = slots.back();
+            if (s.t && s.buffer)
+            {
+                s.t.set_buffer(s.buffer.begin(), s.buffer.end());
+            }
+        }
+    }
+    bulk_in_pipe(const bulk_in_pipe &) = delete;
+    bulk_in_pipe &operator=(const bulk_in_pipe &) = delete;
+    ~bulk_in_pipe()
+    {
+        drain();
+    }
+
+    //true if all transfers and buffers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : slots)
+        {
+            if (!s.t || !s.buffer)
+            {
+                return false;
+            }
+        }
+        return !slots.empty();
+    }
+
+    //called with the received range of every completed transfer
+    //the range is only valid until the callback returns
+    void set_callback(std::function<void(const unsigned char *, const unsigned char *)> f)
+    {
+        consumer = std::move(f);
+    }
+    //called with a lease on every completed transfer, takes precedence over set_callback
+    //the transfer is resubmitted once the lease is released, so the
+    //consumer reads straight from the transfer memory without copying.
+    //holding on to leases takes transfers out of rotation, once all of
+    //them are leased nothing is received until one is released
+    void set_reader(std::function<void(lease)> f)
+    {
+        reader = std::move(f);
+    }
+    //hands the lease of every completed transfer to a queue (see queue.hpp),
+    //so the event thread only pushes and worker threads pop and process.
+    //a full queue drops the buffer and counts an overrun, the transfer is
+    //resubmitted right away instead of stalling the endpoint.
+    //the queue has to outlive the pipe or be drained before it is destroyed
+    template <typename Queue>
+    void set_queue(Queue &q)
+    {
+        reader = [this, &q](lease l) {
+            if (!q.try_push(std::move(l)))
+            {
+                overruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+    }
+    //a timed out transfer delivers what it received and is resubmitted
+    void set_timeout(std::chrono::milliseconds t)
+    {
+        for (auto &s : slots)
+        {
+            s.t.set_timeout(t);
+        }
+    }
+
+    //submits all transfers, returns 0 on success or a libusb error code
+    //on failure the already submitted transfers are cancelled again
+    int start() noexcept
+    {
+        if (leased.load() != 0)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        return pipe_base::start();
+    }
+    //number of buffers which are currently lent to the reader
+    std::size_t get_leased() const noexcept
+    {
+        return leased.load(std::memory_order_relaxed);
+    }
+    //number of buffers which were dropped because the queue was full
+    std::size_t get_overruns() const noexcept
+    {
+        return overruns.load(std::memory_order_relaxed);
+    }
+    std::size_t get_transfer_size() const noexcept
+    {
+        return transfer_size;
+    }
+    //true if the transfers receive straight into device memory
+    bool is_device_memory() const noexcept
+    {
+        return arena.is_device_memory();
+    }
 };
 } // namespace libusbcpp
-} // namespace osf
\ No newline at end of file
+} // namespace osf
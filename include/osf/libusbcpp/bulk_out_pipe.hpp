@@ -0,0 +1,369 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+#include "buffer_arena.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//streams writes to one bulk OUT endpoint
+//small writes are copied into the buffer of the transfer which is being
+//filled and go out together, so many small writes cost one round trip.
+//up to transfer_count transfers are in flight at once. a buffer is submitted
+//once it is full, on flush(), when no transfer is in flight (so the bus
+//never idles while data is waiting) or, if a flush deadline is set, instead
+//of the last rule once its first byte waited for the deadline.
+//the transfer size is rounded up to a multiple of the max packet size,
+//so only the last packet of a flushed buffer can be short. a flushed buffer
+//which ends on a packet boundary is terminated by a zero length packet,
+//which tells the device that the write is complete. if the data ended with
+//a full buffer, flush() sends the zero length packet as a transfer of its own.
+//callbacks run on the thread which calls handle_events on the context
+//note: the destructor cancels the transfers and blocks until libusb handed all of
+//them back, so either another thread handles the events meanwhile (see
+//context::start_event_thread) or the pipe is drained first: cancel() and
+//handle the events until in_flight() returns 0. it must not be destroyed
+//from one of its own callbacks
+class bulk_out_pipe
+{
+    using clock = std::chrono::steady_clock;
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+    //completion callback of the slot with the given index
+    struct slot_callback
+    {
+        bulk_out_pipe *pipe;
+        std::size_t index;
+        template <typename T>
+        void operator()(T &)
+        {
+            pipe->complete(index);
+        }
+    };
+    using slot_transfer = basic_transfer<slot_callback>;
+    struct slot
+    {
+        slot_transfer t;
+        buffer_arena::slab buffer;
+        bool submitted = false;
+    };
+
+    std::size_t packet_size;
+    std::size_t transfer_size;
+    buffer_arena arena;
+    std::vector<slot> slots;
+    std::mutex mtx;
+    //everything below is guarded by mtx
+    std::vector<std::size_t> free_slots;
+    std::size_t filling = none; //the slot which collects writes
+    std::size_t fill = 0;
+    clock::time_point fill_started{};
+    std::size_t pending = 0;
+    //completions which are still in their callback
+    std::size_t completing = 0;
+    std::condition_variable idle;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t transfers_sent = 0;
+    clock::duration deadline{0};
+    bool zlp = true;
+    //the last submitted buffer ended on a packet boundary without a zero length packet
+    bool open_end = false;
+    //flush() found no free slot for the zero length packet, the next free one sends it
+    bool zlp_due = false;
+    std::function<void(libusb_transfer_status, std::size_t)> on_error;
+
+    static std::size_t packet_size_of(device_handle &dev, endpoint_address ep)
+    {
+        int size = 512;
+        dev.get_max_packet_size(ep)(
+            [&](int s) { size = s & 0x7ff; },
+            [](auto) {});
+        return static_cast<std::size_t>(std::max(size, 1));
+    }
+    //expects the lock to be held, hands the filling slot to libusb
+    int submit_filling(bool flush) noexcept
+    {
+        auto &s = slots[filling];
+        bool boundary = fill % packet_size == 0;
+        s.t.set_buffer(s.buffer.begin(), s.buffer.begin() + fill);
+        s.t.get()->flags = flush && zlp && boundary ? LIBUSB_TRANSFER_ADD_ZERO_PACKET : 0;
+        if (int r = s.t.submit(); r != 0)
+        {
+            return r;
+        }
+        s.submitted = true;
+        ++pending;
+        filling = none;
+        fill = 0;
+        open_end = boundary && !(flush && zlp);
+        return 0;
+    }
+    //expects the lock to be held, terminates data which ended with a full
+    //buffer by an empty transfer, or marks it due if no slot is free
+    int submit_zero_length() noexcept
+    {
+        if (free_slots.empty())
+        {
+            zlp_due = true;
+            return 0;
+        }
+        auto &s = slots[free_slots.back()];
+        s.t.set_buffer(s.buffer.begin(), s.buffer.begin());
+        s.t.get()->flags = 0;
+        if (int r = s.t.submit(); r != 0)
+        {
+            return r;
+        }
+        free_slots.pop_back();
+        s.submitted = true;
+        ++pending;
+        open_end = false;
+        zlp_due = false;
+        return 0;
+    }
+    //expects the lock to be held, submits a partially filled slot if the rules say so
+    int maybe_flush(clock::time_point now) noexcept
+    {
+        if (filling == none || fill == 0)
+        {
+            return 0;
+        }
+        bool due = deadline == clock::duration::zero() ? pending == 0 : now - fill_started >= deadline;
+        return due ? submit_filling(true) : 0;
+    }
+    void complete(std::size_t i)
+    {
+        auto &t = slots[i].t;
+        auto status = t.get_status();
+        int r = 0;
+        std::size_t lost = 0;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            slots[i].submitted = false;
+            --pending;
+            ++completing;
+            bytes_sent += static_cast<std::uint64_t>(t.end() - t.begin());
+            ++transfers_sent;
+            if (status != LIBUSB_TRANSFER_COMPLETED)
+            {
+                lost = static_cast<std::size_t>(t.get()->length - t.get()->actual_length);
+            }
+            free_slots.push_back(i);
+            r = zlp_due ? submit_zero_length() : maybe_flush(clock::now());
+        }
+        if (status != LIBUSB_TRANSFER_COMPLETED && on_error)
+        {
+            on_error(status, lost);
+        }
+        if (r != 0 && on_error)
+        {
+            on_error(LIBUSB_TRANSFER_ERROR, 0);
+        }
+        std::lock_guard<std::mutex> lock{mtx};
+        if (--completing == 0 && pending == 0)
+        {
+            idle.notify_all();
+        }
+    }
+
+public:
+    bulk_out_pipe(device_handle &dev, endpoint_address ep, std::size_t transfer_count, std::size_t transfer_size)
+        : bulk_out_pipe(dev, ep, 0, transfer_count, transfer_size)
+    {
+    }
+    //writes to one of the streams allocated with device_handle::alloc_streams, 0 writes to the endpoint itself.
+    //with one pipe per stream id every stream coalesces and flushes on its own
+    bulk_out_pipe(device_handle &dev, endpoint_address ep, std::uint32_t stream_id, std::size_t transfer_count, std::size_t transfer_size)
+        : packet_size{packet_size_of(dev, ep)},
+          transfer_size{(std::max<std::size_t>(transfer_size, 1) + packet_size - 1) / packet_size * packet_size},
+          arena(dev, this->transfer_size, transfer_count)
+    {
+        slots.reserve(transfer_count);
+        free_slots.reserve(transfer_count);
+        for (std::size_t i = 0; i < transfer_count; ++i)
+        {
+            slots.push_back(slot{stream_id == 0 ? dev.async_bulk_transfer(ep, slot_callback{this, i}) : dev.async_bulk_stream_transfer(ep, stream_id, slot_callback{this, i}),
+                                 arena.acquire()});
+            free_slots.push_back(transfer_count - 1 - i);
+        }
+    }
+    bulk_out_pipe(const bulk_out_pipe &) = delete;
+    bulk_out_pipe &operator=(const bulk_out_pipe &) = delete;
+    ~bulk_out_pipe()
+    {
+        cancel();
+        std::unique_lock<std::mutex> lock{mtx};
+        idle.wait(lock, [this] { return pending == 0 && completing == 0; });
+    }
+
+    //true if all transfers and buffers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : slots)
+        {
+            if (!s.t || !s.buffer)
+            {
+                return false;
+            }
+        }
+        return !slots.empty();
+    }
+
+    //copies as much of [begin, end) as fits into the free buffers and returns
+    //the number of bytes taken, less than requested means all buffers are
+    //busy and the rest has to be written again once transfers completed.
+    //if a transfer can not be submitted the error callback is called and
+    //its data stays buffered until the next write, flush or completion
+    std::size_t write(const unsigned char *begin, const unsigned char *end)
+    {
+        std::size_t taken = 0;
+        int r = 0;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto now = clock::now();
+            while (begin != end)
+            {
+                if (filling == none)
+                {
+                    //the zero length packet of an earlier flush goes out before the new data
+                    if (zlp_due && (r = submit_zero_length()) != 0)
+                    {
+                        break;
+                    }
+                    if (zlp_due || free_slots.empty())
+                    {
+                        break;
+                    }
+                    filling = free_slots.back();
+                    free_slots.pop_back();
+                    fill = 0;
+                    fill_started = now;
+                }
+                std::size_t n = std::min(static_cast<std::size_t>(end - begin), transfer_size - fill);
+                std::memcpy(slots[filling].buffer.begin() + fill, begin, n);
+                fill += n;
+                begin += n;
+                taken += n;
+                if (fill == transfer_size)
+                {
+                    //a full buffer is part of a longer write, so it never gets a zero length packet
+                    if ((r = submit_filling(false)) != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (r == 0)
+            {
+                r = maybe_flush(now);
+            }
+        }
+        if (r != 0 && on_error)
+        {
+            on_error(LIBUSB_TRANSFER_ERROR, 0);
+        }
+        return taken;
+    }
+    //submits the partially filled buffer right away, or a zero length
+    //packet if the data written so far ended with a full buffer.
+    //returns 0 on success or a libusb error code
+    int flush() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        if (filling != none && fill != 0)
+        {
+            return submit_filling(true);
+        }
+        return zlp && open_end ? submit_zero_length() : 0;
+    }
+    //applies the flush deadline, has to be called regularly if a
+    //deadline is set and no further writes or completions happen
+    int poll() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return maybe_flush(clock::now());
+    }
+    //cancels all submitted transfers, their callbacks still have to be handled
+    void cancel() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        for (auto &s : slots)
+        {
+            if (s.submitted)
+            {
+                s.t.cancel();
+            }
+        }
+    }
+
+    //zero keeps a partial buffer only while transfers are in flight,
+    //anything else holds it until it is full or has waited this long
+    void set_flush_deadline(std::chrono::microseconds d)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        deadline = std::chrono::duration_cast<clock::duration>(d);
+    }
+    //terminates flushed buffers which end on a packet boundary with a zero length packet
+    void set_zero_length_packets(bool on)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        zlp = on;
+    }
+    void set_timeout(std::chrono::milliseconds t)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        for (auto &s : slots)
+        {
+            s.t.set_timeout(t);
+        }
+    }
+    //called for every transfer which failed with its status and the number of bytes which were lost
+    void set_error_callback(std::function<void(libusb_transfer_status, std::size_t)> f)
+    {
+        on_error = std::move(f);
+    }
+
+    //number of transfers which are currently owned by libusb
+    std::size_t in_flight() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return pending;
+    }
+    //number of bytes write() takes right now without returning short
+    std::size_t get_writable() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return free_slots.size() * transfer_size + (filling != none ? transfer_size - fill : 0);
+    }
+    std::uint64_t get_bytes_sent() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return bytes_sent;
+    }
+    std::uint64_t get_transfers_sent() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return transfers_sent;
+    }
+    std::size_t get_transfer_size() const noexcept
+    {
+        return transfer_size;
+    }
+    std::size_t get_packet_size() const noexcept
+    {
+        return packet_size;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
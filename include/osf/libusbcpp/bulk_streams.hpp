@@ -0,0 +1,101 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "error.hpp"
+#include "sum_type.hpp"
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//usb 3.0 bulk streams on a set of endpoints of one device handle
+//every endpoint gets the stream ids 1 to size(). the device keeps a queue
+//per stream, so a stream which waits for data does not hold up the others
+//on the same endpoint. transfers pick their stream through
+//device_handle::async_bulk_stream_transfer or the stream id of the pipes.
+//the streams are freed once this object is destroyed
+//note: the device handle has to outlive this object and no transfer
+//may be submitted on the streams any more when it is destroyed
+class bulk_streams
+{
+    friend class device_handle;
+    backend *be = nullptr;
+    libusb_device_handle *dev = nullptr;
+    std::vector<unsigned char> endpoints{};
+    std::uint32_t count = 0;
+    bulk_streams(backend *b, libusb_device_handle *d, std::vector<unsigned char> eps, std::uint32_t n)
+        : be{b}, dev{d}, endpoints{std::move(eps)}, count{n}
+    {
+    }
+
+public:
+    bulk_streams(const bulk_streams &) = delete;
+    bulk_streams &operator=(const bulk_streams &) = delete;
+    bulk_streams(bulk_streams &&other) noexcept
+        : be{other.be}, dev{other.dev}, endpoints{std::move(other.endpoints)}, count{other.count}
+    {
+        other.dev = nullptr;
+    }
+    bulk_streams &operator=(bulk_streams &&other) noexcept
+    {
+        free();
+        be = other.be;
+        dev = other.dev;
+        endpoints = std::move(other.endpoints);
+        count = other.count;
+        other.dev = nullptr;
+        return *this;
+    }
+    ~bulk_streams()
+    {
+        free();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return dev != nullptr;
+    }
+    //the number of streams every endpoint got, which may be
+    //less than requested if the device supports fewer
+    std::uint32_t size() const noexcept
+    {
+        return count;
+    }
+    //frees the streams early, returns 0 on success or a libusb error code
+    int free() noexcept
+    {
+        if (dev == nullptr)
+        {
+            return 0;
+        }
+        int r = be->free_streams(dev, endpoints.data(), static_cast<int>(endpoints.size()));
+        dev = nullptr;
+        return r;
+    }
+};
+
+inline sum_type<bulk_streams, error> device_handle::alloc_streams(std::uint32_t num_streams, const std::vector<endpoint_address> &endpoints)
+{
+    std::vector<unsigned char> eps;
+    eps.reserve(endpoints.size());
+    for (auto ep : endpoints)
+    {
+        eps.push_back(static_cast<unsigned char>(ep));
+    }
+    if (int r = be->alloc_streams(dev, num_streams, eps.data(), static_cast<int>(eps.size())); r > 0)
+    {
+        return bulk_streams{be, dev, std::move(eps), static_cast<std::uint32_t>(r)};
+    }
+    else
+    {
+        return error(r == 0 ? LIBUSB_ERROR_OTHER : r);
+    }
+}
+
+} // namespace libusbcpp
+} // namespace osf
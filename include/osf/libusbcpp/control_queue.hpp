@@ -0,0 +1,301 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <deque>
+#include <future>
+#include <variant>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "error.hpp"
+#include "sum_type.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//keeps several control requests of one device in flight
+//every blocking libusb_control_transfer costs a full round trip through the
+//kernel and the host controller, so configuring a device with thousands of
+//register writes is dominated by the waiting. the queue submits up to depth
+//requests at once and keeps the rest waiting in order, the device still
+//handles them one after the other in the order they were queued, but the
+//round trips overlap.
+//every request returns a future which is ready once the request completed,
+//since the requests complete in order, waiting for the last future of a
+//batch is enough to know the whole batch completed:
+//    control_queue q{handle};
+//    std::future<control_queue::write_result> last;
+//    for (auto &r : registers)
+//        last = q.write(0x40, 0x01, r.address, 0, r.bytes, r.bytes + 4);
+//    last.get()(...);
+//the futures are completed on the thread which calls handle_events on the
+//context, which must not be the thread waiting for them
+//note: the destructor cancels the requests and blocks until libusb handed all
+//transfers back, so either another thread handles the events meanwhile (see
+//context::start_event_thread) or cancel() is called first and the events are
+//handled until in_flight() returns 0. it must not be destroyed from the thread
+//which handles the events
+class control_queue
+{
+public:
+    //the received data stage of a read
+    using read_result = sum_type<std::vector<unsigned char>, error>;
+    //the number of bytes of the data stage a write sent
+    using write_result = sum_type<std::size_t, error>;
+
+private:
+    struct pending_request
+    {
+        std::uint8_t request_type = 0;
+        std::uint8_t request = 0;
+        std::uint16_t value = 0;
+        std::uint16_t index = 0;
+        std::uint16_t length = 0;
+        std::vector<unsigned char> data{}; //the data stage of a write
+        std::variant<std::promise<read_result>, std::promise<write_result>> result{};
+    };
+    //completion callback of the slot with the given index
+    struct slot_callback
+    {
+        control_queue *queue;
+        std::size_t index;
+        template <typename T>
+        void operator()(T &)
+        {
+            queue->complete(index);
+        }
+    };
+    using slot_transfer = basic_transfer<slot_callback>;
+    struct slot
+    {
+        slot_transfer t;
+        //the setup packet followed by the data stage, keeps its capacity between requests
+        std::vector<unsigned char> buffer{};
+        pending_request req{};
+        bool busy = false;
+    };
+
+    std::vector<slot> slots;
+    std::deque<pending_request> waiting;
+    std::size_t busy = 0;
+    std::mutex mtx;
+    //notified once no request is submitted any more
+    std::condition_variable idle;
+
+    //the data of a read is in req.data, length is the size of the data stage which was transferred
+    static void fulfill(pending_request &req, int code, std::size_t length)
+    {
+        if (auto *p = std::get_if<std::promise<read_result>>(&req.result))
+        {
+            p->set_value(code == 0 ? read_result{std::move(req.data)} : read_result{error(code)});
+        }
+        else
+        {
+            auto &w = std::get<std::promise<write_result>>(req.result);
+            w.set_value(code == 0 ? write_result{length} : write_result{error(code)});
+        }
+    }
+    //expects the lock to be held, returns 0 or the error of the submission
+    int start(std::size_t i, pending_request &&req)
+    {
+        auto &s = slots[i];
+        s.req = std::move(req);
+        s.buffer.resize(LIBUSB_CONTROL_SETUP_SIZE + s.req.length);
+        std::copy(s.req.data.begin(), s.req.data.end(), s.buffer.begin() + LIBUSB_CONTROL_SETUP_SIZE);
+        s.t.set_control_setup(s.buffer.data(), s.buffer.data() + s.buffer.size(), s.req.request_type, s.req.request, s.req.value, s.req.index);
+        if (int r = s.t.submit(); r != 0)
+        {
+            return r;
+        }
+        s.busy = true;
+        ++busy;
+        return 0;
+    }
+    //submits the next waiting requests, expects the lock to be held.
+    //the requests whose submission failed are moved to failed, their slot
+    //stays free and takes the next request, so no request is left waiting
+    //while a slot is free, e.g. after the device is gone
+    void start_waiting(std::vector<std::pair<pending_request, int>> &failed)
+    {
+        for (std::size_t i = 0; i < slots.size() && !waiting.empty(); ++i)
+        {
+            while (!slots[i].busy && !waiting.empty())
+            {
+                if (int r = start(i, std::move(waiting.front())); r != 0)
+                {
+                    failed.emplace_back(std::move(slots[i].req), r);
+                }
+                waiting.pop_front();
+            }
+        }
+    }
+    void enqueue(pending_request req)
+    {
+        std::vector<std::pair<pending_request, int>> failed;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            waiting.push_back(std::move(req));
+            start_waiting(failed);
+        }
+        for (auto &f : failed)
+        {
+            fulfill(f.first, f.second, 0);
+        }
+    }
+    void complete(std::size_t i)
+    {
+        pending_request done;
+        int code;
+        std::size_t length;
+        std::vector<std::pair<pending_request, int>> failed;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto &s = slots[i];
+            s.busy = false;
+            --busy;
+            done = std::move(s.req);
+            code = status_error_code(s.t.get_status());
+            length = static_cast<std::size_t>(s.t.end() - s.t.begin());
+            //the data is copied out before the slot is reused
+            if (code == 0 && (done.request_type & LIBUSB_ENDPOINT_IN))
+            {
+                done.data.assign(s.t.begin(), s.t.end());
+            }
+            start_waiting(failed);
+            if (busy == 0)
+            {
+                idle.notify_all();
+            }
+        }
+        fulfill(done, code, length);
+        for (auto &f : failed)
+        {
+            fulfill(f.first, f.second, 0);
+        }
+    }
+
+public:
+    //depth is the number of requests which are in flight at once
+    explicit control_queue(device_handle &dev, std::size_t depth = 8)
+    {
+        slots.reserve(depth);
+        for (std::size_t i = 0; i < depth; ++i)
+        {
+            slots.push_back(slot{dev.async_control_transfer(slot_callback{this, i})});
+        }
+    }
+    control_queue(const control_queue &) = delete;
+    control_queue &operator=(const control_queue &) = delete;
+    ~control_queue()
+    {
+        cancel();
+        std::unique_lock<std::mutex> lock{mtx};
+        idle.wait(lock, [this] { return busy == 0; });
+    }
+
+    //true if all transfers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : slots)
+        {
+            if (!s.t)
+            {
+                return false;
+            }
+        }
+        return !slots.empty();
+    }
+
+    //the timeout of every request, 0 waits forever
+    void set_timeout(std::chrono::milliseconds t)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        for (auto &s : slots)
+        {
+            s.t.set_timeout(t);
+        }
+    }
+
+    //queues a request with a data stage of length bytes from the device,
+    //the direction bit is set in request_type
+    std::future<read_result> read(std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, std::uint16_t length)
+    {
+        pending_request r;
+        r.request_type = static_cast<std::uint8_t>(request_type | LIBUSB_ENDPOINT_IN);
+        r.request = request;
+        r.value = value;
+        r.index = index;
+        r.length = length;
+        std::promise<read_result> p;
+        auto f = p.get_future();
+        r.result = std::move(p);
+        enqueue(std::move(r));
+        return f;
+    }
+    //queues a request which sends [begin, end) as its data stage, the data is copied,
+    //the direction bit is cleared in request_type. a data stage longer than 65535
+    //bytes fails right away with LIBUSB_ERROR_INVALID_PARAM
+    std::future<write_result> write(std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, const unsigned char *begin, const unsigned char *end)
+    {
+        if (end - begin > 0xffff)
+        {
+            std::promise<write_result> p;
+            p.set_value(write_result{error(LIBUSB_ERROR_INVALID_PARAM)});
+            return p.get_future();
+        }
+        pending_request r;
+        r.request_type = static_cast<std::uint8_t>(request_type & ~LIBUSB_ENDPOINT_IN);
+        r.request = request;
+        r.value = value;
+        r.index = index;
+        r.length = static_cast<std::uint16_t>(end - begin);
+        r.data.assign(begin, end);
+        std::promise<write_result> p;
+        auto f = p.get_future();
+        r.result = std::move(p);
+        enqueue(std::move(r));
+        return f;
+    }
+
+    //fails the waiting requests with LIBUSB_ERROR_INTERRUPTED and cancels the submitted ones,
+    //whose futures are completed once their callbacks were handled
+    void cancel() noexcept
+    {
+        std::deque<pending_request> dropped;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            std::swap(dropped, waiting);
+            for (auto &s : slots)
+            {
+                if (s.busy)
+                {
+                    s.t.cancel();
+                }
+            }
+        }
+        for (auto &r : dropped)
+        {
+            fulfill(r, LIBUSB_ERROR_INTERRUPTED, 0);
+        }
+    }
+    //number of requests which are submitted to libusb
+    std::size_t in_flight() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return busy;
+    }
+    //number of requests which wait for a free transfer
+    std::size_t queued() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return waiting.size();
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
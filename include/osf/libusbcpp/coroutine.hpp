@@ -0,0 +1,141 @@
+#pragma once
+//only available with compiler support for C++20 coroutines
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include "libusb.h"
+#include <coroutine>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include "sum_type.hpp"
+#include "error.hpp"
+#include "descriptor.hpp"
+#include "transfer.hpp"
+#include "transfer_pool.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//resumes the awaiting coroutine right away on the thread which handles the events
+struct inline_executor
+{
+    void post(std::coroutine_handle<> h) const
+    {
+        h.resume();
+    }
+};
+
+//awaits the completion of one transfer borrowed from a transfer_pool
+//the awaitable lives in the coroutine frame and the transfer comes from the
+//pool, so awaiting allocates nothing. once the transfer completed the
+//coroutine is handed to ex.post, which may resume it inline or queue it
+//on another thread. the result is the end of the transferred data or a
+//libusb error code, LIBUSB_ERROR_NO_MEM if the pool was exhausted.
+//note: an awaitable has to be awaited exactly once
+template <typename Executor>
+class transfer_awaitable
+{
+    transfer_pool::lease l;
+    Executor ex;
+    std::coroutine_handle<> waiter;
+    unsigned char *data = nullptr; //start of the payload in the transfer buffer
+    int result = 0;
+
+public:
+    transfer_awaitable(transfer_pool::lease lease, Executor e, unsigned char *payload, int r = 0) noexcept
+        : l{std::move(lease)}, ex{std::move(e)}, data{payload}, result{r != 0 || l ? r : LIBUSB_ERROR_NO_MEM}
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return result != 0;
+    }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        waiter = h;
+        //only a pointer is captured, which std::function stores without allocating
+        l->set_callback([this](transfer &) {
+            ex.post(waiter);
+        });
+        if (int r = l->submit(); r != 0)
+        {
+            result = r;
+            return false;
+        }
+        //the coroutine may already be resumed on the event thread from here on
+        return true;
+    }
+    sum_type<unsigned char *, error> await_resume() noexcept
+    {
+        if (result == 0)
+        {
+            result = status_error_code(l->get_status());
+        }
+        if (result != 0)
+        {
+            return error(result);
+        }
+        return data + l->get()->actual_length;
+    }
+};
+
+namespace detail
+{
+template <typename Executor>
+transfer_awaitable<Executor> make_awaitable(transfer_pool &pool, libusb_transfer_type type, endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex, unsigned char *payload)
+{
+    auto l = pool.acquire();
+    if (l)
+    {
+        l->get()->type = type;
+        l->set_endpoint(ep);
+        l->set_buffer(begin, end);
+        l->set_timeout(timeout);
+    }
+    return transfer_awaitable<Executor>{std::move(l), std::move(ex), payload};
+}
+} // namespace detail
+
+//reads from a bulk IN endpoint into [begin, end)
+//    auto r = co_await async_read(pool, endpoint_address(0x81), buf, buf + 512, 100ms);
+template <typename Executor = inline_executor>
+transfer_awaitable<Executor> async_read(transfer_pool &pool, endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex = {})
+{
+    return detail::make_awaitable(pool, LIBUSB_TRANSFER_TYPE_BULK, ep, begin, end, timeout, std::move(ex), begin);
+}
+//writes [begin, end) to a bulk OUT endpoint
+template <typename Executor = inline_executor>
+transfer_awaitable<Executor> async_write(transfer_pool &pool, endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex = {})
+{
+    return detail::make_awaitable(pool, LIBUSB_TRANSFER_TYPE_BULK, ep, begin, end, timeout, std::move(ex), begin);
+}
+//reads from an interrupt IN endpoint into [begin, end)
+template <typename Executor = inline_executor>
+transfer_awaitable<Executor> async_interrupt_read(transfer_pool &pool, endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex = {})
+{
+    return detail::make_awaitable(pool, LIBUSB_TRANSFER_TYPE_INTERRUPT, ep, begin, end, timeout, std::move(ex), begin);
+}
+//writes [begin, end) to an interrupt OUT endpoint
+template <typename Executor = inline_executor>
+transfer_awaitable<Executor> async_interrupt_write(transfer_pool &pool, endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex = {})
+{
+    return detail::make_awaitable(pool, LIBUSB_TRANSFER_TYPE_INTERRUPT, ep, begin, end, timeout, std::move(ex), begin);
+}
+//control transfer on endpoint 0
+//[begin, end) holds room for the setup packet (LIBUSB_CONTROL_SETUP_SIZE bytes)
+//followed by the data stage, the setup packet is filled in here.
+//the result is the end of the data which was actually transferred
+template <typename Executor = inline_executor>
+transfer_awaitable<Executor> async_control(transfer_pool &pool, std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout, Executor ex = {})
+{
+    if (end - begin < static_cast<std::ptrdiff_t>(LIBUSB_CONTROL_SETUP_SIZE))
+    {
+        return transfer_awaitable<Executor>{transfer_pool::lease{}, std::move(ex), begin, LIBUSB_ERROR_INVALID_PARAM};
+    }
+    libusb_fill_control_setup(begin, request_type, request, value, index, static_cast<std::uint16_t>(end - begin - LIBUSB_CONTROL_SETUP_SIZE));
+    return detail::make_awaitable(pool, LIBUSB_TRANSFER_TYPE_CONTROL, endpoint_address(0), begin, end, timeout, std::move(ex), begin + LIBUSB_CONTROL_SETUP_SIZE);
+}
+} // namespace libusbcpp
+} // namespace osf
+#endif
@@ -5,6 +5,7 @@
 #include <utility>
 #include "error.hpp"
 #include "sum_type.hpp"
+#include "backend.hpp"
 
 namespace osf
 {
@@ -31,13 +32,14 @@ class interface_range;
 class config_descriptor
 {
     friend class device;
+    backend *be = nullptr;
     const libusb_config_descriptor *pcfg = nullptr;
-    config_descriptor(const libusb_config_descriptor *p) : pcfg{p} {}
+    config_descriptor(backend *b, const libusb_config_descriptor *p) : be{b}, pcfg{p} {}
     void free() const noexcept
     {
         if (pcfg != nullptr)
         {
-            libusb_free_config_descriptor(const_cast<libusb_config_descriptor *>(pcfg));
+            be->free_config_descriptor(const_cast<libusb_config_descriptor *>(pcfg));
         }
     }
 
@@ -46,13 +48,16 @@ public:
     config_descriptor &operator=(const config_descriptor &) = delete;
     config_descriptor(config_descriptor &&other) noexcept
     {
+        std::swap(be, other.be);
         std::swap(pcfg, other.pcfg);
     }
     config_descriptor &operator=(config_descriptor &&other) noexcept
     {
         free();
+        be = other.be;
         pcfg = other.pcfg;
         other.pcfg = nullptr;
+        return *this;
     }
     ~config_descriptor()
     {
@@ -69,8 +74,9 @@ public:
 class device_list_iterator
 {
     friend class device_list;
+    backend *be;
     libusb_device **pdev;
-    device_list_iterator(libusb_device **d) noexcept : pdev{d} {}
+    device_list_iterator(backend *b, libusb_device **d) noexcept : be{b}, pdev{d} {}
 
 public:
     device_list_iterator &operator++() noexcept
@@ -81,7 +87,7 @@ public:
     device_list_iterator operator++(int) noexcept
     {
         auto p = pdev++;
-        return device_list_iterator{p};
+        return device_list_iterator{be, p};
     }
     device operator*() const noexcept;
     friend bool operator==(const device_list_iterator &lhs, const device_list_iterator &rhs) noexcept
@@ -148,7 +154,7 @@ public:
     }
     bool is_in() const noexcept
     {
-        return pdesc->bEndpointAddress | LIBUSB_ENDPOINT_IN;
+        return (pdesc->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
     }
     bool is_out() const noexcept
     {
@@ -391,13 +397,13 @@ public:
     }
 };
 
-interface_range config_descriptor::get_interfaces() const noexcept
+inline interface_range config_descriptor::get_interfaces() const noexcept
 {
     return interface_range(
         interface_iterator{&(pcfg->interface[0])},
         interface_iterator{&(pcfg->interface[pcfg->bNumInterfaces])});
 }
-interface_descriptor_range interface::get_interface_descriptors() const noexcept
+inline interface_descriptor_range interface::get_interface_descriptors() const noexcept
 {
     return interface_descriptor_range(
         interface_descriptor_iterator{&(pdesc->altsetting[0])},
@@ -0,0 +1,276 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "error.hpp"
+#include "sum_type.hpp"
+#include "descriptor.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//one endpoint of a descriptor_index, a plain copy which outlives the index
+struct endpoint_info
+{
+    std::uint8_t address;
+    std::uint8_t attributes;
+    std::uint16_t max_packet_size;
+    std::uint8_t interval;
+    std::uint8_t interface_number;
+    std::uint8_t alternate_setting;
+
+    endpoint_address get_ep_address() const noexcept
+    {
+        return endpoint_address(address);
+    }
+    libusb_endpoint_transfer_type get_type() const noexcept
+    {
+        return static_cast<libusb_endpoint_transfer_type>(attributes & LIBUSB_TRANSFER_TYPE_MASK);
+    }
+    bool is_in() const noexcept
+    {
+        return (address & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+    }
+    bool is_out() const noexcept
+    {
+        return !is_in();
+    }
+};
+
+//one alternate setting of an interface of a descriptor_index
+struct altsetting_info
+{
+    std::uint8_t interface_number;
+    std::uint8_t alternate_setting;
+    std::uint8_t interface_class;
+    std::uint8_t interface_subclass;
+    std::uint8_t interface_protocol;
+    std::uint8_t endpoint_count;
+};
+
+//owning, flat copy of the interfaces, alternate settings and endpoints of a
+//config descriptor. every field is stored in its own contiguous column, so
+//a lookup touches a few cache lines instead of chasing the nested libusb
+//structures, and answers the common questions in constant time through
+//tables which are filled once on construction:
+//    auto ep = index.find_endpoint(0, LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK, LIBUSB_ENDPOINT_IN);
+//the index does not refer to the config descriptor it was built from
+//and is immutable, so it may be cached and read from any thread
+class descriptor_index
+{
+    static constexpr std::int16_t none = -1;
+
+    //alternate setting columns, the settings of an interface are adjacent
+    std::vector<std::uint8_t> alt_interface;
+    std::vector<std::uint8_t> alt_setting;
+    std::vector<std::uint8_t> alt_class;
+    std::vector<std::uint8_t> alt_subclass;
+    std::vector<std::uint8_t> alt_protocol;
+    std::vector<std::uint16_t> alt_first_endpoint;
+    std::vector<std::uint8_t> alt_endpoint_count;
+    //first endpoint of every transfer type and direction, see kind_of
+    std::vector<std::array<std::int16_t, 8>> alt_by_kind;
+
+    //endpoint columns, the endpoints of an alternate setting are adjacent
+    std::vector<std::uint8_t> ep_address;
+    std::vector<std::uint8_t> ep_attributes;
+    std::vector<std::uint16_t> ep_max_packet_size;
+    std::vector<std::uint8_t> ep_interval;
+    std::vector<std::uint16_t> ep_altsetting;
+
+    //first alternate setting of every interface number
+    std::vector<std::int16_t> interface_first_alt;
+    //the endpoints of the default alternate settings by address,
+    //indexed by endpoint number plus 16 for IN endpoints
+    std::array<std::int16_t, 32> by_address;
+    std::size_t interfaces = 0;
+
+    static std::size_t kind_of(libusb_endpoint_transfer_type type, bool in) noexcept
+    {
+        return static_cast<std::size_t>(type) * 2 + (in ? 1 : 0);
+    }
+    static std::size_t address_slot(std::uint8_t address) noexcept
+    {
+        return (address & LIBUSB_ENDPOINT_ADDRESS_MASK) | ((address & LIBUSB_ENDPOINT_DIR_MASK) ? 16 : 0);
+    }
+    endpoint_info endpoint_at(std::size_t i) const noexcept
+    {
+        std::size_t alt = ep_altsetting[i];
+        return endpoint_info{ep_address[i], ep_attributes[i], ep_max_packet_size[i], ep_interval[i], alt_interface[alt], alt_setting[alt]};
+    }
+    //index of the alternate setting or none
+    std::int16_t find_alt(std::uint8_t interface_number, std::uint8_t alternate_setting) const noexcept
+    {
+        if (interface_number >= interface_first_alt.size() || interface_first_alt[interface_number] == none)
+        {
+            return none;
+        }
+        std::size_t first = static_cast<std::size_t>(interface_first_alt[interface_number]);
+        //alternate settings are numbered in order almost always
+        std::size_t guess = first + alternate_setting;
+        if (guess < alt_setting.size() && alt_interface[guess] == interface_number && alt_setting[guess] == alternate_setting)
+        {
+            return static_cast<std::int16_t>(guess);
+        }
+        for (std::size_t i = first; i < alt_interface.size() && alt_interface[i] == interface_number; ++i)
+        {
+            if (alt_setting[i] == alternate_setting)
+            {
+                return static_cast<std::int16_t>(i);
+            }
+        }
+        return none;
+    }
+
+public:
+    explicit descriptor_index(const config_descriptor &cfg) : descriptor_index(cfg.get()) {}
+    explicit descriptor_index(const libusb_config_descriptor *cfg)
+    {
+        by_address.fill(none);
+        if (cfg == nullptr)
+        {
+            return;
+        }
+        interfaces = cfg->bNumInterfaces;
+        std::size_t alt_count = 0;
+        std::size_t ep_count = 0;
+        for (int i = 0; i < cfg->bNumInterfaces; ++i)
+        {
+            auto &intf = cfg->interface[i];
+            alt_count += static_cast<std::size_t>(intf.num_altsetting);
+            for (int a = 0; a < intf.num_altsetting; ++a)
+            {
+                ep_count += intf.altsetting[a].bNumEndpoints;
+            }
+        }
+        for (auto *column : {&alt_interface, &alt_setting, &alt_class, &alt_subclass, &alt_protocol, &alt_endpoint_count})
+        {
+            column->reserve(alt_count);
+        }
+        alt_first_endpoint.reserve(alt_count);
+        alt_by_kind.reserve(alt_count);
+        for (auto *column : {&ep_address, &ep_attributes, &ep_interval})
+        {
+            column->reserve(ep_count);
+        }
+        ep_max_packet_size.reserve(ep_count);
+        ep_altsetting.reserve(ep_count);
+
+        for (int i = 0; i < cfg->bNumInterfaces; ++i)
+        {
+            auto &intf = cfg->interface[i];
+            for (int a = 0; a < intf.num_altsetting; ++a)
+            {
+                auto &alt = intf.altsetting[a];
+                auto alt_index = static_cast<std::uint16_t>(alt_interface.size());
+                if (alt.bInterfaceNumber >= interface_first_alt.size())
+                {
+                    interface_first_alt.resize(alt.bInterfaceNumber + 1u, none);
+                }
+                if (interface_first_alt[alt.bInterfaceNumber] == none)
+                {
+                    interface_first_alt[alt.bInterfaceNumber] = static_cast<std::int16_t>(alt_index);
+                }
+                alt_interface.push_back(alt.bInterfaceNumber);
+                alt_setting.push_back(alt.bAlternateSetting);
+                alt_class.push_back(alt.bInterfaceClass);
+                alt_subclass.push_back(alt.bInterfaceSubClass);
+                alt_protocol.push_back(alt.bInterfaceProtocol);
+                alt_first_endpoint.push_back(static_cast<std::uint16_t>(ep_address.size()));
+                alt_endpoint_count.push_back(alt.bNumEndpoints);
+                alt_by_kind.emplace_back();
+                alt_by_kind.back().fill(none);
+                for (int e = 0; e < alt.bNumEndpoints; ++e)
+                {
+                    auto &ep = alt.endpoint[e];
+                    auto ep_index = static_cast<std::int16_t>(ep_address.size());
+                    ep_address.push_back(ep.bEndpointAddress);
+                    ep_attributes.push_back(ep.bmAttributes);
+                    ep_max_packet_size.push_back(ep.wMaxPacketSize);
+                    ep_interval.push_back(ep.bInterval);
+                    ep_altsetting.push_back(alt_index);
+                    auto type = static_cast<libusb_endpoint_transfer_type>(ep.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK);
+                    auto &slot = alt_by_kind.back()[kind_of(type, (ep.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) != 0)];
+                    if (slot == none)
+                    {
+                        slot = ep_index;
+                    }
+                    if (a == 0 && by_address[address_slot(ep.bEndpointAddress)] == none)
+                    {
+                        by_address[address_slot(ep.bEndpointAddress)] = ep_index;
+                    }
+                }
+            }
+        }
+    }
+
+    //the first endpoint of the given transfer type and direction of an alternate setting
+    sum_type<endpoint_info, error> find_endpoint(std::uint8_t interface_number, libusb_endpoint_transfer_type type, libusb_endpoint_direction dir, std::uint8_t alternate_setting = 0) const noexcept
+    {
+        auto alt = find_alt(interface_number, alternate_setting);
+        if (alt == none)
+        {
+            return error(LIBUSB_ERROR_NOT_FOUND);
+        }
+        auto ep = alt_by_kind[static_cast<std::size_t>(alt)][kind_of(type, dir == LIBUSB_ENDPOINT_IN)];
+        if (ep == none)
+        {
+            return error(LIBUSB_ERROR_NOT_FOUND);
+        }
+        return endpoint_at(static_cast<std::size_t>(ep));
+    }
+    //the endpoint with the given address in the default alternate settings
+    sum_type<endpoint_info, error> find_endpoint(endpoint_address address) const noexcept
+    {
+        auto ep = by_address[address_slot(static_cast<unsigned char>(address))];
+        if (ep == none)
+        {
+            return error(LIBUSB_ERROR_NOT_FOUND);
+        }
+        return endpoint_at(static_cast<std::size_t>(ep));
+    }
+    sum_type<altsetting_info, error> find_altsetting(std::uint8_t interface_number, std::uint8_t alternate_setting = 0) const noexcept
+    {
+        auto alt = find_alt(interface_number, alternate_setting);
+        if (alt == none)
+        {
+            return error(LIBUSB_ERROR_NOT_FOUND);
+        }
+        return get_altsetting(static_cast<std::size_t>(alt));
+    }
+
+    //number of interfaces of the configuration
+    std::size_t interface_count() const noexcept
+    {
+        return interfaces;
+    }
+    //number of alternate settings of all interfaces
+    std::size_t altsetting_count() const noexcept
+    {
+        return alt_interface.size();
+    }
+    //number of endpoints of all alternate settings
+    std::size_t endpoint_count() const noexcept
+    {
+        return ep_address.size();
+    }
+    altsetting_info get_altsetting(std::size_t i) const noexcept
+    {
+        return altsetting_info{alt_interface[i], alt_setting[i], alt_class[i], alt_subclass[i], alt_protocol[i], alt_endpoint_count[i]};
+    }
+    endpoint_info get_endpoint(std::size_t i) const noexcept
+    {
+        return endpoint_at(i);
+    }
+    //the endpoints of alternate setting i are [first, first + get_altsetting(i).endpoint_count)
+    std::size_t first_endpoint_of(std::size_t i) const noexcept
+    {
+        return alt_first_endpoint[i];
+    }
+};
+
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace detail
+{
+//lock free stack of the indices [0, capacity)
+//the top of the stack carries a tag which is bumped on every change,
+//so a pop can not be fooled by an index which was popped and pushed again
+//between reading the top and swapping it (aba problem)
+class index_free_list
+{
+    static constexpr std::uint32_t empty = 0;
+    //low 32 bit: index + 1 of the top element or empty, high 32 bit: tag
+    std::atomic<std::uint64_t> top{empty};
+    std::unique_ptr<std::atomic<std::uint32_t>[]> next;
+    std::size_t capacity;
+
+    static std::uint64_t pack(std::uint64_t old, std::uint32_t link) noexcept
+    {
+        return (((old >> 32) + 1) << 32) | link;
+    }
+
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    //the list starts out full
+    explicit index_free_list(std::size_t n) : next{new std::atomic<std::uint32_t>[n]}, capacity{n}
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            next[i].store(static_cast<std::uint32_t>(i + 2 <= n ? i + 2 : empty), std::memory_order_relaxed);
+        }
+        top.store(n != 0 ? 1 : empty, std::memory_order_release);
+    }
+    index_free_list(const index_free_list &) = delete;
+    index_free_list &operator=(const index_free_list &) = delete;
+
+    //returns npos if the list is empty
+    std::size_t pop() noexcept
+    {
+        std::uint64_t old = top.load(std::memory_order_acquire);
+        for (;;)
+        {
+            std::uint32_t link = static_cast<std::uint32_t>(old);
+            if (link == empty)
+            {
+                return npos;
+            }
+            std::uint32_t after = next[link - 1].load(std::memory_order_relaxed);
+            if (top.compare_exchange_weak(old, pack(old, after), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return link - 1;
+            }
+        }
+    }
+    void push(std::size_t i) noexcept
+    {
+        std::uint64_t old = top.load(std::memory_order_relaxed);
+        do
+        {
+            next[i].store(static_cast<std::uint32_t>(old), std::memory_order_relaxed);
+        } while (!top.compare_exchange_weak(old, pack(old, static_cast<std::uint32_t>(i + 1)), std::memory_order_release, std::memory_order_relaxed));
+    }
+    std::size_t size() const noexcept
+    {
+        return capacity;
+    }
+};
+} // namespace detail
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,213 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace detail
+{
+template <typename Pipe>
+class pipe_base;
+
+//completion callback of the slot with the given index of a pipe
+template <typename Pipe>
+struct pipe_slot_callback
+{
+    pipe_base<Pipe> *pipe;
+    std::size_t index;
+    template <typename T>
+    void operator()(T &)
+    {
+        pipe->on_callback(index);
+    }
+};
+
+//what bulk_in_pipe, iso_in_pipe and interrupt_poller have in common:
+//a fixed set of slots whose transfers are kept submitted, completions are
+//delivered strictly in submission order and a failed transfer stops the pipe.
+//Pipe derives from it and provides
+//    slots           a vector of slots with a transfer t and a bool done each
+//    deliver(i)      hands the completed slot to the consumer and usually
+//                    gives it back through resubmit(i)
+//and may hide
+//    completed(i)    runs first in the libusb callback, has to call complete(i)
+//    dequeued(i)     runs under the lock once slot i is next to be delivered
+//    starting()      runs under the lock when start submits the transfers
+//the destructor of Pipe has to call drain() before its slots are destroyed
+template <typename Pipe>
+class pipe_base
+{
+    friend struct pipe_slot_callback<Pipe>;
+    //indices of the submitted slots in submission order
+    std::vector<std::size_t> order;
+    std::size_t head = 0;
+    std::size_t pending = 0;
+    //number of completed transfers which are handed to the consumer right now
+    std::size_t delivering = 0;
+    std::condition_variable idle;
+    std::atomic<bool> running{false};
+    std::function<void(libusb_transfer_status)> on_error;
+
+    Pipe &self() noexcept
+    {
+        return static_cast<Pipe &>(*this);
+    }
+    void on_callback(std::size_t i)
+    {
+        self().completed(i);
+    }
+    //expects the lock to be held
+    int submit(std::size_t i) noexcept
+    {
+        if (int r = self().slots[i].t.submit(); r != 0)
+        {
+            return r;
+        }
+        order[(head + pending) % order.size()] = i;
+        ++pending;
+        return 0;
+    }
+
+protected:
+    using slot_callback = pipe_slot_callback<Pipe>;
+
+    std::mutex mtx;
+
+    explicit pipe_base(std::size_t transfer_count) : order(transfer_count) {}
+    ~pipe_base() = default;
+
+    void completed(std::size_t i)
+    {
+        complete(i);
+    }
+    void dequeued(std::size_t) noexcept
+    {
+    }
+    void starting() noexcept
+    {
+    }
+    void complete(std::size_t i)
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        auto &slots = self().slots;
+        slots[i].done = true;
+        //libusb completes transfers of one endpoint in order,
+        //the queue only guards the delivery order in case it does not
+        while (pending != 0 && slots[order[head]].done)
+        {
+            std::size_t next = order[head];
+            head = (head + 1) % order.size();
+            --pending;
+            slots[next].done = false;
+            self().dequeued(next);
+            ++delivering;
+            lock.unlock();
+            self().deliver(next);
+            lock.lock();
+            --delivering;
+        }
+        if (pending == 0 && delivering == 0)
+        {
+            idle.notify_all();
+        }
+    }
+    //submits slot i again unless the pipe was stopped
+    void resubmit(std::size_t i) noexcept
+    {
+        int r = 0;
+        {
+            //checked under the lock, a slot may be given back while stop() runs
+            std::lock_guard<std::mutex> lock{mtx};
+            if (!running.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            r = submit(i);
+        }
+        if (r != 0)
+        {
+            fail(LIBUSB_TRANSFER_ERROR);
+        }
+    }
+    void fail(libusb_transfer_status status)
+    {
+        if (running.load(std::memory_order_acquire))
+        {
+            stop();
+            if (on_error)
+            {
+                on_error(status);
+            }
+        }
+    }
+    //cancels the transfers and blocks until libusb handed all of them back
+    //and no completion is being delivered anymore
+    void drain() noexcept
+    {
+        stop();
+        std::unique_lock<std::mutex> lock{mtx};
+        idle.wait(lock, [this] { return pending == 0 && delivering == 0; });
+    }
+
+public:
+    pipe_base(const pipe_base &) = delete;
+    pipe_base &operator=(const pipe_base &) = delete;
+
+    //called once if a transfer fails, the pipe is stopped at that point
+    void set_error_callback(std::function<void(libusb_transfer_status)> f)
+    {
+        on_error = std::move(f);
+    }
+    //submits all transfers, returns 0 on success or a libusb error code
+    //on failure the already submitted transfers are cancelled again
+    int start() noexcept
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        if (running.load() || pending != 0 || delivering != 0)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        running.store(true);
+        self().starting();
+        for (std::size_t i = 0; i < self().slots.size(); ++i)
+        {
+            if (int r = submit(i); r != 0)
+            {
+                lock.unlock();
+                stop();
+                return r;
+            }
+        }
+        return 0;
+    }
+    //cancels all submitted transfers, their callbacks still have to be handled
+    void stop() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        running.store(false);
+        for (std::size_t n = 0; n < pending; ++n)
+        {
+            self().slots[order[(head + n) % order.size()]].t.cancel();
+        }
+    }
+    bool is_running() const noexcept
+    {
+        return running.load();
+    }
+    //number of transfers which are currently owned by libusb
+    std::size_t in_flight() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return pending;
+    }
+};
+} // namespace detail
+} // namespace libusbcpp
+} // namespace osf
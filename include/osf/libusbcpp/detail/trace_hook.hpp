@@ -0,0 +1,260 @@
+#pragma once
+#include "libusb.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include "../backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace detail
+{
+//one usbmon event of a transfer, see trace_recorder
+struct trace_record
+{
+    std::uint64_t id;
+    char type; //'S' submitted, 'C' completed, 'E' submission failed
+    unsigned char transfer_type; //libusb_transfer_type
+    unsigned char endpoint; //with the direction bit, also for control transfers
+    std::uint8_t device;
+    std::uint8_t bus;
+    std::int32_t status; //a negative errno as usbmon reports it
+    std::uint32_t length; //requested on submission, transferred on completion
+    const unsigned char *setup; //the 8 setup bytes of a control submission or nullptr
+    const unsigned char *data; //the data which went over the bus with this event or nullptr
+    std::uint32_t data_length;
+};
+
+//receives the records of all transfers of the process while it is installed
+class trace_sink
+{
+public:
+    virtual void record(const trace_record &r) noexcept = 0;
+
+protected:
+    ~trace_sink() = default;
+};
+
+inline std::atomic<trace_sink *> active_trace{nullptr};
+
+//every thread which called into a sink has one of these, uninstalling a sink
+//waits until none of them is inside it. the counter is only written by its
+//own thread, so the threads never contend for a cache line
+struct alignas(64) trace_thread
+{
+    std::atomic<unsigned> depth{0};
+    trace_thread *next = nullptr;
+    trace_thread *prev = nullptr;
+
+    static std::mutex &list_mutex() noexcept
+    {
+        static std::mutex m;
+        return m;
+    }
+    static trace_thread *&list() noexcept
+    {
+        static trace_thread *first = nullptr;
+        return first;
+    }
+    trace_thread()
+    {
+        std::lock_guard<std::mutex> lock{list_mutex()};
+        next = list();
+        if (next != nullptr)
+        {
+            next->prev = this;
+        }
+        list() = this;
+    }
+    ~trace_thread()
+    {
+        std::lock_guard<std::mutex> lock{list_mutex()};
+        (prev != nullptr ? prev->next : list()) = next;
+        if (next != nullptr)
+        {
+            next->prev = prev;
+        }
+    }
+    trace_thread(const trace_thread &) = delete;
+    trace_thread &operator=(const trace_thread &) = delete;
+
+    static trace_thread &current()
+    {
+        thread_local trace_thread t;
+        return t;
+    }
+    //blocks until no thread is inside the sink which was uninstalled before
+    static void wait_for_quiescence() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock{list_mutex()};
+        for (auto *t = list(); t != nullptr; t = t->next)
+        {
+            while (t->depth.load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+//calls f with the installed sink, costs one relaxed load if there is none
+template <typename F>
+inline void with_trace(F f) noexcept
+{
+    if (active_trace.load(std::memory_order_relaxed) == nullptr)
+    {
+        return;
+    }
+    auto &self = trace_thread::current();
+    unsigned depth = self.depth.load(std::memory_order_relaxed);
+    self.depth.store(depth + 1, std::memory_order_relaxed);
+    //pairs with the fence in wait_for_quiescence: either the uninstalling thread
+    //sees the raised depth or this thread sees the sink gone
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (auto *sink = active_trace.load(std::memory_order_acquire))
+    {
+        f(*sink);
+    }
+    self.depth.store(depth, std::memory_order_release);
+}
+inline bool tracing() noexcept
+{
+    return active_trace.load(std::memory_order_relaxed) != nullptr;
+}
+
+//the status usbmon reports for a completed urb
+inline std::int32_t trace_status(libusb_transfer_status status) noexcept
+{
+    switch (status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+        return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        return -ETIMEDOUT;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return -ENOENT;
+    case LIBUSB_TRANSFER_STALL:
+        return -EPIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        return -ENODEV;
+    case LIBUSB_TRANSFER_OVERFLOW:
+        return -EOVERFLOW;
+    default:
+        return -EPROTO;
+    }
+}
+//the status usbmon reports for a libusb error code
+inline std::int32_t trace_error_status(int code) noexcept
+{
+    switch (code)
+    {
+    case 0:
+        return 0;
+    case LIBUSB_ERROR_TIMEOUT:
+        return -ETIMEDOUT;
+    case LIBUSB_ERROR_PIPE:
+        return -EPIPE;
+    case LIBUSB_ERROR_NO_DEVICE:
+        return -ENODEV;
+    case LIBUSB_ERROR_OVERFLOW:
+        return -EOVERFLOW;
+    case LIBUSB_ERROR_INTERRUPTED:
+        return -EINTR;
+    case LIBUSB_ERROR_BUSY:
+        return -EBUSY;
+    case LIBUSB_ERROR_INVALID_PARAM:
+        return -EINVAL;
+    case LIBUSB_ERROR_NO_MEM:
+        return -ENOMEM;
+    default:
+        return -EPROTO;
+    }
+}
+
+//records one event with the setup packet of a control transfer or nullptr and the data stage
+inline void trace_event(backend *be, libusb_device_handle *dev, std::uint64_t id, char type, unsigned char transfer_type, unsigned char endpoint,
+                        const unsigned char *setup, const unsigned char *data, int length, std::int32_t status) noexcept
+{
+    with_trace([&](trace_sink &sink) {
+        trace_record r{};
+        r.id = id;
+        r.type = type;
+        r.transfer_type = transfer_type;
+        r.endpoint = endpoint;
+        r.status = status;
+        r.length = static_cast<std::uint32_t>(length < 0 ? 0 : length);
+        if (libusb_device *d = be->get_device(dev))
+        {
+            r.bus = be->get_bus_number(d);
+            r.device = be->get_device_address(d);
+        }
+        if (setup != nullptr)
+        {
+            r.endpoint = setup[0] & LIBUSB_ENDPOINT_DIR_MASK;
+            r.setup = type == 'S' ? setup : nullptr;
+        }
+        //OUT data goes over the bus after the submission, IN data before the completion
+        bool in = (r.endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+        if (type == (in ? 'C' : 'S') && data != nullptr)
+        {
+            r.data = data;
+            r.data_length = r.length;
+        }
+        sink.record(r);
+    });
+}
+//records one event of a transfer with the given buffer, which starts with
+//the setup packet for control transfers. length counts the data after it
+inline void trace(backend *be, libusb_device_handle *dev, std::uint64_t id, char type, unsigned char transfer_type, unsigned char endpoint,
+                  const unsigned char *buffer, int length, std::int32_t status) noexcept
+{
+    if (transfer_type == LIBUSB_TRANSFER_TYPE_CONTROL && buffer != nullptr)
+    {
+        trace_event(be, dev, id, type, transfer_type, endpoint, buffer, buffer + LIBUSB_CONTROL_SETUP_SIZE, length, status);
+    }
+    else
+    {
+        trace_event(be, dev, id, type, transfer_type, endpoint, nullptr, buffer, length, status);
+    }
+}
+inline void trace_submit(backend *be, const libusb_transfer *t) noexcept
+{
+    if (tracing())
+    {
+        int length = t->type == LIBUSB_TRANSFER_TYPE_CONTROL ? t->length - LIBUSB_CONTROL_SETUP_SIZE : t->length;
+        trace(be, t->dev_handle, reinterpret_cast<std::uintptr_t>(t), 'S', t->type, t->endpoint, t->buffer, length, -EINPROGRESS);
+    }
+}
+inline void trace_submit_failed(backend *be, const libusb_transfer *t, int code) noexcept
+{
+    if (tracing())
+    {
+        trace(be, t->dev_handle, reinterpret_cast<std::uintptr_t>(t), 'E', t->type, t->endpoint, nullptr, 0, trace_error_status(code));
+    }
+}
+inline void trace_complete(backend *be, const libusb_transfer *t) noexcept
+{
+    if (tracing())
+    {
+        int length = t->actual_length;
+        if (t->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            //the length sums up the packets, the captured data is the start of the buffer as it is
+            length = 0;
+            for (int i = 0; i < t->num_iso_packets; ++i)
+            {
+                length += static_cast<int>(t->iso_packet_desc[i].actual_length);
+            }
+        }
+        trace(be, t->dev_handle, reinterpret_cast<std::uintptr_t>(t), 'C', t->type, t->endpoint, t->buffer, length, trace_status(t->status));
+    }
+}
+} // namespace detail
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,238 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace detail
+{
+//minimal io_uring on the raw system calls, so no liburing is needed.
+//one thread submits and one thread reaps, the submitting side has to be
+//serialized by the caller
+class uring
+{
+    int fd = -1;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    std::size_t sq_ring_size = 0;
+    std::size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    std::size_t sqes_size = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    static unsigned load_acquire(unsigned *p) noexcept
+    {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+    static void store_release(unsigned *p, unsigned v) noexcept
+    {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+    static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+    void reset() noexcept
+    {
+        if (sqes != nullptr)
+        {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ring != nullptr && cq_ring != sq_ring)
+        {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != nullptr)
+        {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = -1;
+        sq_ring = cq_ring = nullptr;
+        sqes = nullptr;
+    }
+    //fills the next submission queue entry and enters it, returns 0, EBUSY if the
+    //queue is full or the errno of io_uring_enter, in which case the entry is taken
+    //back, so no completion of it will arrive
+    template <typename F>
+    int push(F fill) noexcept
+    {
+        unsigned tail = *sq_tail;
+        if (tail - load_acquire(sq_head) > *sq_mask)
+        {
+            return EBUSY;
+        }
+        unsigned i = tail & *sq_mask;
+        io_uring_sqe &e = sqes[i];
+        std::memset(&e, 0, sizeof(e));
+        fill(e);
+        sq_array[i] = i;
+        store_release(sq_tail, tail + 1);
+        int err = 0;
+        while (enter(fd, 1, 0, 0) < 0 && (err = errno) == EINTR)
+        {
+            err = 0;
+        }
+        //without SQPOLL only io_uring_enter consumes entries, so one it left is still there
+        if (load_acquire(sq_head) == tail)
+        {
+            store_release(sq_tail, tail);
+            return err != 0 ? err : EAGAIN;
+        }
+        return 0;
+    }
+
+public:
+    uring() noexcept = default;
+    uring(const uring &) = delete;
+    uring &operator=(const uring &) = delete;
+    ~uring()
+    {
+        reset();
+    }
+
+    //creates a ring with at least the given number of entries,
+    //returns 0 or the errno, e.g. ENOSYS or EPERM if io_uring is not available
+    int init(unsigned entries) noexcept
+    {
+        reset();
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0)
+        {
+            return errno;
+        }
+        sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+            sq_ring_size = cq_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+        }
+        sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            sq_ring = nullptr;
+            int e = errno;
+            reset();
+            return e;
+        }
+        cq_ring = single ? sq_ring : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            cq_ring = nullptr;
+            int e = errno;
+            reset();
+            return e;
+        }
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *s = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED)
+        {
+            int e = errno;
+            reset();
+            return e;
+        }
+        sqes = static_cast<io_uring_sqe *>(s);
+        auto *sq = static_cast<unsigned char *>(sq_ring);
+        auto *cq = static_cast<unsigned char *>(cq_ring);
+        sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        return 0;
+    }
+    explicit operator bool() const noexcept
+    {
+        return fd >= 0;
+    }
+    void close() noexcept
+    {
+        reset();
+    }
+    //true if the kernel implements the opcode, e.g. IORING_OP_WRITE only exists since
+    //linux 5.6, as does the probe itself, so older kernels report nothing as supported
+    bool supports(unsigned char opcode) const noexcept
+    {
+        constexpr unsigned op_count = 256;
+        alignas(io_uring_probe) unsigned char buffer[sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op)] = {};
+        auto *probe = reinterpret_cast<io_uring_probe *>(buffer);
+        if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, op_count) < 0)
+        {
+            return false;
+        }
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    //queues a write of [data, data + length) to the file at offset and enters it,
+    //returns 0 or an errno, see push
+    int write(int file, const void *data, std::uint32_t length, std::uint64_t offset, std::uint64_t user_data) noexcept
+    {
+        return push([&](io_uring_sqe &e) {
+            e.opcode = IORING_OP_WRITE;
+            e.fd = file;
+            e.addr = reinterpret_cast<std::uintptr_t>(data);
+            e.len = length;
+            e.off = offset;
+            e.user_data = user_data;
+        });
+    }
+    //completes right away, wakes up the thread in wait. returns 0 or an errno, see push
+    int nop(std::uint64_t user_data) noexcept
+    {
+        return push([&](io_uring_sqe &e) {
+            e.opcode = IORING_OP_NOP;
+            e.user_data = user_data;
+        });
+    }
+    //blocks until at least one completion is there and calls f(user_data, result)
+    //for all of them, result is the number of bytes written or a negative errno.
+    //returns 0 or the errno of io_uring_enter, in which case f was not called
+    template <typename F>
+    int wait(F f) noexcept
+    {
+        while (load_acquire(cq_tail) == *cq_head)
+        {
+            if (enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            {
+                return errno;
+            }
+        }
+        unsigned head = *cq_head;
+        unsigned tail = load_acquire(cq_tail);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &c = cqes[head & *cq_mask];
+            f(c.user_data, c.res);
+        }
+        store_release(cq_head, head);
+        return 0;
+    }
+};
+} // namespace detail
+} // namespace libusbcpp
+} // namespace osf
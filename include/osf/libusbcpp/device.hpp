@@ -1,13 +1,18 @@
 
 #pragma once
 #include <vector>
+#include <memory>
 #include <variant>
 #include <utility>
 #include <chrono>
+#include <cstdint>
 #include "libusb.h"
 #include "error.hpp"
 #include "sum_type.hpp"
 #include "descriptor.hpp"
+#include "backend.hpp"
+#include "stats.hpp"
+#include "detail/trace_hook.hpp"
 
 namespace osf
 {
@@ -16,22 +21,57 @@ namespace libusbcpp
 class context;
 class device;
 class config_descriptor;
-class transfer;
+class transfer_pool;
+class buffer_arena;
+class bulk_streams;
+class device_probe;
+template <typename Filter>
+class device_query;
+//selects the type erased std::function callback of basic_transfer
+struct dynamic_callback;
+template <typename Callback>
+class basic_transfer;
+using transfer = basic_transfer<dynamic_callback>;
 //this corresponds to a libusb_device_handle
 class device_handle
 {
     friend class context;
     friend class device;
+    friend class transfer_pool;
+    friend class buffer_arena;
+    template <typename Callback>
+    friend class basic_transfer;
+    backend *be = nullptr;
     libusb_device_handle *dev = nullptr;
     std::vector<int> claimed_interfaces{};
-    device_handle(libusb_device_handle *d) : dev{d} {}
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+    //shared, so the transfers keep counting into it when the handle is moved
+    std::shared_ptr<detail::handle_counters> counters = std::make_shared<detail::handle_counters>();
+#endif
+    device_handle(backend *b, libusb_device_handle *d) : be{b}, dev{d} {}
+
+    //counts a synchronous transfer on the endpoint
+    void record(unsigned char ep, int r, int actual_len, std::chrono::steady_clock::time_point started) noexcept
+    {
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        auto &c = counters->endpoint(ep);
+        c.on_submitted(c.on_submit());
+        c.on_complete(detail::status_of_error_code(r), static_cast<std::uint64_t>(actual_len), std::chrono::steady_clock::now() - started);
+#else
+        (void)ep, (void)r, (void)actual_len, (void)started;
+#endif
+    }
 
 public:
     device_handle(const device_handle &) = delete;
     device_handle(device_handle &&rhs)
     {
+        be = rhs.be;
         dev = rhs.dev;
         std::swap(claimed_interfaces, rhs.claimed_interfaces);
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        std::swap(counters, rhs.counters);
+#endif
         rhs.dev = nullptr;
     }
     ~device_handle()
@@ -40,9 +80,9 @@ public:
         {
             for (auto num : claimed_interfaces)
             {
-                libusb_release_interface(dev, num);
+                be->release_interface(dev, num);
             }
-            libusb_close(dev);
+            be->close(dev);
         }
     }
     explicit operator bool()
@@ -51,11 +91,11 @@ public:
     }
     int claim(const int interface_number)
     {
-        return libusb_claim_interface(dev, interface_number);
+        return be->claim_interface(dev, interface_number);
     }
     int release(const int interface_number)
     {
-        return libusb_release_interface(dev, interface_number);
+        return be->release_interface(dev, interface_number);
     }
     device get_device();
     sum_type<config_descriptor, error> get_active_config_descriptor();
@@ -68,7 +108,12 @@ public:
     sum_type<unsigned char *, error> bulk_transfer(endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout) noexcept
     {
         int actual_len = 0;
-        if (int r = libusb_bulk_transfer(dev, static_cast<unsigned char>(ep), begin, end - begin, &actual_len, timeout.count()); r == 0)
+        auto started = stats_enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        detail::trace(be, dev, reinterpret_cast<std::uintptr_t>(begin), 'S', LIBUSB_TRANSFER_TYPE_BULK, static_cast<unsigned char>(ep), begin, static_cast<int>(end - begin), -EINPROGRESS);
+        int r = be->bulk_transfer(dev, static_cast<unsigned char>(ep), begin, end - begin, &actual_len, timeout.count());
+        detail::trace(be, dev, reinterpret_cast<std::uintptr_t>(begin), 'C', LIBUSB_TRANSFER_TYPE_BULK, static_cast<unsigned char>(ep), begin, actual_len, detail::trace_error_status(r));
+        record(static_cast<unsigned char>(ep), r, actual_len, started);
+        if (r == 0)
         {
             return begin + actual_len; //advance iterator upon success
         }
@@ -78,7 +123,118 @@ public:
         }
     }
 
+    //c++ style interface for libusb_interrupt_transfer
+    //works like bulk_transfer but uses the transfer type of interrupt endpoints
+    sum_type<unsigned char *, error> interrupt_transfer(endpoint_address ep, unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout) noexcept
+    {
+        int actual_len = 0;
+        auto started = stats_enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        detail::trace(be, dev, reinterpret_cast<std::uintptr_t>(begin), 'S', LIBUSB_TRANSFER_TYPE_INTERRUPT, static_cast<unsigned char>(ep), begin, static_cast<int>(end - begin), -EINPROGRESS);
+        int r = be->interrupt_transfer(dev, static_cast<unsigned char>(ep), begin, end - begin, &actual_len, timeout.count());
+        detail::trace(be, dev, reinterpret_cast<std::uintptr_t>(begin), 'C', LIBUSB_TRANSFER_TYPE_INTERRUPT, static_cast<unsigned char>(ep), begin, actual_len, detail::trace_error_status(r));
+        record(static_cast<unsigned char>(ep), r, actual_len, started);
+        if (r == 0)
+        {
+            return begin + actual_len;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
+
+    //c++ style interface for libusb_control_transfer
+    //the direction bit of request_type decides whether [begin, end) is sent
+    //to the device or filled by it, the distance to the returned iterator
+    //is the length of the data stage which was actually transferred.
+    //fails with LIBUSB_ERROR_INVALID_PARAM if [begin, end) is longer than 65535 bytes
+    sum_type<unsigned char *, error> control_transfer(std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index,
+                                                      unsigned char *begin, unsigned char *end, std::chrono::milliseconds timeout) noexcept
+    {
+        if (end - begin > 0xffff)
+        {
+            return error(LIBUSB_ERROR_INVALID_PARAM);
+        }
+        auto started = stats_enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        auto length = static_cast<std::uint16_t>(end - begin);
+        unsigned char setup[LIBUSB_CONTROL_SETUP_SIZE];
+        libusb_fill_control_setup(setup, request_type, request, value, index, length);
+        detail::trace_event(be, dev, reinterpret_cast<std::uintptr_t>(setup), 'S', LIBUSB_TRANSFER_TYPE_CONTROL, 0, setup, begin, length, -EINPROGRESS);
+        int r = be->control_transfer(dev, request_type, request, value, index, begin, length, static_cast<unsigned int>(timeout.count()));
+        int actual_len = r < 0 ? 0 : r;
+        detail::trace_event(be, dev, reinterpret_cast<std::uintptr_t>(setup), 'C', LIBUSB_TRANSFER_TYPE_CONTROL, 0, setup, begin, actual_len, detail::trace_error_status(r < 0 ? r : 0));
+        //like the asynchronous ones, control transfers count on endpoint 0
+        record(0, r < 0 ? r : 0, actual_len, started);
+        if (r >= 0)
+        {
+            return begin + r;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
+
     transfer async_bulk_transfer(endpoint_address ep);
+    //the callback type is part of the transfer type,
+    //so completions call it directly without type erasure or allocation
+    template <typename Callback>
+    basic_transfer<Callback> async_bulk_transfer(endpoint_address ep, Callback cb);
+    //allocates up to num_streams bulk streams on each of the endpoints,
+    //they are freed again once the returned object is destroyed
+    sum_type<bulk_streams, error> alloc_streams(std::uint32_t num_streams, const std::vector<endpoint_address> &endpoints);
+    //bulk transfer on one of the streams allocated with alloc_streams,
+    //transfers on different streams of an endpoint complete independently
+    transfer async_bulk_stream_transfer(endpoint_address ep, std::uint32_t stream_id);
+    template <typename Callback>
+    basic_transfer<Callback> async_bulk_stream_transfer(endpoint_address ep, std::uint32_t stream_id, Callback cb);
+    transfer async_interrupt_transfer(endpoint_address ep);
+    template <typename Callback>
+    basic_transfer<Callback> async_interrupt_transfer(endpoint_address ep, Callback cb);
+    //isochronous transfer with the given number of packets,
+    //set_iso_packet_lengths has to be called before it is submitted
+    transfer async_iso_transfer(endpoint_address ep, int packets);
+    template <typename Callback>
+    basic_transfer<Callback> async_iso_transfer(endpoint_address ep, int packets, Callback cb);
+    //control transfer on endpoint 0, set_control_setup has to be called before it is submitted
+    transfer async_control_transfer();
+    template <typename Callback>
+    basic_transfer<Callback> async_control_transfer(Callback cb);
+
+    //the wMaxPacketSize of the endpoint, for high speed isochronous and interrupt
+    //endpoints bits 11 and 12 hold the number of additional transactions
+    sum_type<int, error> get_max_packet_size(endpoint_address ep);
+    //the number of bytes one isochronous packet of the endpoint can carry per
+    //service interval, including the additional transactions of high speed endpoints
+    sum_type<int, error> get_max_iso_packet_size(endpoint_address ep);
+
+    //the counters of every endpoint which saw a transfer through this handle,
+    //empty unless OSF_LIBUSBCPP_ENABLE_STATS is defined
+    std::vector<endpoint_stats> get_stats() const
+    {
+        std::vector<endpoint_stats> out;
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        counters->for_each([&](unsigned char address, const detail::transfer_counters &c) {
+            out.emplace_back();
+            out.back().address = address;
+            c.read(out.back().stats);
+        });
+#endif
+        return out;
+    }
+    transfer_stats get_stats(endpoint_address ep) const
+    {
+        transfer_stats s;
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        if (const auto *c = counters->find(static_cast<unsigned char>(ep)))
+        {
+            c->read(s);
+        }
+#else
+        (void)ep;
+#endif
+        return s;
+    }
 };
 
 //this corresponds to a libusb_device
@@ -86,18 +242,21 @@ class device
 {
     friend class device_list_iterator;
     friend class device_handle;
+    friend class device_registry;
+    friend class device_probe;
+    backend *be = nullptr;
     libusb_device *pdev = nullptr;
-    device(libusb_device *p) : pdev{p}
+    device(backend *b, libusb_device *p) : be{b}, pdev{p}
     {
-        libusb_ref_device(pdev); //bump up ref count
+        be->ref_device(pdev); //bump up ref count
     }
 
 public:
-    device(const device &other) : pdev{other.pdev}
+    device(const device &other) : be{other.be}, pdev{other.pdev}
     {
-        libusb_ref_device(pdev);
+        be->ref_device(pdev);
     }
-    device(device &&other) : pdev{other.pdev}
+    device(device &&other) : be{other.be}, pdev{other.pdev}
     {
         other.pdev = nullptr; //set other to null because we essentially took its ref count
     }
@@ -105,19 +264,23 @@ public:
     {
         if (pdev != nullptr)
         {
-            libusb_unref_device(pdev);
+            be->unref_device(pdev);
         }
+        be = other.be;
         pdev = other.pdev;
-        libusb_ref_device(pdev);
+        be->ref_device(pdev);
+        return *this;
     }
     device &operator=(device &&other)
     {
         if (pdev != nullptr)
         {
-            libusb_unref_device(pdev);
+            be->unref_device(pdev);
         }
+        be = other.be;
         pdev = other.pdev;
         other.pdev = nullptr;
+        return *this;
     }
     ~device()
     {
@@ -125,15 +288,15 @@ public:
         //but we still need to make sure and only free valid pointers
         if (pdev != nullptr)
         {
-            libusb_unref_device(pdev);
+            be->unref_device(pdev);
         }
     }
     sum_type<device_handle, error> open() const
     {
         libusb_device_handle *dev;
-        if (int err = libusb_open(pdev, &dev); err == 0)
+        if (int err = be->open(pdev, &dev); err == 0)
         {
-            return device_handle{dev};
+            return device_handle{be, dev};
         }
         else
         {
@@ -143,7 +306,7 @@ public:
     sum_type<libusb_device_descriptor, error> get_device_descriptor() const
     {
         libusb_device_descriptor desc;                                 //partially formed
-        if (int r = libusb_get_device_descriptor(pdev, &desc); r == 0) //well formed on success
+        if (int r = be->get_device_descriptor(pdev, &desc); r == 0) //well formed on success
         {
             return desc;
         }
@@ -152,12 +315,56 @@ public:
             return error(r);
         }
     }
+    std::uint8_t get_bus_number() const
+    {
+        return be->get_bus_number(pdev);
+    }
+    std::uint8_t get_device_address() const
+    {
+        return be->get_device_address(pdev);
+    }
+    //writes the port numbers from the root hub down to the device into
+    //[begin, end) and returns the iterator past the last one written.
+    //usb allows hubs 7 levels deep, so 7 elements are always enough
+    sum_type<std::uint8_t *, error> get_port_numbers(std::uint8_t *begin, std::uint8_t *end) const
+    {
+        if (int r = be->get_port_numbers(pdev, begin, static_cast<int>(end - begin)); r >= 0)
+        {
+            return begin + r;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
+    sum_type<int, error> get_max_packet_size(endpoint_address ep) const
+    {
+        if (int r = be->get_max_packet_size(pdev, static_cast<unsigned char>(ep)); r >= 0)
+        {
+            return r;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
+    sum_type<int, error> get_max_iso_packet_size(endpoint_address ep) const
+    {
+        if (int r = be->get_max_iso_packet_size(pdev, static_cast<unsigned char>(ep)); r >= 0)
+        {
+            return r;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
     sum_type<config_descriptor, error> get_active_config_descriptor() const
     {
         libusb_config_descriptor *cfg;
-        if (int r = libusb_get_active_config_descriptor(pdev, &cfg); r == 0)
+        if (int r = be->get_active_config_descriptor(pdev, &cfg); r == 0)
         {
-            return config_descriptor(cfg);
+            return config_descriptor(be, cfg);
         }
         else
         {
@@ -166,20 +373,78 @@ public:
     }
 };
 
-device device_list_iterator::operator*() const noexcept
+class device_list
+{
+    backend *be = nullptr;
+    libusb_device **devs = nullptr;
+    std::size_t length = 0;
+    friend class context;
+    template <typename Filter>
+    friend class device_query;
+    device_list(backend *b, libusb_device **d, std::size_t l) : be{b}, devs{d}, length{l} {}
+
+public:
+    device_list(const device_list &) = delete;
+    device_list &operator=(const device_list &) = delete;
+    device_list(device_list &&other)
+    {
+        std::swap(be, other.be);
+        std::swap(devs, other.devs);
+        std::swap(length, other.length);
+    }
+    device_list &operator=(device_list &&other)
+    {
+        length = 0;
+        devs = nullptr;
+        std::swap(be, other.be);
+        std::swap(devs, other.devs);
+        std::swap(length, other.length);
+        return *this;
+    }
+    ~device_list()
+    {
+        if (devs != nullptr)
+        {
+            be->free_device_list(devs, 1); //free the list, unref the devices in it
+        }
+    }
+    device_list_iterator begin();
+    device_list_iterator end();
+};
+
+inline device_list_iterator device_list::begin()
 {
-    return device{*pdev};
+    return device_list_iterator{be, &devs[0]};
+}
+inline device_list_iterator device_list::end()
+{
+    return device_list_iterator{be, &devs[length]};
 }
 
-device device_handle::get_device()
+inline device device_list_iterator::operator*() const noexcept
 {
-    return device{libusb_get_device(dev)};
+    return device{be, *pdev};
 }
 
-sum_type<config_descriptor, error> device_handle::get_active_config_descriptor()
+inline device device_handle::get_device()
+{
+    return device{be, be->get_device(dev)};
+}
+
+inline sum_type<config_descriptor, error> device_handle::get_active_config_descriptor()
 {
     return get_device().get_active_config_descriptor();
 }
 
+inline sum_type<int, error> device_handle::get_max_packet_size(endpoint_address ep)
+{
+    return get_device().get_max_packet_size(ep);
+}
+
+inline sum_type<int, error> device_handle::get_max_iso_packet_size(endpoint_address ep)
+{
+    return get_device().get_max_iso_packet_size(ep);
+}
+
 } // namespace libusbcpp
 } // namespace osf
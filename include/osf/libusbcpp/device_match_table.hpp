@@ -0,0 +1,232 @@
+#pragma once
+#include "libusb.h"
+#include <array>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include "device_query.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//one supported device of a device_match_table
+struct device_id
+{
+    std::uint16_t vendor_id = 0;
+    std::uint16_t product_id = 0;
+    //the interface the application uses on this device, -1 if that does not matter
+    std::int16_t interface_number = -1;
+};
+
+namespace detail
+{
+constexpr std::uint64_t match_key(std::uint16_t vendor_id, std::uint16_t product_id) noexcept
+{
+    return (static_cast<std::uint64_t>(vendor_id) << 16) | product_id;
+}
+//never equal to a key, marks the free slots
+constexpr std::uint64_t no_key = ~std::uint64_t{0};
+
+constexpr std::uint64_t match_hash(std::uint64_t key, std::uint64_t seed) noexcept
+{
+    std::uint64_t x = key ^ (seed * 0x9e3779b97f4a7c15ull);
+    x ^= x >> 31;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    return x;
+}
+constexpr std::size_t match_table_slots(std::size_t n) noexcept
+{
+    std::size_t r = 2;
+    while (r < 2 * n)
+    {
+        r <<= 1;
+    }
+    return r;
+}
+} // namespace detail
+
+//a fixed set of vendor and product ids with a perfect hash, built at compile time:
+//    constexpr auto supported = make_static_device_match_table([] {
+//        return std::array{
+//            device_id{0x1234, 0x0001, 0},
+//            device_id{0x1234, 0x0002, 1},
+//        };
+//    });
+//    auto handles = open_if(ctx, supported);
+//matching a descriptor costs two hashes and one compare however long the
+//list is. the ids are spread over buckets by a first hash and every bucket
+//gets the seed of a second hash which places its ids in free slots
+//(hash and displace). a table is used as a predicate for open_if, the
+//device registry and device_query.
+//a duplicate id, or a list which does not hash perfectly, throws
+//std::invalid_argument. make_static_device_match_table always builds the
+//table during compilation, so there the throw fails to compile instead.
+//make_device_match_table only does so if its result initializes a constexpr
+//variable, otherwise the table is built and the exception thrown at run time
+template <std::size_t N>
+class device_match_table
+{
+    static_assert(N > 0, "a device_match_table needs at least one id");
+    static constexpr std::size_t slots = detail::match_table_slots(N);
+    static constexpr std::size_t buckets = slots / 4 != 0 ? slots / 4 : 1;
+    static constexpr std::uint32_t max_seed = 1u << 16;
+
+    std::array<std::uint64_t, slots> keys{};
+    std::array<device_id, slots> ids{};
+    std::array<std::uint32_t, buckets> seeds{};
+
+    static constexpr std::size_t bucket_of(std::uint64_t key) noexcept
+    {
+        return static_cast<std::size_t>(detail::match_hash(key, 0) & (buckets - 1));
+    }
+    static constexpr std::size_t slot_of(std::uint64_t key, std::uint32_t seed) noexcept
+    {
+        return static_cast<std::size_t>(detail::match_hash(key, seed) & (slots - 1));
+    }
+
+    constexpr void build(const device_id *list)
+    {
+        for (auto &k : keys)
+        {
+            k = detail::no_key;
+        }
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            for (std::size_t j = i + 1; j < N; ++j)
+            {
+                if (list[i].vendor_id == list[j].vendor_id && list[i].product_id == list[j].product_id)
+                {
+                    throw std::invalid_argument("device_match_table: duplicate vendor and product id");
+                }
+            }
+        }
+        //group the ids by bucket, members[first[b], first[b + 1]) are the ids of bucket b
+        std::array<std::size_t, buckets + 1> first{};
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            ++first[bucket_of(detail::match_key(list[i].vendor_id, list[i].product_id)) + 1];
+        }
+        for (std::size_t b = 0; b < buckets; ++b)
+        {
+            first[b + 1] += first[b];
+        }
+        std::array<std::size_t, N> members{};
+        std::array<std::size_t, buckets> filled{};
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            auto b = bucket_of(detail::match_key(list[i].vendor_id, list[i].product_id));
+            members[first[b] + filled[b]++] = i;
+        }
+        //the largest buckets are placed first while most slots are still free
+        std::array<std::size_t, buckets> order{};
+        for (std::size_t b = 0; b < buckets; ++b)
+        {
+            order[b] = b;
+        }
+        for (std::size_t i = 1; i < buckets; ++i)
+        {
+            for (std::size_t j = i; j > 0 && filled[order[j - 1]] < filled[order[j]]; --j)
+            {
+                auto t = order[j - 1];
+                order[j - 1] = order[j];
+                order[j] = t;
+            }
+        }
+        for (std::size_t n = 0; n < buckets && filled[order[n]] != 0; ++n)
+        {
+            std::size_t b = order[n];
+            for (std::uint32_t seed = 1;; ++seed)
+            {
+                if (seed == max_seed)
+                {
+                    throw std::invalid_argument("device_match_table: no perfect hash found");
+                }
+                bool fits = true;
+                for (std::size_t m = first[b]; m < first[b + 1] && fits; ++m)
+                {
+                    auto s = slot_of(detail::match_key(list[members[m]].vendor_id, list[members[m]].product_id), seed);
+                    fits = keys[s] == detail::no_key;
+                    for (std::size_t o = first[b]; o < m && fits; ++o)
+                    {
+                        fits = slot_of(detail::match_key(list[members[o]].vendor_id, list[members[o]].product_id), seed) != s;
+                    }
+                }
+                if (!fits)
+                {
+                    continue;
+                }
+                for (std::size_t m = first[b]; m < first[b + 1]; ++m)
+                {
+                    auto key = detail::match_key(list[members[m]].vendor_id, list[members[m]].product_id);
+                    keys[slot_of(key, seed)] = key;
+                    ids[slot_of(key, seed)] = list[members[m]];
+                }
+                seeds[b] = seed;
+                break;
+            }
+        }
+    }
+
+public:
+    constexpr explicit device_match_table(const device_id (&list)[N])
+    {
+        build(list);
+    }
+    constexpr explicit device_match_table(const std::array<device_id, N> &list)
+    {
+        build(list.data());
+    }
+
+    //the entry of the device or nullptr if it is not in the table
+    constexpr const device_id *find(std::uint16_t vendor_id, std::uint16_t product_id) const noexcept
+    {
+        auto key = detail::match_key(vendor_id, product_id);
+        auto s = slot_of(key, seeds[bucket_of(key)]);
+        return keys[s] == key ? &ids[s] : nullptr;
+    }
+    constexpr const device_id *find(const libusb_device_descriptor &desc) const noexcept
+    {
+        return find(desc.idVendor, desc.idProduct);
+    }
+    constexpr bool contains(std::uint16_t vendor_id, std::uint16_t product_id) const noexcept
+    {
+        return find(vendor_id, product_id) != nullptr;
+    }
+
+    //predicate of open_if and device_registry::find_if
+    constexpr bool operator()(const libusb_device_descriptor &desc) const noexcept
+    {
+        return find(desc) != nullptr;
+    }
+    //filter of device_query
+    bool operator()(const device_probe &p) const noexcept
+    {
+        const auto *desc = p.descriptor();
+        return desc != nullptr && find(*desc) != nullptr;
+    }
+
+    static constexpr std::size_t size() noexcept
+    {
+        return N;
+    }
+};
+
+template <std::size_t N>
+constexpr device_match_table<N> make_device_match_table(const device_id (&list)[N])
+{
+    return device_match_table<N>{list};
+}
+//builds the table from the std::array of device_id a captureless lambda
+//returns, always during compilation. invalid lists fail to compile
+template <typename List>
+constexpr auto make_static_device_match_table(List list)
+{
+    constexpr auto ids = list();
+    constexpr device_match_table<ids.size()> table{ids};
+    return table;
+}
+
+} // namespace libusbcpp
+} // namespace osf
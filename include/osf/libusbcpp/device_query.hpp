@@ -0,0 +1,298 @@
+#pragma once
+#include "libusb.h"
+#include <array>
+#include <initializer_list>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include "error.hpp"
+#include "sum_type.hpp"
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//a device of a device_list as the filters of a device_query see it
+//the descriptor is read on first use only and kept for the following
+//filters, nothing is opened or referenced until it is asked for
+class device_probe
+{
+    backend *be;
+    libusb_device *pdev;
+    mutable int descriptor_result = 1; //1 until the descriptor was read
+    mutable libusb_device_descriptor desc{};
+
+public:
+    device_probe(backend *b, libusb_device *p) noexcept : be{b}, pdev{p} {}
+
+    sum_type<libusb_device_descriptor, error> get_device_descriptor() const
+    {
+        if (const auto *d = descriptor())
+        {
+            return *d;
+        }
+        return error(descriptor_result);
+    }
+    //nullptr if the descriptor could not be read
+    const libusb_device_descriptor *descriptor() const noexcept
+    {
+        if (descriptor_result == 1)
+        {
+            descriptor_result = be->get_device_descriptor(pdev, &desc);
+        }
+        return descriptor_result == 0 ? &desc : nullptr;
+    }
+    std::uint8_t get_bus_number() const
+    {
+        return be->get_bus_number(pdev);
+    }
+    std::uint8_t get_device_address() const
+    {
+        return be->get_device_address(pdev);
+    }
+    //see device::get_port_numbers
+    sum_type<std::uint8_t *, error> get_port_numbers(std::uint8_t *begin, std::uint8_t *end) const
+    {
+        if (int r = be->get_port_numbers(pdev, begin, static_cast<int>(end - begin)); r >= 0)
+        {
+            return begin + r;
+        }
+        else
+        {
+            return error(r);
+        }
+    }
+    //true if the device or one of the interfaces of its active configuration has the class,
+    //the configuration is only read for devices which declare their class per interface
+    bool has_class(std::uint8_t device_class) const
+    {
+        const auto *d = descriptor();
+        if (d == nullptr)
+        {
+            return false;
+        }
+        if (d->bDeviceClass != LIBUSB_CLASS_PER_INTERFACE)
+        {
+            return d->bDeviceClass == device_class;
+        }
+        libusb_config_descriptor *cfg;
+        if (be->get_active_config_descriptor(pdev, &cfg) != 0)
+        {
+            return false;
+        }
+        bool found = false;
+        for (int i = 0; i < cfg->bNumInterfaces && !found; ++i)
+        {
+            for (int a = 0; a < cfg->interface[i].num_altsetting && !found; ++a)
+            {
+                found = cfg->interface[i].altsetting[a].bInterfaceClass == device_class;
+            }
+        }
+        be->free_config_descriptor(cfg);
+        return found;
+    }
+    device get_device() const
+    {
+        return device{be, pdev};
+    }
+    sum_type<device_handle, error> open() const
+    {
+        return get_device().open();
+    }
+};
+
+//accepts every device
+struct match_any
+{
+    bool operator()(const device_probe &) const noexcept
+    {
+        return true;
+    }
+};
+//accepts the devices both filters accept, the second one is only asked if the first one agrees
+template <typename First, typename Second>
+struct match_both
+{
+    First first;
+    Second second;
+    bool operator()(const device_probe &p) const
+    {
+        return first(p) && second(p);
+    }
+};
+struct match_vid_pid
+{
+    std::uint16_t vendor_id;
+    std::uint16_t product_id;
+    bool operator()(const device_probe &p) const
+    {
+        const auto *d = p.descriptor();
+        return d != nullptr && d->idVendor == vendor_id && d->idProduct == product_id;
+    }
+};
+//see device_probe::has_class
+struct match_class
+{
+    std::uint8_t device_class;
+    bool operator()(const device_probe &p) const
+    {
+        return p.has_class(device_class);
+    }
+};
+//the device at the given bus and chain of hub ports, as libusb_get_port_numbers reports it
+class match_port_path
+{
+    std::uint8_t bus;
+    std::uint8_t depth;
+    std::array<std::uint8_t, 7> ports{};
+
+public:
+    match_port_path(std::uint8_t bus_number, std::initializer_list<std::uint8_t> port_numbers)
+        : bus{bus_number}, depth{static_cast<std::uint8_t>(std::min<std::size_t>(port_numbers.size(), 7))}
+    {
+        std::copy_n(port_numbers.begin(), depth, ports.begin());
+    }
+    bool operator()(const device_probe &p) const
+    {
+        if (p.get_bus_number() != bus)
+        {
+            return false;
+        }
+        std::array<std::uint8_t, 7> actual;
+        bool equal = false;
+        p.get_port_numbers(actual.data(), actual.data() + actual.size())(
+            [&](std::uint8_t *end) { equal = std::equal(actual.data(), end, ports.begin(), ports.begin() + depth); },
+            [](auto) {});
+        return equal;
+    }
+};
+
+//a lazy view of the devices of a device_list which satisfy a filter
+//filters are composed with where and only run while the query is iterated,
+//in order and on one device at a time, so iteration stops reading
+//descriptors as soon as the caller stops iterating:
+//    device_query<> q{ctx.get_device_list()};
+//    auto h = std::move(q).where(match_vid_pid{0x1234, 0x5678}).open_first();
+//iterating yields device_probe objects, devices are only opened on request.
+//apart from the device list itself nothing is allocated
+template <typename Filter = match_any>
+class device_query
+{
+    template <typename>
+    friend class device_query;
+    device_list list;
+    Filter filter;
+    device_query(device_list l, Filter f) : list{std::move(l)}, filter{std::move(f)} {}
+
+public:
+    class iterator
+    {
+        friend class device_query;
+        const device_query *query;
+        libusb_device **pos;
+        device_probe probe;
+        iterator(const device_query *q, libusb_device **p) : query{q}, pos{p}, probe{q->list.be, nullptr}
+        {
+            skip();
+        }
+        //moves on to the first device at or after pos which satisfies the filter
+        void skip()
+        {
+            for (auto last = query->list.devs + query->list.length; pos != last; ++pos)
+            {
+                probe = device_probe{query->list.be, *pos};
+                if (query->filter(static_cast<const device_probe &>(probe)))
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = device_probe;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const device_probe *;
+        using reference = const device_probe &;
+
+        const device_probe &operator*() const noexcept
+        {
+            return probe;
+        }
+        const device_probe *operator->() const noexcept
+        {
+            return &probe;
+        }
+        iterator &operator++()
+        {
+            ++pos;
+            skip();
+            return *this;
+        }
+        friend bool operator==(const iterator &lhs, const iterator &rhs) noexcept
+        {
+            return lhs.pos == rhs.pos;
+        }
+        friend bool operator!=(const iterator &lhs, const iterator &rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+    };
+
+    explicit device_query(device_list l) : list{std::move(l)}, filter{} {}
+
+    //narrows the query down to the devices which also satisfy f,
+    //which is called with a const device_probe &
+    template <typename F>
+    device_query<match_both<Filter, F>> where(F f) &&
+    {
+        return device_query<match_both<Filter, F>>{std::move(list), match_both<Filter, F>{std::move(filter), std::move(f)}};
+    }
+
+    //finds the next match on every call to operator++
+    iterator begin() const
+    {
+        return iterator{this, list.devs};
+    }
+    iterator end() const
+    {
+        return iterator{this, list.devs + list.length};
+    }
+
+    //the first match, LIBUSB_ERROR_NOT_FOUND if there is none
+    sum_type<device, error> first() const
+    {
+        for (auto &p : *this)
+        {
+            return p.get_device();
+        }
+        return error(LIBUSB_ERROR_NOT_FOUND);
+    }
+    //opens the matches in order until one opens, the devices after it are not looked at.
+    //fails with the error of the last match which did not open, or
+    //LIBUSB_ERROR_NOT_FOUND if there is no match
+    sum_type<device_handle, error> open_first() const
+    {
+        int last_error = LIBUSB_ERROR_NOT_FOUND;
+        for (auto &p : *this)
+        {
+            sum_type<device_handle, error> r = p.open();
+            bool opened = false;
+            r([&](device_handle &) { opened = true; },
+              [&](auto e) { last_error = static_cast<int>(e); });
+            if (opened)
+            {
+                return r;
+            }
+        }
+        return error(last_error);
+    }
+};
+
+} // namespace libusbcpp
+} // namespace osf
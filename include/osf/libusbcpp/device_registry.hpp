@@ -0,0 +1,242 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "sum_type.hpp"
+#include "error.hpp"
+#include "descriptor.hpp"
+#include "descriptor_index.hpp"
+#include "device.hpp"
+#include "backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//a connected device with the descriptors which were read when it arrived
+struct registry_entry
+{
+    device dev;
+    libusb_device_descriptor descriptor;
+    //null if the active configuration could not be read
+    std::shared_ptr<const config_descriptor> config;
+    //flat copy of config for fast endpoint lookups, null along with it
+    std::shared_ptr<const descriptor_index> index;
+};
+
+//the devices of a context, kept up to date by hotplug events instead of
+//enumerating the bus (and reading sysfs) on every lookup.
+//the devices are enumerated once when the registry starts, afterwards
+//every arrival or removal publishes a new immutable snapshot. lookups read
+//the current snapshot without locks or syscalls: a reader announces itself
+//in the reader count of the current epoch, a writer publishes the new
+//snapshot, moves on to the next epoch and frees the old snapshot once the
+//readers of the previous epoch left.
+//hotplug events are delivered while the events of the context are handled,
+//so the registry only follows the bus while someone handles events
+class device_registry
+{
+    using snapshot = std::vector<registry_entry>;
+    backend *be;
+    libusb_context *ctx;
+    libusb_hotplug_callback_handle handle{};
+    bool registered = false;
+    std::atomic<const snapshot *> current{nullptr};
+    std::atomic<std::uint64_t> epoch{0};
+    mutable std::atomic<std::size_t> readers[2] = {};
+    std::atomic<std::uint64_t> generation{0};
+    std::mutex write_mtx; //serializes the writers
+
+    //keeps the snapshot it was constructed with alive until it is destroyed
+    class read_guard
+    {
+        const device_registry &r;
+        std::size_t slot;
+
+    public:
+        const snapshot *snap;
+        explicit read_guard(const device_registry &reg) noexcept : r{reg}
+        {
+            for (;;)
+            {
+                auto e = r.epoch.load();
+                slot = static_cast<std::size_t>(e & 1);
+                r.readers[slot].fetch_add(1);
+                if (r.epoch.load() == e)
+                {
+                    break;
+                }
+                r.readers[slot].fetch_sub(1); //a writer moved on in between, retry in the new epoch
+            }
+            snap = r.current.load();
+        }
+        read_guard(const read_guard &) = delete;
+        read_guard &operator=(const read_guard &) = delete;
+        ~read_guard()
+        {
+            r.readers[slot].fetch_sub(1);
+        }
+    };
+
+    //expects write_mtx to be held
+    void publish(std::unique_ptr<const snapshot> next)
+    {
+        const snapshot *old = current.exchange(next.release());
+        auto e = epoch.fetch_add(1);
+        //readers which entered before the switch may still look at old
+        while (readers[e & 1].load() != 0)
+        {
+            std::this_thread::yield();
+        }
+        delete old;
+        generation.fetch_add(1);
+    }
+    void arrived(libusb_device *pdev)
+    {
+        registry_entry entry{device{be, pdev}, {}, nullptr, nullptr};
+        if (be->get_device_descriptor(pdev, &entry.descriptor) != 0)
+        {
+            return;
+        }
+        entry.dev.get_active_config_descriptor()(
+            [&](config_descriptor &cfg) { entry.config = std::make_shared<const config_descriptor>(std::move(cfg)); },
+            [](auto) {});
+        if (entry.config)
+        {
+            entry.index = std::make_shared<const descriptor_index>(*entry.config);
+        }
+        std::lock_guard<std::mutex> lock{write_mtx};
+        for (auto &known : *current.load())
+        {
+            if (known.dev.pdev == pdev)
+            {
+                return; //enumerated and announced by an event at the same time
+            }
+        }
+        auto next = std::make_unique<snapshot>(*current.load());
+        next->push_back(std::move(entry));
+        publish(std::move(next));
+    }
+    void left(libusb_device *pdev)
+    {
+        std::lock_guard<std::mutex> lock{write_mtx};
+        auto next = std::make_unique<snapshot>();
+        next->reserve(current.load()->size());
+        for (auto &entry : *current.load())
+        {
+            if (entry.dev.pdev != pdev)
+            {
+                next->push_back(entry);
+            }
+        }
+        publish(std::move(next));
+    }
+    static int LIBUSB_CALL hotplug_callback(libusb_context *, libusb_device *pdev, libusb_hotplug_event event, void *user_data)
+    {
+        auto *self = static_cast<device_registry *>(user_data);
+        if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+        {
+            self->arrived(pdev);
+        }
+        else
+        {
+            self->left(pdev);
+        }
+        return 0;
+    }
+
+public:
+    device_registry(backend &b, libusb_context *c) : be{&b}, ctx{c}, current{new snapshot{}} {}
+    device_registry(const device_registry &) = delete;
+    device_registry &operator=(const device_registry &) = delete;
+    //note: no thread may handle the events of the context while the registry is destroyed
+    ~device_registry()
+    {
+        if (registered)
+        {
+            be->hotplug_deregister_callback(ctx, handle);
+        }
+        delete current.load();
+    }
+
+    //enumerates the connected devices and starts following the hotplug events
+    //returns 0 on success, LIBUSB_ERROR_NOT_SUPPORTED if the platform has
+    //no hotplug support or another libusb error code
+    int start()
+    {
+        if (registered)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        if (!be->has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+        {
+            return LIBUSB_ERROR_NOT_SUPPORTED;
+        }
+        int events = LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+        if (int r = be->hotplug_register_callback(ctx, events, LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                                  LIBUSB_HOTPLUG_MATCH_ANY, &hotplug_callback, static_cast<void *>(this), &handle);
+            r != 0)
+        {
+            return r;
+        }
+        registered = true;
+        return 0;
+    }
+
+    //calls f with the current list of registry_entry and returns its result
+    //the list stays valid and unchanged until f returns, f should be
+    //short as writers wait for it before they free the previous list
+    template <typename F>
+    decltype(auto) read(F &&f) const
+    {
+        read_guard guard{*this};
+        return f(static_cast<const snapshot &>(*guard.snap));
+    }
+    //the devices whose descriptor satisfies pred
+    template <typename T>
+    std::vector<device> find_if(T pred) const
+    {
+        return read([&](const snapshot &snap) {
+            std::vector<device> out;
+            for (auto &entry : snap)
+            {
+                if (pred(entry.descriptor))
+                {
+                    out.push_back(entry.dev);
+                }
+            }
+            return out;
+        });
+    }
+    //opens the devices whose descriptor satisfies pred, see open_if
+    template <typename T>
+    std::vector<device_handle> open_if(T pred) const
+    {
+        std::vector<device_handle> out;
+        for (auto &dev : find_if(pred)) //opened outside of the read, writers do not wait for the syscalls
+        {
+            dev.open()(
+                [&](auto &od) { out.emplace_back(std::move(od)); },
+                [](auto) {});
+        }
+        return out;
+    }
+    std::size_t size() const
+    {
+        return read([](const snapshot &snap) { return snap.size(); });
+    }
+    //incremented on every arrival or removal
+    std::uint64_t get_generation() const noexcept
+    {
+        return generation.load();
+    }
+};
+
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,692 @@
+#pragma once
+#include "libusb.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "bulk_in_pipe.hpp"
+#include "detail/uring.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+enum class disk_sink_method
+{
+    io_uring, //asynchronous writes, with O_DIRECT where the file system supports it
+    mmap      //copies into a mapping of the file, for kernels without io_uring
+};
+
+struct disk_sink_stats
+{
+    std::uint64_t files = 0;
+    //buffers taken and bytes which reached the file
+    std::uint64_t buffers = 0;
+    std::uint64_t bytes = 0;
+    //bytes written straight from the transfer buffers without copying
+    std::uint64_t zero_copy_bytes = 0;
+    //buffers dropped because the disk fell behind, see disk_sink
+    std::uint64_t overruns = 0;
+    std::uint64_t dropped_bytes = 0;
+    std::size_t pending_writes = 0;
+    std::size_t max_pending_writes = 0;
+    disk_sink_method method = disk_sink_method::io_uring;
+    bool direct = false; //the files are written with O_DIRECT
+};
+
+//writes the buffers of one or more bulk_in_pipes to preallocated files.
+//with io_uring the write of a buffer is queued on the thread which handles
+//the events and the buffer is held as a lease until the write completed,
+//so the data goes from the transfer memory to the disk without being copied
+//and without a system call per buffer on the event thread besides the
+//submission. with O_DIRECT this needs buffers and lengths aligned to 4096
+//bytes, i.e. a transfer_size which is a multiple of 4096 and transfers which
+//complete in full. other buffers are copied into staging chunks which are
+//written once they are full, after such a buffer the stream stays on the
+//staging chunks until the next file starts, since the file offset is not
+//aligned any more.
+//transfer memory mapped from usbfs (see buffer_arena) can not be written
+//with O_DIRECT, so the files of such pipes are written through the page cache.
+//without io_uring the buffers are copied into a mapping of the file right
+//away. the mmap method never drops a buffer, but the event thread waits
+//for the page faults.
+//if the writes fall behind and the queue depth or all staging chunks are in
+//use, or io_uring_enter runs short of resources for a moment, the buffer is
+//dropped and counted as an overrun instead of stalling the endpoint, like
+//set_queue of bulk_in_pipe does.
+//with a file size the stream is split into files of at most that size,
+//named path.000000, path.000001, ..., which are preallocated, otherwise
+//everything goes to path:
+//    disk_sink sink{"capture", 1ull << 30};
+//    sink.attach(pipe);
+//    sink.start();
+//    pipe.start();
+//the completed files are reported to set_file_callback, which runs on the
+//thread which completed the last write and must not call into the sink
+//linux only, so libusbcpp.hpp does not include it
+//note: stop the pipes and handle their events before stopping the sink
+class disk_sink
+{
+    static constexpr std::size_t alignment = 4096;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    //wakes the completion thread up on stop
+    static constexpr std::uint64_t wake_up = 0;
+
+    struct file
+    {
+        int fd = -1;
+        std::string path;
+        std::uint64_t length = 0;    //bytes appended, including those still staged
+        std::uint64_t allocated = 0; //bytes reserved on disk
+        std::size_t pending = 0;     //writes in flight
+        bool closing = false;
+        //mmap method
+        unsigned char *map = nullptr;
+        std::uint64_t map_offset = 0;
+        std::size_t map_length = 0;
+    };
+    struct write_op
+    {
+        file *f = nullptr;
+        bulk_in_pipe::lease data;
+        std::size_t chunk = npos;
+        std::uint32_t length = 0; //including the padding of the last chunk of a file
+        std::uint32_t bytes = 0;
+    };
+    struct free_deleter
+    {
+        void operator()(unsigned char *p) const noexcept
+        {
+            std::free(p);
+        }
+    };
+
+    std::string path;
+    std::uint64_t file_size;
+    std::size_t queue_depth;
+    std::size_t chunk_size = 1 << 20;
+    std::size_t chunk_count = 4;
+    std::size_t map_window = 64 << 20;
+    disk_sink_method preferred = disk_sink_method::io_uring;
+    bool device_memory = false;
+    detail::uring ring;
+    std::thread completer;
+    std::mutex mtx;
+    std::condition_variable idle;
+    //everything below is guarded by mtx
+    bool running = false;
+    //the completion thread reaps the writes, false once io_uring_enter failed
+    bool reaping = false;
+    int failure = 0;
+    std::size_t file_index = 0;
+    std::vector<std::unique_ptr<file>> files;
+    file *current = nullptr;
+    std::vector<write_op> ops;
+    std::vector<std::size_t> free_ops;
+    std::unique_ptr<unsigned char, free_deleter> staging;
+    std::vector<std::size_t> free_chunks;
+    std::size_t fill_chunk = npos;
+    std::size_t fill = 0;
+    std::uint64_t fill_offset = 0;
+    disk_sink_stats stats;
+    std::function<void(const std::string &, std::uint64_t)> on_file;
+    std::function<void(int)> on_error;
+
+    //expects the lock to be held
+    void fail(int err)
+    {
+        if (failure == 0)
+        {
+            failure = err;
+            if (on_error)
+            {
+                on_error(err);
+            }
+        }
+    }
+    //reserves the first size bytes of the file on disk, so writing them can not fail for lack of space
+    static bool reserve(file &f, std::uint64_t size) noexcept
+    {
+        if (size <= f.allocated)
+        {
+            return true;
+        }
+        if (::fallocate(f.fd, 0, 0, static_cast<off_t>(size)) != 0 && ::ftruncate(f.fd, static_cast<off_t>(size)) != 0)
+        {
+            return false;
+        }
+        f.allocated = size;
+        return true;
+    }
+    //expects the lock to be held
+    bool open_file()
+    {
+        auto f = std::make_unique<file>();
+        if (file_size != 0)
+        {
+            char suffix[24];
+            std::snprintf(suffix, sizeof(suffix), ".%06zu", file_index);
+            f->path = path + suffix;
+        }
+        else
+        {
+            f->path = path;
+        }
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        stats.direct = false;
+        if (stats.method == disk_sink_method::io_uring && !device_memory)
+        {
+            //tmpfs and some others refuse O_DIRECT
+            f->fd = ::open(f->path.c_str(), flags | O_DIRECT, 0644);
+            stats.direct = f->fd >= 0;
+        }
+        if (f->fd < 0)
+        {
+            f->fd = ::open(f->path.c_str(), stats.method == disk_sink_method::mmap ? (flags & ~O_WRONLY) | O_RDWR : flags, 0644);
+        }
+        if (f->fd < 0)
+        {
+            fail(errno);
+            return false;
+        }
+        if (file_size != 0)
+        {
+            reserve(*f, file_size);
+        }
+        ++file_index;
+        ++stats.files;
+        current = f.get();
+        files.push_back(std::move(f));
+        return true;
+    }
+    //trims the preallocated rest, closes the file and reports it, expects the lock to be held
+    void finish_file(file *f)
+    {
+        if (f->map != nullptr)
+        {
+            ::munmap(f->map, f->map_length);
+        }
+        if (::ftruncate(f->fd, static_cast<off_t>(f->length)) != 0)
+        {
+            fail(errno);
+        }
+        ::close(f->fd);
+        if (on_file)
+        {
+            on_file(f->path, f->length);
+        }
+        files.erase(std::find_if(files.begin(), files.end(), [f](const std::unique_ptr<file> &p) { return p.get() == f; }));
+    }
+    //gives up on the writes nobody will reap any more, closes the files they
+    //kept open and collects their leases, expects the lock to be held
+    void abandon_writes(std::vector<bulk_in_pipe::lease> &released)
+    {
+        std::vector<bool> in_use(ops.size(), true);
+        for (std::size_t i : free_ops)
+        {
+            in_use[i] = false;
+        }
+        for (std::size_t i = 0; i < ops.size(); ++i)
+        {
+            if (!in_use[i])
+            {
+                continue;
+            }
+            auto &op = ops[i];
+            if (op.chunk != npos)
+            {
+                free_chunks.push_back(op.chunk);
+            }
+            released.push_back(std::move(op.data));
+            file *f = op.f;
+            op = write_op{};
+            free_ops.push_back(i);
+            --stats.pending_writes;
+            if (--f->pending == 0 && f->closing)
+            {
+                finish_file(f);
+            }
+        }
+    }
+    //writes what is staged and closes the current file once its writes completed, expects the lock to be held
+    void close_current(std::unique_lock<std::mutex> &lock)
+    {
+        if (current == nullptr)
+        {
+            return;
+        }
+        flush_chunk(lock);
+        file *f = current;
+        current = nullptr;
+        f->closing = true;
+        if (f->pending == 0)
+        {
+            finish_file(f);
+        }
+    }
+    //expects the lock to be held and a free write_op. returns 0 or the errno of
+    //queueing the write, in which case op keeps its lease and chunk
+    int submit(file *f, write_op &op, const unsigned char *data, std::uint64_t offset)
+    {
+        std::size_t i = free_ops.back();
+        //the completion thread takes the lock before it looks at the op
+        if (int err = ring.write(f->fd, data, op.length, offset, i + 1); err != 0)
+        {
+            return err;
+        }
+        free_ops.pop_back();
+        op.f = f;
+        ops[i] = std::move(op);
+        ++f->pending;
+        ++stats.pending_writes;
+        stats.max_pending_writes = std::max(stats.max_pending_writes, stats.pending_writes);
+        return 0;
+    }
+    //submits a full or flushed staging chunk, expects the lock to be held
+    void submit_chunk(write_op op)
+    {
+        std::size_t chunk = op.chunk;
+        if (int err = submit(current, op, staging.get() + chunk * chunk_size, fill_offset); err != 0)
+        {
+            //the staged bytes would leave a hole in the file
+            free_chunks.push_back(chunk);
+            fail(err);
+        }
+        fill_chunk = npos;
+        fill = 0;
+    }
+    //submits the staging chunk, padded to the alignment if it is not full, expects the lock to be held
+    void flush_chunk(std::unique_lock<std::mutex> &lock)
+    {
+        if (fill_chunk == npos)
+        {
+            return;
+        }
+        //nothing would reap the write any more
+        if (fill == 0 || !reaping)
+        {
+            free_chunks.push_back(fill_chunk);
+            fill_chunk = npos;
+            fill = 0;
+            return;
+        }
+        idle.wait(lock, [this] { return !free_ops.empty(); });
+        write_op op;
+        op.chunk = fill_chunk;
+        op.bytes = static_cast<std::uint32_t>(fill);
+        op.length = static_cast<std::uint32_t>(stats.direct ? (fill + alignment - 1) / alignment * alignment : fill);
+        submit_chunk(std::move(op));
+    }
+    //expects the lock to be held
+    void stage(const unsigned char *p, std::size_t n)
+    {
+        while (n != 0)
+        {
+            if (fill_chunk == npos)
+            {
+                fill_chunk = free_chunks.back();
+                free_chunks.pop_back();
+                fill_offset = current->length;
+            }
+            std::size_t k = std::min(n, chunk_size - fill);
+            std::memcpy(staging.get() + fill_chunk * chunk_size + fill, p, k);
+            fill += k;
+            current->length += k;
+            p += k;
+            n -= k;
+            if (fill == chunk_size)
+            {
+                write_op op;
+                op.chunk = fill_chunk;
+                op.bytes = op.length = static_cast<std::uint32_t>(chunk_size);
+                submit_chunk(std::move(op));
+            }
+        }
+    }
+    //expects the lock to be held
+    void copy_mapped(const unsigned char *p, std::size_t n)
+    {
+        file &f = *current;
+        while (n != 0)
+        {
+            if (f.map == nullptr || f.length >= f.map_offset + f.map_length)
+            {
+                if (f.map != nullptr)
+                {
+                    ::munmap(f.map, f.map_length);
+                    f.map = nullptr;
+                }
+                f.map_offset = f.length / alignment * alignment;
+                f.map_length = map_window;
+                if (f.map_offset < file_size)
+                {
+                    //a preallocated file is not grown by the last window
+                    f.map_length = std::min<std::size_t>(map_window, static_cast<std::size_t>((file_size - f.map_offset + alignment - 1) / alignment * alignment));
+                }
+                if (!reserve(f, f.map_offset + f.map_length))
+                {
+                    fail(errno);
+                    return;
+                }
+                void *m = ::mmap(nullptr, f.map_length, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, static_cast<off_t>(f.map_offset));
+                if (m == MAP_FAILED)
+                {
+                    fail(errno);
+                    return;
+                }
+                f.map = static_cast<unsigned char *>(m);
+            }
+            std::size_t at = static_cast<std::size_t>(f.length - f.map_offset);
+            std::size_t k = std::min(n, f.map_length - at);
+            std::memcpy(f.map + at, p, k);
+            f.length += k;
+            stats.bytes += k;
+            p += k;
+            n -= k;
+        }
+    }
+    void complete_writes()
+    {
+        std::vector<std::pair<std::uint64_t, int>> done;
+        std::vector<bulk_in_pipe::lease> released;
+        for (;;)
+        {
+            done.clear();
+            if (int err = ring.wait([&](std::uint64_t user_data, int result) { done.emplace_back(user_data, result); }); err != 0)
+            {
+                //the completions can not be reaped any more, so the writes are lost
+                {
+                    std::lock_guard<std::mutex> lock{mtx};
+                    fail(err);
+                    reaping = false;
+                    abandon_writes(released);
+                }
+                idle.notify_all();
+                released.clear();
+                return;
+            }
+            bool quit = false;
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                for (auto &d : done)
+                {
+                    if (d.first == wake_up)
+                    {
+                        quit = true;
+                        continue;
+                    }
+                    auto &op = ops[d.first - 1];
+                    if (d.second < 0)
+                    {
+                        fail(-d.second);
+                    }
+                    else if (static_cast<std::uint32_t>(d.second) != op.length)
+                    {
+                        fail(ENOSPC);
+                    }
+                    else
+                    {
+                        stats.bytes += op.bytes;
+                        if (op.data)
+                        {
+                            stats.zero_copy_bytes += op.bytes;
+                        }
+                    }
+                    if (op.chunk != npos)
+                    {
+                        free_chunks.push_back(op.chunk);
+                    }
+                    released.push_back(std::move(op.data));
+                    file *f = op.f;
+                    op = write_op{};
+                    free_ops.push_back(d.first - 1);
+                    --stats.pending_writes;
+                    if (--f->pending == 0 && f->closing)
+                    {
+                        finish_file(f);
+                    }
+                }
+            }
+            idle.notify_all();
+            //hands the transfers back to their pipes
+            released.clear();
+            if (quit)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    //file_size is the size of every file, 0 writes everything to one file without preallocation.
+    //queue_depth is the number of writes which can be in flight at once
+    explicit disk_sink(std::string path, std::uint64_t file_size = 0, std::size_t queue_depth = 64)
+        : path{std::move(path)}, file_size{file_size}, queue_depth{std::max<std::size_t>(queue_depth, 1)}
+    {
+    }
+    disk_sink(const disk_sink &) = delete;
+    disk_sink &operator=(const disk_sink &) = delete;
+    ~disk_sink()
+    {
+        stop();
+    }
+
+    //the method used from the next start on, io_uring falls back to mmap if the kernel
+    //lacks it or its IORING_OP_WRITE (before linux 5.6)
+    void set_method(disk_sink_method m)
+    {
+        preferred = m;
+    }
+    //the staging chunks for buffers which can not be written in place,
+    //size is rounded up to a multiple of 4096
+    void set_staging(std::size_t size, std::size_t count)
+    {
+        chunk_size = std::max<std::size_t>((size + alignment - 1) / alignment * alignment, alignment);
+        chunk_count = std::max<std::size_t>(count, 1);
+    }
+    //called with the path and length of every file once it is complete
+    void set_file_callback(std::function<void(const std::string &, std::uint64_t)> f)
+    {
+        on_file = std::move(f);
+    }
+    //called once with the errno of the first write which fails or can not be queued,
+    //or of io_uring_enter if the completions can not be reaped any more, after that
+    //buffers are dropped until the sink is restarted. must not call into the sink
+    void set_error_callback(std::function<void(int)> f)
+    {
+        on_error = std::move(f);
+    }
+
+    //makes the sink the reader of the pipe
+    void attach(bulk_in_pipe &pipe)
+    {
+        device_memory = device_memory || pipe.is_device_memory();
+        pipe.set_reader([this](bulk_in_pipe::lease l) { write(std::move(l)); });
+    }
+
+    //creates the first file and starts writing, returns 0 on success,
+    //LIBUSB_ERROR_BUSY if it is started already or LIBUSB_ERROR_IO if the file can not be created
+    int start()
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        if (running)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        stats = disk_sink_stats{};
+        stats.method = preferred;
+        if (stats.method == disk_sink_method::io_uring && (ring.init(static_cast<unsigned>(queue_depth + 1)) != 0 || !ring.supports(IORING_OP_WRITE)))
+        {
+            ring.close();
+            stats.method = disk_sink_method::mmap;
+        }
+        failure = 0;
+        file_index = 0;
+        if (stats.method == disk_sink_method::io_uring)
+        {
+            //allocated before the first file is created, so a failure leaves no file behind
+            staging.reset(static_cast<unsigned char *>(std::aligned_alloc(alignment, chunk_size * chunk_count)));
+            if (!staging)
+            {
+                ring.close();
+                return LIBUSB_ERROR_NO_MEM;
+            }
+            ops.clear();
+            ops.resize(queue_depth);
+            free_ops.clear();
+            for (std::size_t i = queue_depth; i-- != 0;)
+            {
+                free_ops.push_back(i);
+            }
+            free_chunks.clear();
+            for (std::size_t i = chunk_count; i-- != 0;)
+            {
+                free_chunks.push_back(i);
+            }
+            fill_chunk = npos;
+            fill = 0;
+        }
+        if (!open_file())
+        {
+            ring.close();
+            return LIBUSB_ERROR_IO;
+        }
+        if (stats.method == disk_sink_method::io_uring)
+        {
+            reaping = true;
+            completer = std::thread([this] { complete_writes(); });
+        }
+        running = true;
+        return 0;
+    }
+    //writes what is staged, waits for all writes and closes the file
+    void stop()
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        if (!running)
+        {
+            return;
+        }
+        running = false;
+        close_current(lock);
+        if (stats.method == disk_sink_method::io_uring)
+        {
+            idle.wait(lock, [this] { return stats.pending_writes == 0; });
+            //no write is in flight, so only a lack of resources keeps the nop from being queued
+            while (reaping && ring.nop(wake_up) != 0)
+            {
+                lock.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                lock.lock();
+            }
+            lock.unlock();
+            completer.join();
+        }
+    }
+    bool is_running()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return running;
+    }
+
+    //writes one buffer, for pipes which are not attached, e.g. in the consumer of a queue.
+    //the lease is released once the data is written or copied
+    void write(bulk_in_pipe::lease l)
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        std::size_t n = l.size();
+        if (!running || n == 0)
+        {
+            return;
+        }
+        if (failure != 0)
+        {
+            stats.dropped_bytes += n;
+            return;
+        }
+        if (file_size != 0 && current->length != 0 && current->length + n > file_size)
+        {
+            close_current(lock);
+            if (!open_file())
+            {
+                stats.dropped_bytes += n;
+                return;
+            }
+        }
+        ++stats.buffers;
+        if (stats.method == disk_sink_method::mmap)
+        {
+            copy_mapped(l.data(), n);
+            return;
+        }
+        bool in_place = !stats.direct || (fill_chunk == npos && reinterpret_cast<std::uintptr_t>(l.data()) % alignment == 0 && n % alignment == 0);
+        if (in_place)
+        {
+            if (free_ops.empty())
+            {
+                ++stats.overruns;
+                stats.dropped_bytes += n;
+                return;
+            }
+            write_op op;
+            op.bytes = op.length = static_cast<std::uint32_t>(n);
+            const unsigned char *data = l.data();
+            op.data = std::move(l);
+            if (int err = submit(current, op, data, current->length); err != 0)
+            {
+                //io_uring_enter lacks resources for a moment, anything else will not go away
+                if (err == EAGAIN || err == EBUSY)
+                {
+                    ++stats.overruns;
+                }
+                else
+                {
+                    fail(err);
+                }
+                stats.dropped_bytes += n;
+                //released after the lock
+                l = std::move(op.data);
+                return;
+            }
+            current->length += n;
+            return;
+        }
+        //every chunk which fills up needs a write and at worst a fresh chunk follows it
+        std::size_t filled = (fill + n) / chunk_size;
+        if (free_ops.size() < filled || free_chunks.size() < filled + (fill_chunk == npos ? 1 : 0))
+        {
+            ++stats.overruns;
+            stats.dropped_bytes += n;
+            return;
+        }
+        stage(l.data(), n);
+    }
+
+    disk_sink_stats get_stats()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return stats;
+    }
+    //the errno of the first failed write or 0
+    int get_error()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return failure;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
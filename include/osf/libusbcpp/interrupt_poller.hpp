@@ -0,0 +1,234 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <array>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+#include "detail/pipe_base.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//one report of an interrupt endpoint as it is handed to a queue
+//size is the length which was received, data holds at most Capacity bytes of it
+template <std::size_t Capacity>
+struct basic_interrupt_event
+{
+    std::chrono::steady_clock::time_point arrival;
+    std::size_t size;
+    std::array<unsigned char, Capacity> data;
+};
+using interrupt_event = basic_interrupt_event<64>;
+
+//spacing of consecutive completions of an interrupt endpoint
+//a device which reports in every interval should show a mean of the
+//endpoints bInterval period and a small deviation
+struct interrupt_jitter
+{
+    std::uint64_t samples = 0;
+    std::chrono::nanoseconds min_interval = std::chrono::nanoseconds::max();
+    std::chrono::nanoseconds max_interval{0};
+    std::chrono::nanoseconds mean_interval{0};
+    std::chrono::nanoseconds stddev{0};
+};
+
+//keeps transfers queued on one interrupt IN endpoint at all times
+//every completion is timestamped as soon as libusb reports it, before any
+//other work, and resubmitted right after the report was delivered.
+//with two or more transfers the next one is already queued while a report
+//is handled, so the endpoint is polled in every interval.
+//reports are delivered in order through a callback or a queue.
+//callbacks run on the thread which calls handle_events on the context
+//note: the destructor cancels the transfers and blocks until libusb handed
+//all of them back, see bulk_in_pipe
+class interrupt_poller : public detail::pipe_base<interrupt_poller>
+{
+    friend class detail::pipe_base<interrupt_poller>;
+    using clock = std::chrono::steady_clock;
+    using slot_transfer = basic_transfer<slot_callback>;
+    struct slot
+    {
+        slot_transfer t;
+        std::vector<unsigned char> buffer;
+        clock::time_point arrival{};
+        bool done = false;
+    };
+
+    std::vector<slot> slots;
+    std::atomic<std::size_t> overruns{0};
+    //welford accumulators of the completion spacing in nanoseconds, guarded by mtx
+    clock::time_point last_arrival{};
+    interrupt_jitter jitter{};
+    double mean = 0.0;
+    double m2 = 0.0;
+    std::function<void(clock::time_point, const unsigned char *, const unsigned char *)> consumer;
+
+    //expects the lock to be held
+    void record(clock::time_point arrival) noexcept
+    {
+        if (last_arrival != clock::time_point{})
+        {
+            auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(arrival - last_arrival);
+            ++jitter.samples;
+            jitter.min_interval = std::min(jitter.min_interval, interval);
+            jitter.max_interval = std::max(jitter.max_interval, interval);
+            double x = static_cast<double>(interval.count());
+            double delta = x - mean;
+            mean += delta / static_cast<double>(jitter.samples);
+            m2 += delta * (x - mean);
+        }
+        last_arrival = arrival;
+    }
+    //the slot is not shared before complete marks it done, so the timestamp is taken first
+    void completed(std::size_t i)
+    {
+        slots[i].arrival = clock::now();
+        complete(i);
+    }
+    //expects the lock to be held
+    void dequeued(std::size_t i) noexcept
+    {
+        if (slots[i].t.get_status() == LIBUSB_TRANSFER_COMPLETED)
+        {
+            record(slots[i].arrival);
+        }
+    }
+    void deliver(std::size_t i)
+    {
+        auto &t = slots[i].t;
+        auto status = t.get_status();
+        if (status != LIBUSB_TRANSFER_COMPLETED && status != LIBUSB_TRANSFER_TIMED_OUT)
+        {
+            if (status != LIBUSB_TRANSFER_CANCELLED)
+            {
+                fail(status);
+            }
+            return;
+        }
+        if (status == LIBUSB_TRANSFER_COMPLETED && consumer)
+        {
+            consumer(slots[i].arrival, t.begin(), t.end());
+        }
+        resubmit(i);
+    }
+    //every run starts a new jitter measurement, the spacing to a report
+    //of an earlier run is not counted. expects the lock to be held
+    void starting() noexcept
+    {
+        reset_jitter_locked();
+    }
+    //expects the lock to be held
+    void reset_jitter_locked() noexcept
+    {
+        last_arrival = clock::time_point{};
+        jitter = interrupt_jitter{};
+        mean = 0.0;
+        m2 = 0.0;
+    }
+
+public:
+    //report_size should be the endpoints wMaxPacketSize
+    interrupt_poller(device_handle &dev, endpoint_address ep, std::size_t report_size, std::size_t transfer_count = 2)
+        : pipe_base(transfer_count)
+    {
+        slots.reserve(transfer_count);
+        for (std::size_t i = 0; i < transfer_count; ++i)
+        {
+            slots.push_back(slot{dev.async_interrupt_transfer(ep, slot_callback{this, i}), std::vector<unsigned char>(report_size)});
+            auto &s = slots.back();
+            if (s.t)
+            {
+                s.t.set_buffer(s.buffer.data(), s.buffer.data() + s.buffer.size());
+            }
+        }
+    }
+    interrupt_poller(const interrupt_poller &) = delete;
+    interrupt_poller &operator=(const interrupt_poller &) = delete;
+    ~interrupt_poller()
+    {
+        drain();
+    }
+
+    //true if all transfers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : slots)
+        {
+            if (!s.t)
+            {
+                return false;
+            }
+        }
+        return !slots.empty();
+    }
+
+    //called with the arrival time and the received range of every report
+    //the range is only valid until the callback returns
+    void set_callback(std::function<void(std::chrono::steady_clock::time_point, const unsigned char *, const unsigned char *)> f)
+    {
+        consumer = std::move(f);
+    }
+    //copies every report into a queue (see queue.hpp) of basic_interrupt_event,
+    //a full queue drops the report and counts an overrun.
+    //the queue has to outlive the poller
+    template <typename Queue>
+    void set_queue(Queue &q)
+    {
+        consumer = [this, &q](clock::time_point arrival, const unsigned char *begin, const unsigned char *end) {
+            typename Queue::value_type e;
+            e.arrival = arrival;
+            e.size = static_cast<std::size_t>(end - begin);
+            std::memcpy(e.data.data(), begin, std::min(e.size, e.data.size()));
+            if (!q.try_push(e))
+            {
+                overruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+    }
+    //without a timeout the transfers wait for a report forever,
+    //a timed out transfer is resubmitted without delivering anything
+    void set_timeout(std::chrono::milliseconds t)
+    {
+        for (auto &s : slots)
+        {
+            s.t.set_timeout(t);
+        }
+    }
+
+    //number of reports which were dropped because the queue was full
+    std::size_t get_overruns() const noexcept
+    {
+        return overruns.load(std::memory_order_relaxed);
+    }
+
+    //spacing of the completions since start or the last reset_jitter
+    interrupt_jitter get_jitter() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        interrupt_jitter j = jitter;
+        j.mean_interval = std::chrono::nanoseconds(static_cast<std::int64_t>(mean));
+        if (j.samples > 1)
+        {
+            j.stddev = std::chrono::nanoseconds(static_cast<std::int64_t>(std::sqrt(m2 / static_cast<double>(j.samples - 1))));
+        }
+        return j;
+    }
+    void reset_jitter() noexcept
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        reset_jitter_locked();
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
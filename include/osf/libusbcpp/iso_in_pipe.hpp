@@ -0,0 +1,159 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+#include "buffer_arena.hpp"
+#include "iso_packet.hpp"
+#include "detail/pipe_base.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//continuously reads from one isochronous IN endpoint
+//an isochronous endpoint moves one packet per service interval (a frame or
+//microframe) and a service interval without a queued transfer is lost for
+//good, so the pipe keeps transfer_count transfers submitted at all times and
+//resubmits every one right after its packets were handed to the consumer.
+//see transfers_for to size the queue. every transfer carries
+//packets_per_transfer packets of the endpoints max iso packet size.
+//callbacks run on the thread which calls handle_events on the context
+//note: the destructor cancels the transfers and blocks until libusb handed
+//all of them back, see bulk_in_pipe
+class iso_in_pipe : public detail::pipe_base<iso_in_pipe>
+{
+    friend class detail::pipe_base<iso_in_pipe>;
+    using slot_transfer = basic_transfer<slot_callback>;
+    struct slot
+    {
+        slot_transfer t;
+        buffer_arena::slab buffer;
+        bool done = false;
+    };
+
+    int packet_size;
+    int packets;
+    buffer_arena arena;
+    std::vector<slot> slots;
+    std::atomic<std::uint64_t> packet_errors{0};
+    std::function<void(iso_packet_range)> consumer;
+
+    static int packet_size_of(device_handle &dev, endpoint_address ep)
+    {
+        int size = 0;
+        dev.get_max_iso_packet_size(ep)(
+            [&](int s) { size = s; },
+            [](auto) {});
+        return size;
+    }
+    void deliver(std::size_t i)
+    {
+        auto &t = slots[i].t;
+        auto status = t.get_status();
+        if (status != LIBUSB_TRANSFER_COMPLETED)
+        {
+            if (status != LIBUSB_TRANSFER_CANCELLED)
+            {
+                fail(status);
+            }
+            return;
+        }
+        //the transfer completes as a whole, lost or damaged packets only show in their own status
+        for (auto packet : t.iso_packets())
+        {
+            if (!packet.is_completed())
+            {
+                packet_errors.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (consumer)
+        {
+            consumer(t.iso_packets());
+        }
+        resubmit(i);
+    }
+
+public:
+    iso_in_pipe(device_handle &dev, endpoint_address ep, std::size_t transfer_count, int packets_per_transfer)
+        : pipe_base(transfer_count),
+          packet_size{packet_size_of(dev, ep)},
+          packets{packets_per_transfer},
+          arena(dev, static_cast<std::size_t>(std::max(packet_size, 1)) * packets_per_transfer, transfer_count)
+    {
+        slots.reserve(transfer_count);
+        for (std::size_t i = 0; i < transfer_count; ++i)
+        {
+            slots.push_back(slot{dev.async_iso_transfer(ep, packets_per_transfer, slot_callback{this, i}), arena.acquire()});
+            auto &s = slots.back();
+            if (s.t && s.buffer)
+            {
+                s.t.set_buffer(s.buffer.begin(), s.buffer.end());
+                s.t.set_iso_packet_lengths(static_cast<unsigned int>(packet_size));
+            }
+        }
+    }
+    iso_in_pipe(const iso_in_pipe &) = delete;
+    iso_in_pipe &operator=(const iso_in_pipe &) = delete;
+    ~iso_in_pipe()
+    {
+        drain();
+    }
+
+    //the number of transfers which keep the endpoint served although completions
+    //are handled up to latency late, service_interval is the time between two
+    //packets (125us * 2^(bInterval - 1) at high speed, 1ms * 2^(bInterval - 1) at full speed)
+    static std::size_t transfers_for(std::chrono::microseconds latency, int packets_per_transfer, std::chrono::microseconds service_interval) noexcept
+    {
+        auto covered = service_interval * packets_per_transfer;
+        if (covered.count() <= 0)
+        {
+            return 2;
+        }
+        auto n = static_cast<std::size_t>((latency + covered - std::chrono::microseconds(1)) / covered);
+        return std::max<std::size_t>(n + 1, 2); //one more which is being handled
+    }
+
+    //true if the endpoint was found and all transfers and buffers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : slots)
+        {
+            if (!s.t || !s.buffer)
+            {
+                return false;
+            }
+        }
+        return packet_size > 0 && !slots.empty();
+    }
+
+    //called with the packets of every completed transfer
+    //the packets are only valid until the callback returns
+    void set_callback(std::function<void(iso_packet_range)> f)
+    {
+        consumer = std::move(f);
+    }
+
+    //number of packets which completed with an error status
+    std::uint64_t get_packet_errors() const noexcept
+    {
+        return packet_errors.load(std::memory_order_relaxed);
+    }
+    int get_packet_size() const noexcept
+    {
+        return packet_size;
+    }
+    int get_packets_per_transfer() const noexcept
+    {
+        return packets;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,114 @@
+#pragma once
+#include "libusb.h"
+#include <cstddef>
+#include "buffer_view.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//non owning view of one packet of an isochronous transfer
+//note: this view is only valid as long as the transfer is not resubmitted
+class iso_packet
+{
+    friend class iso_packet_iterator;
+    const libusb_iso_packet_descriptor *pdesc;
+    const unsigned char *buffer; //start of this packet in the transfer buffer
+    iso_packet(const libusb_iso_packet_descriptor *d, const unsigned char *b) noexcept : pdesc{d}, buffer{b} {}
+
+public:
+    const libusb_iso_packet_descriptor *get() const noexcept
+    {
+        return pdesc;
+    }
+    //every packet has its own status, the one of the transfer does not cover them
+    libusb_transfer_status get_status() const noexcept
+    {
+        return pdesc->status;
+    }
+    bool is_completed() const noexcept
+    {
+        return pdesc->status == LIBUSB_TRANSFER_COMPLETED;
+    }
+    //the number of bytes which were requested for this packet
+    unsigned int get_length() const noexcept
+    {
+        return pdesc->length;
+    }
+    //the range [begin, end) holds the data which was actually transferred
+    const unsigned char *begin() const noexcept
+    {
+        return buffer;
+    }
+    const unsigned char *end() const noexcept
+    {
+        return buffer + pdesc->actual_length;
+    }
+    std::size_t size() const noexcept
+    {
+        return pdesc->actual_length;
+    }
+    buffer_view data() const noexcept
+    {
+        return buffer_view{begin(), end()};
+    }
+};
+
+//the packets of a transfer are stored back to back in its buffer,
+//each one taking its requested length regardless of the actual length
+class iso_packet_iterator
+{
+    friend class iso_packet_range;
+    const libusb_iso_packet_descriptor *pdesc;
+    const unsigned char *buffer;
+    iso_packet_iterator(const libusb_iso_packet_descriptor *d, const unsigned char *b) noexcept : pdesc{d}, buffer{b} {}
+
+public:
+    iso_packet_iterator &operator++() noexcept
+    {
+        buffer += pdesc->length;
+        ++pdesc;
+        return *this;
+    }
+    iso_packet_iterator operator++(int) noexcept
+    {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+    iso_packet operator*() const noexcept
+    {
+        return iso_packet{pdesc, buffer};
+    }
+    friend bool operator==(const iso_packet_iterator &lhs, const iso_packet_iterator &rhs) noexcept
+    {
+        return lhs.pdesc == rhs.pdesc;
+    }
+    friend bool operator!=(const iso_packet_iterator &lhs, const iso_packet_iterator &rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+};
+
+//non owning view of the packets of an isochronous transfer
+class iso_packet_range
+{
+    const libusb_transfer *body;
+
+public:
+    explicit iso_packet_range(const libusb_transfer *t) noexcept : body{t} {}
+    iso_packet_iterator begin() const noexcept
+    {
+        return iso_packet_iterator{&body->iso_packet_desc[0], body->buffer};
+    }
+    iso_packet_iterator end() const noexcept
+    {
+        return iso_packet_iterator{&body->iso_packet_desc[0] + body->num_iso_packets, nullptr};
+    }
+    std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(body->num_iso_packets);
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,264 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace detail
+{
+//head and tail live on their own cache lines, so producer and consumer
+//do not invalidate each others line on every operation
+constexpr std::size_t cache_line = 64;
+
+inline std::size_t round_up_pow2(std::size_t n) noexcept
+{
+    std::size_t r = 2;
+    while (r < n)
+    {
+        r <<= 1;
+    }
+    return r;
+}
+
+//uninitialized storage for one T
+template <typename T>
+struct queue_storage
+{
+    alignas(T) unsigned char bytes[sizeof(T)];
+
+    T *get() noexcept
+    {
+        return std::launder(reinterpret_cast<T *>(bytes));
+    }
+};
+} // namespace detail
+
+//bounded lock free queue for exactly one producer and one consumer thread
+//meant to hand completed transfers (or pipe leases) from the thread which
+//handles the events to a worker thread, so the completion callback only
+//has to push and the heavy lifting happens elsewhere.
+//the capacity is rounded up to a power of two and never grows,
+//try_push fails instead of blocking if the consumer falls behind
+template <typename T>
+class spsc_queue
+{
+public:
+    using value_type = T;
+
+private:
+    std::unique_ptr<detail::queue_storage<T>[]> cells;
+    std::size_t mask;
+    //the consumers line: head and its last view of tail
+    alignas(detail::cache_line) std::atomic<std::size_t> head{0};
+    std::size_t cached_tail = 0;
+    //the producers line: tail and its last view of head, which saves
+    //reading the consumers line on every push
+    alignas(detail::cache_line) std::atomic<std::size_t> tail{0};
+    std::size_t cached_head = 0;
+
+public:
+    explicit spsc_queue(std::size_t capacity)
+        : cells{new detail::queue_storage<T>[detail::round_up_pow2(capacity)]}, mask{detail::round_up_pow2(capacity) - 1}
+    {
+    }
+    spsc_queue(const spsc_queue &) = delete;
+    spsc_queue &operator=(const spsc_queue &) = delete;
+    ~spsc_queue()
+    {
+        while (try_pop())
+        {
+        }
+    }
+
+    //producer side, returns false if the queue is full
+    template <typename... Args>
+    bool try_emplace(Args &&... args) noexcept(std::is_nothrow_constructible_v<T, Args...>)
+    {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+            {
+                return false;
+            }
+        }
+        new (cells[t & mask].bytes) T(std::forward<Args>(args)...);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_push(T &&v) noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        return try_emplace(std::move(v));
+    }
+    bool try_push(const T &v) noexcept(std::is_nothrow_copy_constructible_v<T>)
+    {
+        return try_emplace(v);
+    }
+    //consumer side, returns an empty optional if the queue is empty
+    std::optional<T> try_pop() noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+            {
+                return std::nullopt;
+            }
+        }
+        T *p = cells[h & mask].get();
+        std::optional<T> r{std::move(*p)};
+        p->~T();
+        head.store(h + 1, std::memory_order_release);
+        return r;
+    }
+
+    //only a snapshot while both sides are running
+    std::size_t size() const noexcept
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+    std::size_t capacity() const noexcept
+    {
+        return mask + 1;
+    }
+};
+
+//bounded lock free queue for any number of producer and consumer threads
+//a pool of worker threads pops from it, while one or more event threads push.
+//every cell carries a sequence number which tells whether it is free for
+//the producer of this round or filled for the consumer of this round,
+//so producers and consumers only contend on their own position counter
+template <typename T>
+class mpmc_queue
+{
+public:
+    using value_type = T;
+
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        detail::queue_storage<T> storage;
+    };
+    std::unique_ptr<cell[]> cells;
+    std::size_t mask;
+    alignas(detail::cache_line) std::atomic<std::size_t> enqueue_pos{0};
+    alignas(detail::cache_line) std::atomic<std::size_t> dequeue_pos{0};
+
+public:
+    explicit mpmc_queue(std::size_t capacity)
+        : cells{new cell[detail::round_up_pow2(capacity)]}, mask{detail::round_up_pow2(capacity) - 1}
+    {
+        for (std::size_t i = 0; i <= mask; ++i)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    mpmc_queue(const mpmc_queue &) = delete;
+    mpmc_queue &operator=(const mpmc_queue &) = delete;
+    ~mpmc_queue()
+    {
+        while (try_pop())
+        {
+        }
+    }
+
+    //returns false if the queue is full
+    template <typename... Args>
+    bool try_emplace(Args &&... args) noexcept(std::is_nothrow_constructible_v<T, Args...>)
+    {
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell &c = cells[pos & mask];
+            std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    new (c.storage.bytes) T(std::forward<Args>(args)...);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; //the consumer of the previous round did not free the cell yet
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool try_push(T &&v) noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        return try_emplace(std::move(v));
+    }
+    bool try_push(const T &v) noexcept(std::is_nothrow_copy_constructible_v<T>)
+    {
+        return try_emplace(v);
+    }
+    //returns an empty optional if the queue is empty
+    std::optional<T> try_pop() noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell &c = cells[pos & mask];
+            std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    T *p = c.storage.get();
+                    std::optional<T> r{std::move(*p)};
+                    p->~T();
+                    c.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return r;
+                }
+            }
+            else if (diff < 0)
+            {
+                return std::nullopt;
+            }
+            else
+            {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //only a snapshot while producers or consumers are running
+    std::size_t size() const noexcept
+    {
+        std::size_t e = enqueue_pos.load(std::memory_order_acquire);
+        std::size_t d = dequeue_pos.load(std::memory_order_acquire);
+        return e > d ? e - d : 0;
+    }
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+    std::size_t capacity() const noexcept
+    {
+        return mask + 1;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,1517 @@
+#pragma once
+#include "libusb.h"
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <poll.h>
+#include "backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace sim
+{
+//makes a share of the transfers on an endpoint fail
+struct error_injection
+{
+    libusb_transfer_status status = LIBUSB_TRANSFER_ERROR;
+    std::uint64_t every_nth = 0; //fail every nth transfer, 0 disables this
+    double probability = 0.0;    //fail transfers at random with this probability
+    std::uint32_t seed = 1;      //random failures are repeatable for a given seed
+};
+
+//one completion of a recorded IN endpoint, see sim_replay.hpp
+struct replay_completion
+{
+    std::chrono::nanoseconds at{0}; //since the start of the recording
+    libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED;
+    std::uint32_t length = 0;         //bytes the device sent
+    std::vector<unsigned char> data{}; //the captured start of them, the rest reads as zeros
+};
+enum class replay_timing
+{
+    original,          //every completion happens at its recorded time after the replay started
+    as_fast_as_possible //every completion happens as soon as a transfer is waiting for it
+};
+//the completions an IN endpoint plays back in order, one per transfer
+struct replay_script
+{
+    std::vector<replay_completion> completions{};
+    replay_timing timing = replay_timing::original;
+    double speed = 1.0; //divides the recorded times with original timing
+};
+
+struct endpoint_config
+{
+    unsigned char address = 0;
+    libusb_endpoint_transfer_type type = LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK;
+    std::uint16_t max_packet_size = 512;
+    std::uint8_t interval = 0;
+    double bandwidth = 0.0;              //in bytes per second, 0 means unlimited
+    std::chrono::nanoseconds latency{0}; //added to every transfer
+    error_injection errors{};
+    //IN endpoints: fills a transfer and returns the number of bytes produced,
+    //without a source every transfer completes with its full length and the buffer untouched
+    std::function<int(unsigned char *, int)> source;
+    //OUT endpoints: consumes the data of a transfer, a zero length packet
+    //(an empty transfer or LIBUSB_TRANSFER_ADD_ZERO_PACKET) is a call with length 0
+    std::function<void(const unsigned char *, int)> sink;
+    //IN endpoints: serve the data written to the OUT endpoint with the same number
+    //instead of calling the source, transfers wait until data is available
+    bool loopback = false;
+    //bulk endpoints of super speed devices: the number of streams alloc_streams
+    //grants at most, 0 means the endpoint does not support streams
+    std::uint32_t max_streams = 0;
+    //IN endpoints: play back a recording instead of calling the source,
+    //transfers wait once the script is played to its end
+    std::shared_ptr<const replay_script> replay{};
+};
+
+struct interface_config
+{
+    std::uint8_t number = 0;
+    std::uint8_t alternate_setting = 0;
+    std::uint8_t interface_class = LIBUSB_CLASS_VENDOR_SPEC;
+    std::uint8_t interface_subclass = 0;
+    std::uint8_t interface_protocol = 0;
+    std::vector<endpoint_config> endpoints{};
+};
+
+struct device_config
+{
+    std::uint16_t vendor_id = 0;
+    std::uint16_t product_id = 0;
+    std::uint16_t bcd_usb = 0x0200;
+    std::uint16_t bcd_device = 0x0100;
+    std::uint8_t device_class = LIBUSB_CLASS_PER_INTERFACE;
+    std::uint8_t device_subclass = 0;
+    std::uint8_t device_protocol = 0;
+    std::uint8_t max_packet_size0 = 64;
+    libusb_speed speed = LIBUSB_SPEED_HIGH;
+    std::uint8_t bus_number = 1;
+    std::uint8_t device_address = 1;
+    std::vector<std::uint8_t> port_numbers{1};
+    std::vector<interface_config> interfaces{};
+    //round trip of one control request besides its bus time, the round trips of requests
+    //queued at once overlap. the bus time of the setup packet and the data stage at the
+    //signalling rate of speed is added to every request and does not overlap
+    std::chrono::nanoseconds control_latency{0};
+    //answers control transfers, returns the number of bytes of the data stage
+    //or a negative libusb error code, LIBUSB_ERROR_PIPE stalls the request.
+    //without a handler every control request stalls
+    std::function<int(const libusb_control_setup &, unsigned char *)> control;
+};
+
+//a vendor specific device with one bulk OUT endpoint 0x01 and one bulk IN
+//endpoint 0x81 which returns everything written to the OUT endpoint
+inline device_config loopback_device(std::uint16_t vendor_id, std::uint16_t product_id, double bandwidth = 0.0, std::chrono::nanoseconds latency = std::chrono::nanoseconds{0})
+{
+    device_config cfg{};
+    cfg.vendor_id = vendor_id;
+    cfg.product_id = product_id;
+    endpoint_config out{};
+    out.address = 0x01;
+    out.bandwidth = bandwidth;
+    out.latency = latency;
+    endpoint_config in = out;
+    in.address = 0x81;
+    in.loopback = true;
+    interface_config intf{};
+    intf.endpoints = {out, in};
+    cfg.interfaces.push_back(intf);
+    return cfg;
+}
+
+class backend;
+namespace detail
+{
+using clock = std::chrono::steady_clock;
+
+//bookkeeping stored in front of every libusb_transfer allocated by the simulation
+struct alignas(std::max_align_t) transfer_state
+{
+    bool submitted = false;
+    bool cancelled = false;
+    bool scheduled = false;
+    clock::time_point submitted_at{};
+    clock::time_point due{};
+    std::uint32_t stream_id = 0;
+};
+constexpr std::size_t transfer_state_size = (sizeof(transfer_state) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+inline transfer_state *state_of(libusb_transfer *t) noexcept
+{
+    return reinterpret_cast<transfer_state *>(reinterpret_cast<unsigned char *>(t) - transfer_state_size);
+}
+
+struct endpoint_state
+{
+    endpoint_config cfg;
+    std::deque<libusb_transfer *> queue{}; //submitted transfers in service order
+    clock::time_point busy_until{};
+    std::uint64_t count = 0;
+    std::minstd_rand rng;
+    std::deque<unsigned char> fifo{}; //loopback data waiting to be read
+    std::uint64_t missed_frames = 0; //isochronous service intervals without a queued transfer
+    std::size_t replayed = 0;        //completions of the replay script which were played
+    //a bulk stream has its own queue and loopback data but shares the bandwidth of its endpoint
+    endpoint_state *parent = nullptr;
+    std::uint32_t stream = 0;
+    std::vector<std::unique_ptr<endpoint_state>> streams{}; //allocated streams, stream id n is at n - 1
+    explicit endpoint_state(endpoint_config c) : cfg{std::move(c)}, rng{cfg.errors.seed} {}
+    endpoint_state(endpoint_state *p, std::uint32_t id) : cfg{p->cfg}, rng{cfg.errors.seed + id}, parent{p}, stream{id} {}
+};
+
+inline std::size_t endpoint_index(unsigned char address) noexcept
+{
+    return (address & LIBUSB_ENDPOINT_ADDRESS_MASK) | ((address & LIBUSB_ENDPOINT_IN) ? 16 : 0);
+}
+
+//stands in for libusb_device, never moves once created
+//bytes per second the bus moves at the given speed, protocol overhead aside
+inline double signalling_rate(libusb_speed speed) noexcept
+{
+    switch (speed)
+    {
+    case LIBUSB_SPEED_LOW:
+        return 1.5e6 / 8;
+    case LIBUSB_SPEED_FULL:
+        return 12e6 / 8;
+    case LIBUSB_SPEED_SUPER:
+        return 5e9 / 10; //8b/10b encoding
+    case LIBUSB_SPEED_SUPER_PLUS:
+        return 10e9 * 128 / 132 / 8; //128b/132b encoding
+    default:
+        return 480e6 / 8;
+    }
+}
+
+struct device_state
+{
+    sim::backend *bus;
+    device_config cfg;
+    std::atomic<long> refs{0};
+    bool attached = true;
+    std::uint32_t claimed = 0;
+    clock::time_point replay_start{}; //the first transfer on a replaying endpoint
+    libusb_device_descriptor desc{};
+    std::vector<libusb_endpoint_descriptor> endpoint_descs{};
+    std::vector<libusb_interface_descriptor> altsettings{};
+    std::vector<libusb_interface> interfaces{};
+    libusb_config_descriptor config{};
+    std::array<std::unique_ptr<endpoint_state>, 32> endpoints{};
+
+    device_state(sim::backend *b, device_config c) : bus{b}, cfg{std::move(c)}
+    {
+        desc = {LIBUSB_DT_DEVICE_SIZE, LIBUSB_DT_DEVICE, cfg.bcd_usb, cfg.device_class, cfg.device_subclass,
+                cfg.device_protocol, cfg.max_packet_size0, cfg.vendor_id, cfg.product_id, cfg.bcd_device, 0, 0, 0, 1};
+
+        auto &intfs = cfg.interfaces;
+        std::stable_sort(intfs.begin(), intfs.end(), [](const interface_config &lhs, const interface_config &rhs) {
+            return lhs.number < rhs.number || (lhs.number == rhs.number && lhs.alternate_setting < rhs.alternate_setting);
+        });
+        std::size_t endpoint_count = 0;
+        for (auto &intf : intfs)
+        {
+            endpoint_count += intf.endpoints.size();
+        }
+        //reserve up front, the descriptors point into these vectors
+        endpoint_descs.reserve(endpoint_count);
+        altsettings.reserve(intfs.size());
+        std::uint16_t total_length = LIBUSB_DT_CONFIG_SIZE;
+        for (auto &intf : intfs)
+        {
+            const libusb_endpoint_descriptor *first = endpoint_descs.data() + endpoint_descs.size();
+            for (auto &ep : intf.endpoints)
+            {
+                endpoint_descs.push_back({LIBUSB_DT_ENDPOINT_SIZE, LIBUSB_DT_ENDPOINT, ep.address, static_cast<std::uint8_t>(ep.type),
+                                          ep.max_packet_size, ep.interval, 0, 0, nullptr, 0});
+                if (!endpoints[endpoint_index(ep.address)])
+                {
+                    endpoints[endpoint_index(ep.address)] = std::make_unique<endpoint_state>(ep);
+                }
+                total_length += LIBUSB_DT_ENDPOINT_SIZE;
+            }
+            altsettings.push_back({LIBUSB_DT_INTERFACE_SIZE, LIBUSB_DT_INTERFACE, intf.number, intf.alternate_setting,
+                                   static_cast<std::uint8_t>(intf.endpoints.size()), intf.interface_class, intf.interface_subclass,
+                                   intf.interface_protocol, 0, first, nullptr, 0});
+            total_length += LIBUSB_DT_INTERFACE_SIZE;
+        }
+        for (std::size_t i = 0; i < altsettings.size();)
+        {
+            std::size_t j = i;
+            while (j < altsettings.size() && altsettings[j].bInterfaceNumber == altsettings[i].bInterfaceNumber)
+            {
+                ++j;
+            }
+            interfaces.push_back({&altsettings[i], static_cast<int>(j - i)});
+            i = j;
+        }
+        config = {LIBUSB_DT_CONFIG_SIZE, LIBUSB_DT_CONFIG, total_length, static_cast<std::uint8_t>(interfaces.size()),
+                  1, 0, 0x80, 50, interfaces.data(), nullptr, 0};
+
+        endpoint_config ep0{};
+        ep0.type = LIBUSB_ENDPOINT_TRANSFER_TYPE_CONTROL;
+        ep0.max_packet_size = cfg.max_packet_size0;
+        ep0.latency = cfg.control_latency;
+        ep0.bandwidth = signalling_rate(cfg.speed);
+        endpoints[0] = std::make_unique<endpoint_state>(ep0);
+    }
+    bool has_interface(int number) const noexcept
+    {
+        for (auto &intf : interfaces)
+        {
+            if (intf.altsetting->bInterfaceNumber == number)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+//a registered hotplug callback and the events it was not told about yet
+struct hotplug_state
+{
+    libusb_context *ctx;
+    libusb_hotplug_callback_handle handle;
+    int events;
+    int vendor_id;
+    int product_id;
+    int dev_class;
+    libusb_hotplug_callback_fn fn;
+    void *user_data;
+    std::deque<std::pair<device_state *, libusb_hotplug_event>> pending{};
+
+    bool matches(const device_state &dev, libusb_hotplug_event event) const noexcept
+    {
+        return (events & event) != 0 &&
+               (vendor_id == LIBUSB_HOTPLUG_MATCH_ANY || vendor_id == dev.cfg.vendor_id) &&
+               (product_id == LIBUSB_HOTPLUG_MATCH_ANY || product_id == dev.cfg.product_id) &&
+               (dev_class == LIBUSB_HOTPLUG_MATCH_ANY || dev_class == dev.cfg.device_class);
+    }
+};
+
+//stands in for libusb_device_handle
+struct handle_state
+{
+    device_state *dev;
+    std::uint32_t claimed = 0;
+};
+
+//stands in for libusb_context
+struct context_state
+{
+    sim::backend *bus;
+    bool interrupted = false; //set by interrupt_event_handler
+    bool discovery = true;    //cleared by LIBUSB_OPTION_NO_DEVICE_DISCOVERY
+};
+
+inline device_state *cast(libusb_device *p) noexcept
+{
+    return reinterpret_cast<device_state *>(p);
+}
+inline handle_state *cast(libusb_device_handle *p) noexcept
+{
+    return reinterpret_cast<handle_state *>(p);
+}
+} // namespace detail
+
+//an in process usb bus with simulated devices
+//devices are described by a device_config and behave like real devices
+//regarding enumeration, descriptors and transfers: every endpoint serves its
+//transfers in order, each one taking the configured latency plus its length
+//divided by the bandwidth. completions are delivered from handle_events.
+//a context created with this backend only sees the simulated devices:
+//    sim::backend bus;
+//    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+//    context ctx{bus};
+//bulk endpoints with max_streams support bulk streams, every stream has its
+//own queue and loopback data while all of them share the endpoints bandwidth.
+//the source, sink and control hooks of the configs are called with the bus
+//locked and must not call back into the backend
+class backend final : public libusbcpp::backend
+{
+    using clock = detail::clock;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<detail::device_state>> devices;
+    std::size_t handles = 0;
+    std::size_t transfers = 0;
+    //transfers which get_next_timeout found to be due already
+    std::vector<libusb_transfer *> collected;
+    std::vector<std::unique_ptr<detail::hotplug_state>> hotplug;
+    libusb_hotplug_callback_handle next_hotplug_handle = 1;
+    //LIBUSB_OPTION_NO_DEVICE_DISCOVERY set without a context applies to the contexts created later
+    bool default_discovery = true;
+    //the file descriptors of open_sys_device and the devices they stand for
+    std::vector<std::pair<int, detail::device_state *>> sys_devices;
+    //readable whenever the state of the bus changed, stands in for the
+    //pollfds of libusb so the simulation can be driven by an external event loop
+    int event_fd = -1;
+
+    void signal() noexcept
+    {
+        std::uint64_t one = 1;
+        if (::write(event_fd, &one, sizeof(one)) < 0)
+        {
+            //the counter is saturated, the fd is readable anyway
+        }
+    }
+    void drain() noexcept
+    {
+        std::uint64_t value;
+        if (::read(event_fd, &value, sizeof(value)) < 0)
+        {
+            //nothing to drain
+        }
+    }
+
+    static bool discovers(libusb_context *ctx) noexcept
+    {
+        return ctx == nullptr || reinterpret_cast<detail::context_state *>(ctx)->discovery;
+    }
+    //expects the lock to be held, queues the event for every callback which is interested
+    void notify_hotplug(detail::device_state &dev, libusb_hotplug_event event)
+    {
+        for (auto &h : hotplug)
+        {
+            if (discovers(h->ctx) && h->matches(dev, event))
+            {
+                ++dev.refs;
+                h->pending.emplace_back(&dev, event);
+            }
+        }
+    }
+    //calls the hotplug callbacks of ctx for their pending events with the bus
+    //unlocked, like libusb does from within handle_events.
+    //returns false if there was nothing to deliver
+    bool deliver_hotplug(libusb_context *ctx, std::unique_lock<std::mutex> &lock)
+    {
+        struct call
+        {
+            libusb_hotplug_callback_fn fn;
+            void *user_data;
+            libusb_hotplug_callback_handle handle;
+            detail::device_state *dev;
+            libusb_hotplug_event event;
+        };
+        std::vector<call> calls;
+        for (auto &h : hotplug)
+        {
+            if (h->ctx == ctx)
+            {
+                for (auto &e : h->pending)
+                {
+                    calls.push_back({h->fn, h->user_data, h->handle, e.first, e.second});
+                }
+                h->pending.clear();
+            }
+        }
+        if (calls.empty())
+        {
+            return false;
+        }
+        lock.unlock();
+        std::vector<libusb_hotplug_callback_handle> finished;
+        for (auto &c : calls)
+        {
+            //a callback which returned non zero is deregistered and hears of nothing else
+            if (std::find(finished.begin(), finished.end(), c.handle) == finished.end() &&
+                c.fn(ctx, reinterpret_cast<libusb_device *>(c.dev), c.event, c.user_data) != 0)
+            {
+                finished.push_back(c.handle);
+            }
+            --c.dev->refs;
+        }
+        lock.lock();
+        for (auto handle : finished)
+        {
+            erase_hotplug(ctx, handle);
+        }
+        return true;
+    }
+    //expects the lock to be held
+    void erase_hotplug(libusb_context *ctx, libusb_hotplug_callback_handle handle) noexcept
+    {
+        for (auto it = hotplug.begin(); it != hotplug.end(); ++it)
+        {
+            if ((*it)->ctx == ctx && (*it)->handle == handle)
+            {
+                for (auto &e : (*it)->pending)
+                {
+                    --e.first->refs;
+                }
+                hotplug.erase(it);
+                return;
+            }
+        }
+    }
+
+    detail::endpoint_state *endpoint_of(libusb_transfer *t) const noexcept
+    {
+        auto *dev = detail::cast(t->dev_handle)->dev;
+        if (t->type == LIBUSB_TRANSFER_TYPE_CONTROL)
+        {
+            return dev->endpoints[0].get();
+        }
+        auto *ep = dev->endpoints[detail::endpoint_index(t->endpoint)].get();
+        if (ep != nullptr && t->type == LIBUSB_TRANSFER_TYPE_BULK_STREAM)
+        {
+            std::uint32_t id = detail::state_of(t)->stream_id;
+            return id != 0 && id <= ep->streams.size() ? ep->streams[id - 1].get() : nullptr;
+        }
+        return ep;
+    }
+
+    //time the bytes occupy the endpoint
+    static clock::duration bus_time(const detail::endpoint_state &ep, std::size_t bytes) noexcept
+    {
+        if (ep.cfg.bandwidth > 0.0)
+        {
+            return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(bytes / ep.cfg.bandwidth));
+        }
+        return clock::duration{0};
+    }
+    static clock::duration transfer_time(const detail::endpoint_state &ep, std::size_t bytes) noexcept
+    {
+        return std::chrono::duration_cast<clock::duration>(ep.cfg.latency) + bus_time(ep, bytes);
+    }
+    //time between two polls of an isochronous or interrupt endpoint
+    static clock::duration service_interval(const detail::device_state &dev, const detail::endpoint_state &ep) noexcept
+    {
+        if (dev.cfg.speed >= LIBUSB_SPEED_HIGH)
+        {
+            return std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(125)) * (1 << (std::clamp<int>(ep.cfg.interval, 1, 16) - 1));
+        }
+        if (ep.cfg.type == LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT)
+        {
+            return std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds(std::max<int>(ep.cfg.interval, 1)));
+        }
+        return std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds(1)) * (1 << (std::clamp<int>(ep.cfg.interval, 1, 16) - 1));
+    }
+    //the first interval boundary at or after t
+    static clock::time_point next_interval(clock::time_point t, clock::duration period) noexcept
+    {
+        return clock::time_point{(t.time_since_epoch() + period - clock::duration(1)) / period * period};
+    }
+    static clock::time_point deadline_of(libusb_transfer *t, clock::time_point submitted) noexcept
+    {
+        return t->timeout == 0 ? clock::time_point::max() : submitted + std::chrono::milliseconds(t->timeout);
+    }
+    static void finish(libusb_transfer *t, libusb_transfer_status status, int actual_length) noexcept
+    {
+        t->status = status;
+        t->actual_length = actual_length;
+        for (int i = 0; i < t->num_iso_packets && status != LIBUSB_TRANSFER_COMPLETED; ++i)
+        {
+            t->iso_packet_desc[i].actual_length = 0;
+            t->iso_packet_desc[i].status = status;
+        }
+    }
+
+    //moves the data of a transfer which is due and sets its result
+    void execute(detail::device_state &dev, detail::endpoint_state &ep, libusb_transfer *t)
+    {
+        if (!dev.attached)
+        {
+            return finish(t, LIBUSB_TRANSFER_NO_DEVICE, 0);
+        }
+        ++ep.count;
+        auto &errors = ep.cfg.errors;
+        if ((errors.every_nth != 0 && ep.count % errors.every_nth == 0) ||
+            (errors.probability > 0.0 && std::uniform_real_distribution<double>{}(ep.rng) < errors.probability))
+        {
+            return finish(t, errors.status, 0);
+        }
+        bool in = (t->endpoint & LIBUSB_ENDPOINT_IN) != 0;
+        if (t->type == LIBUSB_TRANSFER_TYPE_CONTROL)
+        {
+            auto *setup = libusb_control_transfer_get_setup(t);
+            int r = dev.cfg.control ? dev.cfg.control(*setup, libusb_control_transfer_get_data(t)) : LIBUSB_ERROR_PIPE;
+            if (r < 0)
+            {
+                return finish(t, r == LIBUSB_ERROR_PIPE ? LIBUSB_TRANSFER_STALL : LIBUSB_TRANSFER_ERROR, 0);
+            }
+            return finish(t, LIBUSB_TRANSFER_COMPLETED, std::min<int>(r, setup->wLength));
+        }
+        if (in && ep.cfg.replay && t->type != LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            const auto &c = ep.cfg.replay->completions[ep.replayed++];
+            int n = static_cast<int>(std::min<std::uint32_t>(c.length, static_cast<std::uint32_t>(t->length)));
+            int captured = std::min(n, static_cast<int>(c.data.size()));
+            std::copy(c.data.begin(), c.data.begin() + captured, t->buffer);
+            std::fill(t->buffer + captured, t->buffer + n, 0);
+            //a recorded packet which does not fit overflows the transfer, as on a real bus
+            return finish(t, c.length > static_cast<std::uint32_t>(t->length) ? LIBUSB_TRANSFER_OVERFLOW : c.status, n);
+        }
+        if (t->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            unsigned char *p = t->buffer;
+            int total = 0;
+            for (int i = 0; i < t->num_iso_packets; ++i)
+            {
+                auto &packet = t->iso_packet_desc[i];
+                int len = static_cast<int>(packet.length);
+                packet.actual_length = static_cast<unsigned int>(move_data(dev, ep, in, p, len));
+                packet.status = LIBUSB_TRANSFER_COMPLETED;
+                total += static_cast<int>(packet.actual_length);
+                p += packet.length;
+            }
+            return finish(t, LIBUSB_TRANSFER_COMPLETED, total);
+        }
+        int n = move_data(dev, ep, in, t->buffer, t->length);
+        if (!in && (t->flags & LIBUSB_TRANSFER_ADD_ZERO_PACKET) && n > 0 && n % std::max(ep.cfg.max_packet_size & 0x7ff, 1) == 0 && ep.cfg.sink)
+        {
+            ep.cfg.sink(t->buffer + n, 0);
+        }
+        finish(t, LIBUSB_TRANSFER_COMPLETED, n);
+    }
+    int move_data(detail::device_state &dev, detail::endpoint_state &ep, bool in, unsigned char *data, int length)
+    {
+        if (in)
+        {
+            if (ep.cfg.loopback)
+            {
+                int n = std::min<int>(length, static_cast<int>(ep.fifo.size()));
+                std::copy(ep.fifo.begin(), ep.fifo.begin() + n, data);
+                ep.fifo.erase(ep.fifo.begin(), ep.fifo.begin() + n);
+                return n;
+            }
+            if (ep.cfg.source)
+            {
+                return std::clamp(ep.cfg.source(data, length), 0, length);
+            }
+            return length;
+        }
+        if (ep.cfg.sink)
+        {
+            ep.cfg.sink(data, length);
+        }
+        auto *in_ep = dev.endpoints[detail::endpoint_index(static_cast<unsigned char>(ep.cfg.address | LIBUSB_ENDPOINT_IN))].get();
+        if (in_ep != nullptr && ep.stream != 0)
+        {
+            //a stream loops back to the stream with the same id
+            in_ep = ep.stream <= in_ep->streams.size() ? in_ep->streams[ep.stream - 1].get() : nullptr;
+        }
+        if (in_ep != nullptr && in_ep->cfg.loopback)
+        {
+            in_ep->fifo.insert(in_ep->fifo.end(), data, data + length);
+        }
+        return length;
+    }
+
+    //computes when the first transfer of an endpoint completes,
+    //returns false if it can not complete before more loopback data arrives
+    bool schedule(detail::device_state &dev, detail::endpoint_state &ep, libusb_transfer *t, clock::time_point now) noexcept
+    {
+        auto *st = detail::state_of(t);
+        if (st->scheduled)
+        {
+            return true;
+        }
+        auto deadline = deadline_of(t, st->submitted_at);
+        if (!dev.attached)
+        {
+            st->due = now;
+        }
+        else if (ep.cfg.loopback && ep.fifo.empty())
+        {
+            if (deadline > now)
+            {
+                return false;
+            }
+            st->due = now;
+        }
+        else if (ep.cfg.replay && (t->endpoint & LIBUSB_ENDPOINT_IN) != 0)
+        {
+            auto &script = *ep.cfg.replay;
+            if (ep.replayed == script.completions.size())
+            {
+                //played to the end, nothing arrives any more
+                if (deadline > now)
+                {
+                    return false;
+                }
+                st->due = now;
+            }
+            else if (script.timing == replay_timing::original)
+            {
+                if (dev.replay_start == clock::time_point{})
+                {
+                    dev.replay_start = st->submitted_at;
+                }
+                auto at = std::chrono::duration_cast<clock::duration>(script.completions[ep.replayed].at / script.speed);
+                st->due = std::max(st->submitted_at, dev.replay_start + at);
+            }
+            else
+            {
+                auto &busy_until = ep.parent != nullptr ? ep.parent->busy_until : ep.busy_until;
+                st->due = std::max(st->submitted_at, busy_until) + transfer_time(ep, script.completions[ep.replayed].length);
+                busy_until = st->due;
+            }
+        }
+        else if (t->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            //one packet per service interval, a late transfer starts at the
+            //next interval and the intervals in between are lost
+            auto period = service_interval(dev, ep);
+            auto start = ep.busy_until;
+            if (st->submitted_at > ep.busy_until)
+            {
+                start = next_interval(st->submitted_at, period);
+                if (ep.busy_until != clock::time_point{})
+                {
+                    ep.missed_frames += static_cast<std::uint64_t>((start - ep.busy_until) / period);
+                }
+            }
+            ep.busy_until = start + period * t->num_iso_packets;
+            st->due = ep.busy_until + ep.cfg.latency;
+        }
+        else if (t->type == LIBUSB_TRANSFER_TYPE_CONTROL)
+        {
+            //the round trips of queued requests overlap, the device still answers them
+            //in order and their setup packets and data stages share the bus
+            auto setup = libusb_control_transfer_get_setup(t);
+            std::size_t bytes = LIBUSB_CONTROL_SETUP_SIZE + libusb_le16_to_cpu(setup->wLength);
+            st->due = std::max(st->submitted_at + std::chrono::duration_cast<clock::duration>(ep.cfg.latency), ep.busy_until) + bus_time(ep, bytes);
+            ep.busy_until = st->due;
+        }
+        else if (t->type == LIBUSB_TRANSFER_TYPE_INTERRUPT && ep.cfg.type == LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT)
+        {
+            //the host polls the endpoint once per interval
+            auto period = service_interval(dev, ep);
+            ep.busy_until = next_interval(std::max(st->submitted_at, ep.busy_until), period) + period;
+            st->due = ep.busy_until + ep.cfg.latency;
+        }
+        else
+        {
+            std::size_t bytes = ep.cfg.loopback ? std::min<std::size_t>(t->length, ep.fifo.size()) : static_cast<std::size_t>(t->length);
+            auto &busy_until = ep.parent != nullptr ? ep.parent->busy_until : ep.busy_until;
+            st->due = std::max(st->submitted_at, busy_until) + transfer_time(ep, bytes);
+            busy_until = st->due;
+        }
+        st->scheduled = true;
+        return true;
+    }
+
+    //takes every transfer of one queue which is due, next is lowered to
+    //the point in time when its next transfer will be due
+    void collect(detail::device_state &dev, detail::endpoint_state &ep, clock::time_point now, std::vector<libusb_transfer *> &ready, clock::time_point &next)
+    {
+        auto &q = ep.queue;
+        for (auto it = q.begin(); it != q.end();)
+        {
+            if (detail::state_of(*it)->cancelled)
+            {
+                finish(*it, LIBUSB_TRANSFER_CANCELLED, 0);
+                ready.push_back(*it);
+                it = q.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        while (!q.empty())
+        {
+            libusb_transfer *t = q.front();
+            auto *st = detail::state_of(t);
+            auto deadline = deadline_of(t, st->submitted_at);
+            if (!schedule(dev, ep, t, now))
+            {
+                next = std::min(next, deadline);
+                break;
+            }
+            if (st->due > now && deadline > now)
+            {
+                next = std::min({next, st->due, deadline});
+                break;
+            }
+            q.pop_front();
+            if (st->due > deadline)
+            {
+                //the transfer would not have finished in time
+                ep.busy_until = deadline;
+                finish(t, LIBUSB_TRANSFER_TIMED_OUT, 0);
+            }
+            else if (ep.cfg.loopback && ep.fifo.empty() && dev.attached)
+            {
+                finish(t, LIBUSB_TRANSFER_TIMED_OUT, 0);
+            }
+            else if (ep.cfg.replay && (t->endpoint & LIBUSB_ENDPOINT_IN) != 0 && ep.replayed == ep.cfg.replay->completions.size() && dev.attached)
+            {
+                finish(t, LIBUSB_TRANSFER_TIMED_OUT, 0);
+            }
+            else
+            {
+                execute(dev, ep, t);
+            }
+            ready.push_back(t);
+        }
+    }
+    //takes every transfer which is due out of the queues and
+    //returns the point in time when the next one will be due
+    clock::time_point collect(clock::time_point now, std::vector<libusb_transfer *> &ready)
+    {
+        auto next = clock::time_point::max();
+        for (auto &dev : devices)
+        {
+            for (auto &ep : dev->endpoints)
+            {
+                if (!ep)
+                {
+                    continue;
+                }
+                collect(*dev, *ep, now, ready, next);
+                //every stream is served on its own, one waiting for data does not hold up the others
+                for (auto &stream : ep->streams)
+                {
+                    collect(*dev, *stream, now, ready, next);
+                }
+            }
+        }
+        return next;
+    }
+
+    int sync_transfer(libusb_device_handle *dev_handle, unsigned char type, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout)
+    {
+        libusb_transfer *t = alloc_transfer(0);
+        if (t == nullptr)
+        {
+            return LIBUSB_ERROR_NO_MEM;
+        }
+        int done = 0;
+        libusb_fill_bulk_transfer(t, dev_handle, endpoint, data, length, [](libusb_transfer *tp) { *static_cast<int *>(tp->user_data) = 1; }, &done, timeout);
+        t->type = type;
+        if (int r = submit_transfer(t); r != 0)
+        {
+            free_transfer(t);
+            return r;
+        }
+        while (done == 0)
+        {
+            timeval tv{1, 0};
+            handle_events_timeout_completed(nullptr, &tv, &done);
+        }
+        int r = 0;
+        switch (t->status)
+        {
+        case LIBUSB_TRANSFER_COMPLETED:
+            r = 0;
+            break;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            r = LIBUSB_ERROR_TIMEOUT;
+            break;
+        case LIBUSB_TRANSFER_STALL:
+            r = LIBUSB_ERROR_PIPE;
+            break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            r = LIBUSB_ERROR_NO_DEVICE;
+            break;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            r = LIBUSB_ERROR_OVERFLOW;
+            break;
+        default:
+            r = LIBUSB_ERROR_IO;
+            break;
+        }
+        if (actual_length != nullptr)
+        {
+            *actual_length = t->actual_length;
+        }
+        free_transfer(t);
+        return r;
+    }
+
+public:
+    backend() : event_fd{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {}
+    backend(const backend &) = delete;
+    backend &operator=(const backend &) = delete;
+    ~backend()
+    {
+        for (auto &sys : sys_devices)
+        {
+            ::close(sys.first);
+        }
+        if (event_fd >= 0)
+        {
+            ::close(event_fd);
+        }
+    }
+
+    //plugs a device into the bus, returns an id for remove_device
+    //hotplug callbacks hear of it the next time their context handles events
+    std::size_t add_device(device_config cfg)
+    {
+        std::size_t id;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            devices.push_back(std::make_unique<detail::device_state>(this, std::move(cfg)));
+            notify_hotplug(*devices.back(), LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+            id = devices.size() - 1;
+        }
+        signal();
+        cv.notify_all();
+        return id;
+    }
+    //unplugs a device, its transfers fail with LIBUSB_TRANSFER_NO_DEVICE from now on
+    void remove_device(std::size_t id)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto &dev = *devices.at(id);
+            if (dev.attached)
+            {
+                dev.attached = false;
+                notify_hotplug(dev, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT);
+            }
+        }
+        signal();
+        cv.notify_all();
+    }
+    //a file descriptor which stands for the device like an opened usbfs node
+    //would, for wrap_sys_device. it stays valid until close_sys_device
+    int open_sys_device(std::size_t id)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *dev = devices.at(id).get();
+        int fd = ::eventfd(0, EFD_CLOEXEC);
+        if (fd >= 0)
+        {
+            sys_devices.emplace_back(fd, dev);
+        }
+        return fd;
+    }
+    void close_sys_device(int fd)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        for (auto it = sys_devices.begin(); it != sys_devices.end(); ++it)
+        {
+            if (it->first == fd)
+            {
+                ::close(fd);
+                sys_devices.erase(it);
+                return;
+            }
+        }
+    }
+    //number of device handles which are not closed yet
+    std::size_t open_handles() const
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return handles;
+    }
+    //number of isochronous service intervals an endpoint had no transfer queued for
+    std::uint64_t missed_iso_frames(std::size_t id, unsigned char address) const
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto &ep = devices.at(id)->endpoints[detail::endpoint_index(address)];
+        return ep ? ep->missed_frames : 0;
+    }
+    //number of completions of the replay script of an endpoint which were played,
+    //it is played to its end once this equals the size of the script
+    std::size_t replayed(std::size_t id, unsigned char address) const
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto &ep = devices.at(id)->endpoints[detail::endpoint_index(address)];
+        return ep ? ep->replayed : 0;
+    }
+    //starts the replay of a device over, the next transfer is the new start
+    void restart_replay(std::size_t id)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto &dev = *devices.at(id);
+        dev.replay_start = clock::time_point{};
+        for (auto &ep : dev.endpoints)
+        {
+            if (ep)
+            {
+                ep->replayed = 0;
+            }
+        }
+    }
+    //number of transfers which are not freed yet
+    std::size_t allocated_transfers() const
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return transfers;
+    }
+
+    int init(libusb_context **ctx) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        *ctx = reinterpret_cast<libusb_context *>(new detail::context_state{this, false, default_discovery});
+        return 0;
+    }
+    int init_without_device_discovery(libusb_context **ctx) override
+    {
+        *ctx = reinterpret_cast<libusb_context *>(new detail::context_state{this, false, false});
+        return 0;
+    }
+    void exit(libusb_context *ctx) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            for (std::size_t i = hotplug.size(); i-- > 0;)
+            {
+                if (hotplug[i]->ctx == ctx)
+                {
+                    erase_hotplug(ctx, hotplug[i]->handle);
+                }
+            }
+        }
+        delete reinterpret_cast<detail::context_state *>(ctx);
+    }
+    void set_debug(libusb_context *, int) override
+    {
+    }
+    int set_option(libusb_context *ctx, libusb_option option) override
+    {
+        if (option != LIBUSB_OPTION_NO_DEVICE_DISCOVERY)
+        {
+            return LIBUSB_ERROR_NOT_SUPPORTED;
+        }
+        std::lock_guard<std::mutex> lock{mtx};
+        if (ctx == nullptr)
+        {
+            default_discovery = false;
+        }
+        else
+        {
+            reinterpret_cast<detail::context_state *>(ctx)->discovery = false;
+        }
+        return 0;
+    }
+    //a context without device discovery only knows the devices it wrapped, which are not listed
+    ssize_t get_device_list(libusb_context *ctx, libusb_device ***list) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        std::vector<libusb_device *> out;
+        for (auto &dev : devices)
+        {
+            if (dev->attached && discovers(ctx))
+            {
+                ++dev->refs;
+                out.push_back(reinterpret_cast<libusb_device *>(dev.get()));
+            }
+        }
+        *list = new libusb_device *[out.size() + 1];
+        std::copy(out.begin(), out.end(), *list);
+        (*list)[out.size()] = nullptr;
+        return static_cast<ssize_t>(out.size());
+    }
+    void free_device_list(libusb_device **list, int unref_devices) override
+    {
+        for (auto p = list; unref_devices && *p != nullptr; ++p)
+        {
+            unref_device(*p);
+        }
+        delete[] list;
+    }
+    int has_capability(std::uint32_t capability) override
+    {
+        return capability == LIBUSB_CAP_HAS_CAPABILITY || capability == LIBUSB_CAP_HAS_HOTPLUG;
+    }
+    //with LIBUSB_HOTPLUG_ENUMERATE the callback is called for the attached devices before this returns
+    int hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle) override
+    {
+        if (cb_fn == nullptr || (events & (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT)) == 0)
+        {
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+        std::unique_lock<std::mutex> lock{mtx};
+        auto h = std::make_unique<detail::hotplug_state>(detail::hotplug_state{ctx, next_hotplug_handle++, events, vendor_id, product_id, dev_class, cb_fn, user_data});
+        libusb_hotplug_callback_handle handle = h->handle;
+        std::vector<detail::device_state *> attached;
+        for (auto &dev : devices)
+        {
+            if ((flags & LIBUSB_HOTPLUG_ENUMERATE) && dev->attached && discovers(ctx) && h->matches(*dev, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED))
+            {
+                ++dev->refs;
+                attached.push_back(dev.get());
+            }
+        }
+        hotplug.push_back(std::move(h));
+        lock.unlock();
+        if (callback_handle != nullptr)
+        {
+            *callback_handle = handle;
+        }
+        bool finished = false;
+        for (auto *dev : attached)
+        {
+            if (!finished)
+            {
+                finished = cb_fn(ctx, reinterpret_cast<libusb_device *>(dev), LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data) != 0;
+            }
+            --dev->refs;
+        }
+        if (finished)
+        {
+            hotplug_deregister_callback(ctx, handle);
+        }
+        return 0;
+    }
+    void hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        erase_hotplug(ctx, callback_handle);
+    }
+
+    libusb_device *ref_device(libusb_device *dev) override
+    {
+        ++detail::cast(dev)->refs;
+        return dev;
+    }
+    void unref_device(libusb_device *dev) override
+    {
+        --detail::cast(dev)->refs;
+    }
+    int get_device_descriptor(libusb_device *dev, libusb_device_descriptor *desc) override
+    {
+        *desc = detail::cast(dev)->desc;
+        return 0;
+    }
+    std::uint8_t get_bus_number(libusb_device *dev) override
+    {
+        return detail::cast(dev)->cfg.bus_number;
+    }
+    std::uint8_t get_device_address(libusb_device *dev) override
+    {
+        return detail::cast(dev)->cfg.device_address;
+    }
+    int get_port_numbers(libusb_device *dev, std::uint8_t *port_numbers, int port_numbers_len) override
+    {
+        auto &ports = detail::cast(dev)->cfg.port_numbers;
+        if (port_numbers_len < static_cast<int>(ports.size()))
+        {
+            return LIBUSB_ERROR_OVERFLOW;
+        }
+        std::copy(ports.begin(), ports.end(), port_numbers);
+        return static_cast<int>(ports.size());
+    }
+    int get_max_packet_size(libusb_device *dev, unsigned char endpoint) override
+    {
+        auto &ep = detail::cast(dev)->endpoints[detail::endpoint_index(endpoint)];
+        if (!ep || (endpoint & LIBUSB_ENDPOINT_ADDRESS_MASK) == 0)
+        {
+            return LIBUSB_ERROR_NOT_FOUND;
+        }
+        return ep->cfg.max_packet_size;
+    }
+    int get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint) override
+    {
+        auto *d = detail::cast(dev);
+        auto &ep = d->endpoints[detail::endpoint_index(endpoint)];
+        if (!ep || (endpoint & LIBUSB_ENDPOINT_ADDRESS_MASK) == 0)
+        {
+            return LIBUSB_ERROR_NOT_FOUND;
+        }
+        int size = ep->cfg.max_packet_size & 0x7ff;
+        bool periodic = ep->cfg.type == LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS || ep->cfg.type == LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT;
+        if (periodic && d->cfg.speed >= LIBUSB_SPEED_HIGH)
+        {
+            size *= 1 + ((ep->cfg.max_packet_size >> 11) & 3); //additional transactions per microframe
+        }
+        return size;
+    }
+    int get_active_config_descriptor(libusb_device *dev, libusb_config_descriptor **config) override
+    {
+        //the descriptor lives as long as the bus
+        *config = &detail::cast(dev)->config;
+        return 0;
+    }
+    void free_config_descriptor(libusb_config_descriptor *) override
+    {
+    }
+    int open(libusb_device *dev, libusb_device_handle **dev_handle) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        if (!detail::cast(dev)->attached)
+        {
+            return LIBUSB_ERROR_NO_DEVICE;
+        }
+        ++detail::cast(dev)->refs;
+        ++handles;
+        *dev_handle = reinterpret_cast<libusb_device_handle *>(new detail::handle_state{detail::cast(dev)});
+        return 0;
+    }
+    //sys_dev has to be a file descriptor of open_sys_device
+    int wrap_sys_device(libusb_context *, std::intptr_t sys_dev, libusb_device_handle **dev_handle) override
+    {
+        detail::device_state *dev = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            for (auto &sys : sys_devices)
+            {
+                if (sys.first == sys_dev)
+                {
+                    dev = sys.second;
+                }
+            }
+        }
+        if (dev == nullptr)
+        {
+            return LIBUSB_ERROR_NOT_FOUND;
+        }
+        return open(reinterpret_cast<libusb_device *>(dev), dev_handle);
+    }
+
+    void close(libusb_device_handle *dev_handle) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *h = detail::cast(dev_handle);
+        h->dev->claimed &= ~h->claimed;
+        --h->dev->refs;
+        --handles;
+        delete h;
+    }
+    libusb_device *get_device(libusb_device_handle *dev_handle) override
+    {
+        return reinterpret_cast<libusb_device *>(detail::cast(dev_handle)->dev);
+    }
+    int claim_interface(libusb_device_handle *dev_handle, int interface_number) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *h = detail::cast(dev_handle);
+        if (!h->dev->attached)
+        {
+            return LIBUSB_ERROR_NO_DEVICE;
+        }
+        if (interface_number < 0 || interface_number >= 32 || !h->dev->has_interface(interface_number))
+        {
+            return LIBUSB_ERROR_NOT_FOUND;
+        }
+        std::uint32_t bit = 1u << interface_number;
+        if ((h->dev->claimed & bit) && !(h->claimed & bit))
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        h->dev->claimed |= bit;
+        h->claimed |= bit;
+        return 0;
+    }
+    int release_interface(libusb_device_handle *dev_handle, int interface_number) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *h = detail::cast(dev_handle);
+        std::uint32_t bit = interface_number >= 0 && interface_number < 32 ? 1u << interface_number : 0;
+        if (!(h->claimed & bit))
+        {
+            return LIBUSB_ERROR_NOT_FOUND;
+        }
+        h->dev->claimed &= ~bit;
+        h->claimed &= ~bit;
+        return 0;
+    }
+    //every endpoint gets the same number of streams, the least max_streams of them
+    int alloc_streams(libusb_device_handle *dev_handle, std::uint32_t num_streams, unsigned char *endpoints, int num_endpoints) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *dev = detail::cast(dev_handle)->dev;
+        if (!dev->attached)
+        {
+            return LIBUSB_ERROR_NO_DEVICE;
+        }
+        if (num_streams == 0 || num_endpoints <= 0)
+        {
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+        std::uint32_t granted = num_streams;
+        for (int i = 0; i < num_endpoints; ++i)
+        {
+            auto *ep = (endpoints[i] & LIBUSB_ENDPOINT_ADDRESS_MASK) != 0 ? dev->endpoints[detail::endpoint_index(endpoints[i])].get() : nullptr;
+            if (ep == nullptr || ep->cfg.type != LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK || ep->cfg.max_streams == 0 || !ep->streams.empty())
+            {
+                return LIBUSB_ERROR_INVALID_PARAM;
+            }
+            granted = std::min(granted, ep->cfg.max_streams);
+        }
+        for (int i = 0; i < num_endpoints; ++i)
+        {
+            auto &ep = dev->endpoints[detail::endpoint_index(endpoints[i])];
+            for (std::uint32_t id = 1; id <= granted; ++id)
+            {
+                ep->streams.push_back(std::make_unique<detail::endpoint_state>(ep.get(), id));
+            }
+        }
+        return static_cast<int>(granted);
+    }
+    int free_streams(libusb_device_handle *dev_handle, unsigned char *endpoints, int num_endpoints) override
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto *dev = detail::cast(dev_handle)->dev;
+        for (int i = 0; i < num_endpoints; ++i)
+        {
+            auto *ep = dev->endpoints[detail::endpoint_index(endpoints[i])].get();
+            if (ep == nullptr || ep->streams.empty())
+            {
+                return LIBUSB_ERROR_INVALID_PARAM;
+            }
+            for (auto &stream : ep->streams)
+            {
+                if (!stream->queue.empty())
+                {
+                    return LIBUSB_ERROR_BUSY;
+                }
+            }
+        }
+        for (int i = 0; i < num_endpoints; ++i)
+        {
+            dev->endpoints[detail::endpoint_index(endpoints[i])]->streams.clear();
+        }
+        return 0;
+    }
+    int bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) override
+    {
+        return sync_transfer(dev_handle, LIBUSB_TRANSFER_TYPE_BULK, endpoint, data, length, actual_length, timeout);
+    }
+    int interrupt_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout) override
+    {
+        return sync_transfer(dev_handle, LIBUSB_TRANSFER_TYPE_INTERRUPT, endpoint, data, length, actual_length, timeout);
+    }
+    int control_transfer(libusb_device_handle *dev_handle, std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index, unsigned char *data, std::uint16_t length, unsigned int timeout) override
+    {
+        std::vector<unsigned char> buffer(LIBUSB_CONTROL_SETUP_SIZE + length);
+        libusb_fill_control_setup(buffer.data(), request_type, request, value, index, length);
+        if (!(request_type & LIBUSB_ENDPOINT_IN) && length != 0)
+        {
+            std::memcpy(buffer.data() + LIBUSB_CONTROL_SETUP_SIZE, data, length);
+        }
+        int actual_length = 0;
+        if (int r = sync_transfer(dev_handle, LIBUSB_TRANSFER_TYPE_CONTROL, 0, buffer.data(), static_cast<int>(buffer.size()), &actual_length, timeout); r != 0)
+        {
+            return r;
+        }
+        if ((request_type & LIBUSB_ENDPOINT_IN) && actual_length != 0)
+        {
+            std::memcpy(data, buffer.data() + LIBUSB_CONTROL_SETUP_SIZE, actual_length);
+        }
+        return actual_length;
+    }
+    //simulated devices have no device memory, which exercises the fallbacks
+    unsigned char *dev_mem_alloc(libusb_device_handle *, std::size_t) override
+    {
+        return nullptr;
+    }
+    int dev_mem_free(libusb_device_handle *, unsigned char *, std::size_t) override
+    {
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+
+    libusb_transfer *alloc_transfer(int iso_packets) override
+    {
+        std::size_t size = detail::transfer_state_size + sizeof(libusb_transfer) + iso_packets * sizeof(libusb_iso_packet_descriptor);
+        auto *mem = static_cast<unsigned char *>(::operator new(size, std::nothrow));
+        if (mem == nullptr)
+        {
+            return nullptr;
+        }
+        std::memset(mem, 0, size);
+        new (mem) detail::transfer_state{};
+        auto *t = reinterpret_cast<libusb_transfer *>(mem + detail::transfer_state_size);
+        t->num_iso_packets = iso_packets;
+        std::lock_guard<std::mutex> lock{mtx};
+        ++transfers;
+        return t;
+    }
+    void free_transfer(libusb_transfer *t) override
+    {
+        if (t == nullptr)
+        {
+            return;
+        }
+        auto *st = detail::state_of(t);
+        st->~transfer_state();
+        ::operator delete(static_cast<void *>(st));
+        std::lock_guard<std::mutex> lock{mtx};
+        --transfers;
+    }
+    int submit_transfer(libusb_transfer *t) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto *st = detail::state_of(t);
+            if (st->submitted)
+            {
+                return LIBUSB_ERROR_BUSY;
+            }
+            if (!detail::cast(t->dev_handle)->dev->attached)
+            {
+                return LIBUSB_ERROR_NO_DEVICE;
+            }
+            auto *ep = endpoint_of(t);
+            if (ep == nullptr)
+            {
+                return LIBUSB_ERROR_NOT_FOUND;
+            }
+            std::uint32_t stream_id = st->stream_id; //set before the submission
+            *st = detail::transfer_state{};
+            st->stream_id = stream_id;
+            st->submitted = true;
+            st->submitted_at = clock::now();
+            ep->queue.push_back(t);
+        }
+        signal();
+        cv.notify_all();
+        return 0;
+    }
+    int cancel_transfer(libusb_transfer *t) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            auto *st = detail::state_of(t);
+            if (!st->submitted || st->cancelled)
+            {
+                return LIBUSB_ERROR_NOT_FOUND;
+            }
+            st->cancelled = true;
+        }
+        signal();
+        cv.notify_all();
+        return 0;
+    }
+    void transfer_set_stream_id(libusb_transfer *t, std::uint32_t stream_id) override
+    {
+        detail::state_of(t)->stream_id = stream_id;
+    }
+    std::uint32_t transfer_get_stream_id(libusb_transfer *t) override
+    {
+        return detail::state_of(t)->stream_id;
+    }
+
+    int handle_events(libusb_context *ctx) override
+    {
+        timeval tv{60, 0};
+        return handle_events_timeout_completed(ctx, &tv, nullptr);
+    }
+    int handle_events_timeout_completed(libusb_context *ctx, timeval *tv, int *completed) override
+    {
+        auto *cs = reinterpret_cast<detail::context_state *>(ctx);
+        auto deadline = clock::now();
+        if (tv != nullptr)
+        {
+            deadline += std::chrono::seconds(tv->tv_sec) + std::chrono::microseconds(tv->tv_usec);
+        }
+        std::vector<libusb_transfer *> ready;
+        bool hotplug_delivered = false;
+        std::unique_lock<std::mutex> lock{mtx};
+        drain();
+        for (;;)
+        {
+            if (completed != nullptr && *completed)
+            {
+                return 0;
+            }
+            if (cs != nullptr && cs->interrupted)
+            {
+                cs->interrupted = false;
+                return LIBUSB_ERROR_INTERRUPTED;
+            }
+            if (ctx != nullptr && deliver_hotplug(ctx, lock))
+            {
+                hotplug_delivered = true;
+                continue; //completions which are already due are handled in the same call
+            }
+            auto now = clock::now();
+            ready.swap(collected);
+            auto next = collect(now, ready);
+            if (!ready.empty())
+            {
+                for (auto t : ready)
+                {
+                    detail::state_of(t)->submitted = false;
+                }
+                lock.unlock();
+                for (auto t : ready)
+                {
+                    t->callback(t);
+                }
+                //threads waiting for a completion flag set by one of the callbacks
+                lock.lock();
+                lock.unlock();
+                cv.notify_all();
+                return 0;
+            }
+            if (hotplug_delivered || now >= deadline)
+            {
+                return 0;
+            }
+            cv.wait_until(lock, std::min(deadline, next));
+        }
+    }
+    void interrupt_event_handler(libusb_context *ctx) override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            reinterpret_cast<detail::context_state *>(ctx)->interrupted = true;
+        }
+        signal();
+        cv.notify_all();
+    }
+
+    //the bus has a single eventfd which never changes, so the notifiers are never called
+    const libusb_pollfd **get_pollfds(libusb_context *) override
+    {
+        auto **list = new const libusb_pollfd *[2];
+        list[0] = new libusb_pollfd{event_fd, POLLIN};
+        list[1] = nullptr;
+        return list;
+    }
+    void free_pollfds(const libusb_pollfd **pollfds) override
+    {
+        for (auto p = pollfds; p != nullptr && *p != nullptr; ++p)
+        {
+            delete *p;
+        }
+        delete[] pollfds;
+    }
+    void set_pollfd_notifiers(libusb_context *, libusb_pollfd_added_cb, libusb_pollfd_removed_cb, void *) override
+    {
+    }
+    //due transfers are kept for the next handle_events, which is then expected right away
+    int get_next_timeout(libusb_context *, timeval *tv) override
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        auto now = clock::now();
+        auto next = collect(now, collected);
+        if (!collected.empty())
+        {
+            next = now;
+        }
+        lock.unlock();
+        if (next == clock::time_point::max())
+        {
+            return 0;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::max(next, now) - now).count();
+        tv->tv_sec = static_cast<decltype(tv->tv_sec)>(us / 1000000);
+        tv->tv_usec = static_cast<decltype(tv->tv_usec)>(us % 1000000);
+        cv.notify_all();
+        return 1;
+    }
+    //timeouts are not signalled through the eventfd
+    int pollfds_handle_timeouts(libusb_context *) override
+    {
+        return 0;
+    }
+};
+} // namespace sim
+} // namespace libusbcpp
+} // namespace osf
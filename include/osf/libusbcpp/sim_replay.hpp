@@ -0,0 +1,323 @@
+#pragma once
+#include "libusb.h"
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "error.hpp"
+#include "sum_type.hpp"
+#include "sim_backend.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace sim
+{
+//one recorded endpoint of a device
+struct replay_endpoint
+{
+    unsigned char address = 0;
+    libusb_endpoint_transfer_type type = LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK;
+    std::uint32_t max_length = 0; //the longest transfer which was seen
+    std::vector<replay_completion> completions{}; //IN endpoints only
+};
+//one recorded control request and the answer of the device
+struct replay_control
+{
+    std::array<unsigned char, LIBUSB_CONTROL_SETUP_SIZE> setup{};
+    libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED;
+    std::uint32_t length = 0;
+    std::vector<unsigned char> data{}; //captured data of IN requests
+};
+//everything which was recorded of one device
+struct replay_device_trace
+{
+    std::uint16_t bus_number = 0;
+    std::uint8_t device_address = 0;
+    std::vector<replay_endpoint> endpoints{};
+    std::vector<replay_control> controls{};
+};
+struct replay_trace
+{
+    std::vector<replay_device_trace> devices{};
+
+    //nullptr if the trace holds nothing of that device
+    const replay_device_trace *find(std::uint16_t bus_number, std::uint8_t device_address) const noexcept
+    {
+        for (auto &d : devices)
+        {
+            if (d.bus_number == bus_number && d.device_address == device_address)
+            {
+                return &d;
+            }
+        }
+        return nullptr;
+    }
+};
+
+namespace detail
+{
+//the libusb status of a completion with the given usbmon status
+inline libusb_transfer_status replay_status(std::int32_t status) noexcept
+{
+    switch (-status)
+    {
+    case 0:
+        return LIBUSB_TRANSFER_COMPLETED;
+    case ETIMEDOUT:
+        return LIBUSB_TRANSFER_TIMED_OUT;
+    case ENOENT:
+    case ECONNRESET:
+        return LIBUSB_TRANSFER_CANCELLED;
+    case EPIPE:
+        return LIBUSB_TRANSFER_STALL;
+    case ENODEV:
+    case ESHUTDOWN:
+        return LIBUSB_TRANSFER_NO_DEVICE;
+    case EOVERFLOW:
+        return LIBUSB_TRANSFER_OVERFLOW;
+    default:
+        return LIBUSB_TRANSFER_ERROR;
+    }
+}
+template <typename T>
+inline T replay_read(const unsigned char *p) noexcept
+{
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+} // namespace detail
+
+//reads a pcap file of usbmon records, as trace_recorder, tcpdump or wireshark
+//write them (LINKTYPE_USB_LINUX_MMAPPED or LINKTYPE_USB_LINUX) in the byte order of this machine.
+//transfers which were cancelled or timed out without data are left out,
+//they are an artifact of the recording application and not of the device.
+//fails with LIBUSB_ERROR_IO if the file can not be read and
+//LIBUSB_ERROR_NOT_SUPPORTED if it is no such pcap file
+inline sum_type<replay_trace, error> load_trace(const char *path)
+{
+    std::vector<unsigned char> file;
+    if (std::FILE *f = std::fopen(path, "rb"))
+    {
+        unsigned char chunk[1 << 16];
+        for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), f)) != 0;)
+        {
+            file.insert(file.end(), chunk, chunk + n);
+        }
+        std::fclose(f);
+    }
+    else
+    {
+        return error(LIBUSB_ERROR_IO);
+    }
+    if (file.size() < 24)
+    {
+        return error(LIBUSB_ERROR_NOT_SUPPORTED);
+    }
+    auto magic = detail::replay_read<std::uint32_t>(file.data());
+    auto linktype = detail::replay_read<std::uint32_t>(file.data() + 20);
+    if ((magic != 0xa1b2c3d4 && magic != 0xa1b23c4d) || (linktype != 220 && linktype != 189))
+    {
+        return error(LIBUSB_ERROR_NOT_SUPPORTED);
+    }
+    const std::int64_t fraction = magic == 0xa1b2c3d4 ? 1000 : 1; //to nanoseconds
+    const std::size_t header_size = linktype == 220 ? 64 : 48;
+
+    replay_trace trace;
+    std::vector<std::int64_t> first_seen; //of every device, in nanoseconds
+    //submitted control requests by urb id
+    std::map<std::uint64_t, std::array<unsigned char, LIBUSB_CONTROL_SETUP_SIZE>> setups;
+    for (std::size_t off = 24; off + 16 <= file.size();)
+    {
+        const unsigned char *rec = file.data() + off;
+        auto incl = detail::replay_read<std::uint32_t>(rec + 8);
+        off += 16 + incl;
+        if (off > file.size() || incl < header_size)
+        {
+            break;
+        }
+        const unsigned char *u = rec + 16;
+        auto id = detail::replay_read<std::uint64_t>(u);
+        char type = static_cast<char>(u[8]);
+        std::uint8_t xfer_type = u[9];
+        unsigned char endpoint = u[10];
+        std::uint8_t devnum = u[11];
+        auto busnum = detail::replay_read<std::uint16_t>(u + 12);
+        auto status = detail::replay_read<std::int32_t>(u + 28);
+        auto length = detail::replay_read<std::uint32_t>(u + 32);
+        auto captured = std::min<std::uint32_t>(detail::replay_read<std::uint32_t>(u + 36), incl - static_cast<std::uint32_t>(header_size));
+        const unsigned char *data = u + header_size;
+        std::int64_t ns = static_cast<std::int64_t>(detail::replay_read<std::uint32_t>(rec)) * 1000000000 + detail::replay_read<std::uint32_t>(rec + 4) * fraction;
+
+        auto dev = std::find_if(trace.devices.begin(), trace.devices.end(), [&](const replay_device_trace &d) {
+            return d.bus_number == busnum && d.device_address == devnum;
+        });
+        if (dev == trace.devices.end())
+        {
+            trace.devices.push_back(replay_device_trace{busnum, devnum});
+            first_seen.push_back(ns);
+            dev = trace.devices.end() - 1;
+        }
+        auto at = std::chrono::nanoseconds(ns - first_seen[static_cast<std::size_t>(dev - trace.devices.begin())]);
+
+        if (xfer_type == 2) //control
+        {
+            if (type == 'S' && u[14] == 0)
+            {
+                std::copy(u + 40, u + 48, setups[id].begin());
+            }
+            else if (type == 'C' && setups.count(id) != 0)
+            {
+                replay_control c;
+                c.setup = setups[id];
+                c.status = detail::replay_status(status);
+                c.length = length;
+                if (c.setup[0] & LIBUSB_ENDPOINT_IN)
+                {
+                    c.data.assign(data, data + captured);
+                }
+                setups.erase(id);
+                dev->controls.push_back(std::move(c));
+            }
+            continue;
+        }
+        if (xfer_type == 0 || (type != 'S' && type != 'C'))
+        {
+            //isochronous transfers carry no packet layout which could be played back
+            continue;
+        }
+        auto ep = std::find_if(dev->endpoints.begin(), dev->endpoints.end(), [&](const replay_endpoint &e) { return e.address == endpoint; });
+        if (ep == dev->endpoints.end())
+        {
+            dev->endpoints.push_back(replay_endpoint{endpoint, xfer_type == 1 ? LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT : LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK});
+            ep = dev->endpoints.end() - 1;
+        }
+        if (type == 'C' && (endpoint & LIBUSB_ENDPOINT_IN))
+        {
+            auto s = detail::replay_status(status);
+            if ((s == LIBUSB_TRANSFER_CANCELLED || s == LIBUSB_TRANSFER_TIMED_OUT) && length == 0)
+            {
+                continue;
+            }
+            ep->max_length = std::max(ep->max_length, length);
+            ep->completions.push_back(replay_completion{at, s, length, std::vector<unsigned char>(data, data + captured)});
+        }
+        else if (type == 'S')
+        {
+            ep->max_length = std::max(ep->max_length, length);
+        }
+    }
+    return trace;
+}
+
+//a device which plays a recorded device back: every recorded IN endpoint
+//completes its transfers with the recorded data, status and, with original
+//timing, at the recorded time after the first transfer on the device.
+//OUT endpoints take everything, control requests are answered with the
+//recorded answer to the same setup packet (in recorded order, the last one
+//repeats) and stall if there is none.
+//vendor and product id are taken from a recorded device descriptor if the
+//trace holds one with enough data, otherwise they are 0
+//    auto trace = sim::load_trace("capture.pcap");
+//    bus.add_device(sim::replay_device(*trace.find(1, 4), sim::replay_timing::as_fast_as_possible));
+inline device_config replay_device(const replay_device_trace &trace, replay_timing timing = replay_timing::original, double speed = 1.0)
+{
+    device_config cfg{};
+    cfg.bus_number = static_cast<std::uint8_t>(trace.bus_number);
+    cfg.device_address = trace.device_address;
+    for (auto &c : trace.controls)
+    {
+        //GET_DESCRIPTOR(DEVICE)
+        if (c.setup[0] == LIBUSB_ENDPOINT_IN && c.setup[1] == LIBUSB_REQUEST_GET_DESCRIPTOR && c.setup[3] == LIBUSB_DT_DEVICE && c.data.size() >= 12)
+        {
+            cfg.bcd_usb = static_cast<std::uint16_t>(c.data[2] | c.data[3] << 8);
+            cfg.device_class = c.data[4];
+            cfg.device_subclass = c.data[5];
+            cfg.device_protocol = c.data[6];
+            cfg.max_packet_size0 = c.data[7];
+            cfg.vendor_id = static_cast<std::uint16_t>(c.data[8] | c.data[9] << 8);
+            cfg.product_id = static_cast<std::uint16_t>(c.data[10] | c.data[11] << 8);
+            break;
+        }
+    }
+    interface_config intf{};
+    for (auto &e : trace.endpoints)
+    {
+        endpoint_config ep{};
+        ep.address = e.address;
+        ep.type = e.type;
+        if (e.type == LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT)
+        {
+            ep.max_packet_size = static_cast<std::uint16_t>(std::clamp<std::uint32_t>(e.max_length, 8, 1024));
+            ep.interval = 1;
+        }
+        if (e.address & LIBUSB_ENDPOINT_IN)
+        {
+            auto script = std::make_shared<replay_script>();
+            script->completions = e.completions;
+            script->timing = timing;
+            script->speed = speed > 0.0 ? speed : 1.0;
+            ep.replay = std::move(script);
+        }
+        intf.endpoints.push_back(std::move(ep));
+    }
+    cfg.interfaces.push_back(std::move(intf));
+
+    if (!trace.controls.empty())
+    {
+        struct answers
+        {
+            std::vector<replay_control> controls;
+            std::vector<bool> played;
+        };
+        auto state = std::make_shared<answers>(answers{trace.controls, std::vector<bool>(trace.controls.size())});
+        cfg.control = [state](const libusb_control_setup &setup, unsigned char *data) -> int {
+            unsigned char raw[LIBUSB_CONTROL_SETUP_SIZE];
+            std::memcpy(raw, &setup, sizeof(raw));
+            //the first answer to this setup which was not played yet, or the last one
+            const replay_control *answer = nullptr;
+            for (std::size_t i = 0; i < state->controls.size(); ++i)
+            {
+                if (std::memcmp(state->controls[i].setup.data(), raw, sizeof(raw)) == 0)
+                {
+                    answer = &state->controls[i];
+                    if (!state->played[i])
+                    {
+                        state->played[i] = true;
+                        break;
+                    }
+                }
+            }
+            if (answer == nullptr || answer->status == LIBUSB_TRANSFER_STALL)
+            {
+                return LIBUSB_ERROR_PIPE;
+            }
+            if (answer->status != LIBUSB_TRANSFER_COMPLETED)
+            {
+                return LIBUSB_ERROR_IO;
+            }
+            if (raw[0] & LIBUSB_ENDPOINT_IN)
+            {
+                auto n = std::min<std::size_t>(answer->length, setup.wLength);
+                auto captured = std::min(n, answer->data.size());
+                std::copy(answer->data.begin(), answer->data.begin() + static_cast<std::ptrdiff_t>(captured), data);
+                std::fill(data + captured, data + n, 0);
+                return static_cast<int>(n);
+            }
+            return static_cast<int>(answer->length);
+        };
+    }
+    return cfg;
+}
+} // namespace sim
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,373 @@
+#pragma once
+#include "libusb.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace osf
+{
+namespace libusbcpp
+{
+//instrumentation of the transfers of device handles and contexts
+//it is only compiled in if OSF_LIBUSBCPP_ENABLE_STATS is defined, otherwise
+//the transfers carry no extra state and the get_stats functions return zeros
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+namespace detail
+{
+//index of a libusb error code in transfer_stats::submit_errors
+inline std::size_t submit_error_index(int code) noexcept
+{
+    return code < 0 && code >= LIBUSB_ERROR_NOT_SUPPORTED ? static_cast<std::size_t>(-code) : 13;
+}
+} // namespace detail
+
+//log-linear histogram of latencies in nanoseconds
+//every power of two is split into 8 linear buckets, so a bucket is at most
+//12.5% wide and values below 8ns are exact. values from 2^40ns (about 18
+//minutes) on share the last bucket
+struct latency_histogram
+{
+    static constexpr std::size_t sub_buckets = 8;
+    static constexpr unsigned max_exponent = 39;
+    static constexpr std::size_t bucket_count = (max_exponent - 1) * sub_buckets;
+
+    std::array<std::uint64_t, bucket_count> counts{};
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0; //in nanoseconds
+
+    static std::size_t bucket_of(std::uint64_t ns) noexcept
+    {
+        if (ns < sub_buckets)
+        {
+            return static_cast<std::size_t>(ns);
+        }
+        unsigned exponent = 63;
+        while ((ns >> exponent) == 0)
+        {
+            --exponent;
+        }
+        if (exponent > max_exponent)
+        {
+            return bucket_count - 1;
+        }
+        return (exponent - 2) * sub_buckets + ((ns >> (exponent - 3)) & (sub_buckets - 1));
+    }
+    //the smallest value of bucket b
+    static std::uint64_t lower_bound(std::size_t b) noexcept
+    {
+        if (b < sub_buckets)
+        {
+            return b;
+        }
+        unsigned exponent = static_cast<unsigned>(b / sub_buckets) + 2;
+        return (sub_buckets + b % sub_buckets) << (exponent - 3);
+    }
+    //the smallest value of the bucket after b
+    static std::uint64_t upper_bound(std::size_t b) noexcept
+    {
+        if (b < sub_buckets)
+        {
+            return b + 1;
+        }
+        unsigned exponent = static_cast<unsigned>(b / sub_buckets) + 2;
+        return lower_bound(b) + (std::uint64_t{1} << (exponent - 3));
+    }
+
+    //the upper bound of the bucket which holds the given fraction of all values, e.g. 0.99
+    std::chrono::nanoseconds percentile(double fraction) const noexcept
+    {
+        if (count == 0)
+        {
+            return std::chrono::nanoseconds{0};
+        }
+        auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count));
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < bucket_count; ++b)
+        {
+            seen += counts[b];
+            if (seen > rank || seen == count)
+            {
+                return std::chrono::nanoseconds(static_cast<std::int64_t>(upper_bound(b)));
+            }
+        }
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(upper_bound(bucket_count - 1)));
+    }
+    std::chrono::nanoseconds mean() const noexcept
+    {
+        return std::chrono::nanoseconds(count == 0 ? 0 : static_cast<std::int64_t>(sum / count));
+    }
+    latency_histogram &operator+=(const latency_histogram &other) noexcept
+    {
+        for (std::size_t b = 0; b < bucket_count; ++b)
+        {
+            counts[b] += other.counts[b];
+        }
+        count += other.count;
+        sum += other.sum;
+        return *this;
+    }
+};
+
+//what happened to the transfers of one endpoint or of one context
+//in_flight and submitted are only known per endpoint, the counters of a
+//context sum up the completions its event handling delivered
+struct transfer_stats
+{
+    std::uint64_t submitted = 0;
+    std::uint64_t completed = 0; //completions with any status
+    std::uint64_t bytes = 0;
+    //completions by libusb_transfer_status, e.g. by_status[LIBUSB_TRANSFER_TIMED_OUT]
+    std::array<std::uint64_t, LIBUSB_TRANSFER_OVERFLOW + 1> by_status{};
+    //failed submissions by libusb error code, see get_submit_errors
+    std::array<std::uint64_t, 14> submit_errors{};
+    //transfers which are submitted and not completed yet, and the most there ever were
+    std::int64_t in_flight = 0;
+    std::int64_t max_in_flight = 0;
+    //time from submission to completion
+    latency_histogram latency{};
+
+    std::uint64_t get_timeouts() const noexcept
+    {
+        return by_status[LIBUSB_TRANSFER_TIMED_OUT];
+    }
+    //completions with a status other than completed, timed out or cancelled
+    std::uint64_t get_errors() const noexcept
+    {
+        return completed - by_status[LIBUSB_TRANSFER_COMPLETED] - by_status[LIBUSB_TRANSFER_TIMED_OUT] - by_status[LIBUSB_TRANSFER_CANCELLED];
+    }
+    std::uint64_t get_submit_errors(int code) const noexcept
+    {
+        return submit_errors[detail::submit_error_index(code)];
+    }
+};
+
+//the counters of one endpoint of a device handle
+struct endpoint_stats
+{
+    unsigned char address = 0;
+    transfer_stats stats{};
+};
+
+struct context_stats
+{
+    transfer_stats transfers{};
+    //calls which handled events of the context
+    std::uint64_t event_loops = 0;
+};
+
+namespace detail
+{
+//lock free counterpart of latency_histogram, any thread may record
+class atomic_histogram
+{
+    std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count> counts{};
+    std::atomic<std::uint64_t> sum{0};
+
+public:
+    void record(std::chrono::nanoseconds latency) noexcept
+    {
+        auto ns = static_cast<std::uint64_t>(latency.count() < 0 ? 0 : latency.count());
+        counts[latency_histogram::bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+    void read(latency_histogram &h) const noexcept
+    {
+        for (std::size_t b = 0; b < h.counts.size(); ++b)
+        {
+            h.counts[b] = counts[b].load(std::memory_order_relaxed);
+            h.count += h.counts[b];
+        }
+        h.sum = sum.load(std::memory_order_relaxed);
+    }
+};
+
+//lock free counterpart of transfer_stats
+//a snapshot is not atomic as a whole, but every counter in it is exact
+class transfer_counters
+{
+    std::atomic<std::uint64_t> submitted{0};
+    std::atomic<std::uint64_t> completed{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::array<std::atomic<std::uint64_t>, LIBUSB_TRANSFER_OVERFLOW + 1> by_status{};
+    std::array<std::atomic<std::uint64_t>, 14> submit_errors{};
+    std::atomic<std::int64_t> in_flight{0};
+    std::atomic<std::int64_t> max_in_flight{0};
+    atomic_histogram latency;
+
+public:
+    //called before the transfer is handed to libusb, which may complete it right away,
+    //returns the number of transfers in flight including this one for on_submitted
+    std::int64_t on_submit() noexcept
+    {
+        submitted.fetch_add(1, std::memory_order_relaxed);
+        return in_flight.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    //called once libusb accepted the transfer, a failed submission never raises the maximum
+    void on_submitted(std::int64_t n) noexcept
+    {
+        auto max = max_in_flight.load(std::memory_order_relaxed);
+        while (n > max && !max_in_flight.compare_exchange_weak(max, n, std::memory_order_relaxed))
+        {
+        }
+    }
+    void on_submit_failed(int code) noexcept
+    {
+        submitted.fetch_sub(1, std::memory_order_relaxed);
+        in_flight.fetch_sub(1, std::memory_order_relaxed);
+        submit_errors[submit_error_index(code)].fetch_add(1, std::memory_order_relaxed);
+    }
+    //for transfers whose submission was counted by on_submit
+    void on_complete(libusb_transfer_status status, std::uint64_t n, std::chrono::nanoseconds t) noexcept
+    {
+        in_flight.fetch_sub(1, std::memory_order_relaxed);
+        on_delivered(status, n, t);
+    }
+    //for transfers this object did not see being submitted
+    void on_delivered(libusb_transfer_status status, std::uint64_t n, std::chrono::nanoseconds t) noexcept
+    {
+        completed.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+        if (static_cast<std::size_t>(status) < by_status.size())
+        {
+            by_status[status].fetch_add(1, std::memory_order_relaxed);
+        }
+        latency.record(t);
+    }
+    void read(transfer_stats &s) const noexcept
+    {
+        s.submitted = submitted.load(std::memory_order_relaxed);
+        s.completed = completed.load(std::memory_order_relaxed);
+        s.bytes = bytes.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < by_status.size(); ++i)
+        {
+            s.by_status[i] = by_status[i].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < submit_errors.size(); ++i)
+        {
+            s.submit_errors[i] = submit_errors[i].load(std::memory_order_relaxed);
+        }
+        s.in_flight = in_flight.load(std::memory_order_relaxed);
+        s.max_in_flight = max_in_flight.load(std::memory_order_relaxed);
+        latency.read(s.latency);
+    }
+};
+
+//the counters of the endpoints of one device handle, allocated on first use
+//indexed by endpoint number plus 16 for IN endpoints
+class handle_counters
+{
+    std::array<std::atomic<transfer_counters *>, 32> endpoints{};
+
+    static std::size_t slot_of(unsigned char address) noexcept
+    {
+        return (address & LIBUSB_ENDPOINT_ADDRESS_MASK) | ((address & LIBUSB_ENDPOINT_DIR_MASK) ? 16 : 0);
+    }
+
+public:
+    handle_counters() = default;
+    handle_counters(const handle_counters &) = delete;
+    handle_counters &operator=(const handle_counters &) = delete;
+    ~handle_counters()
+    {
+        for (auto &e : endpoints)
+        {
+            delete e.load(std::memory_order_relaxed);
+        }
+    }
+    transfer_counters &endpoint(unsigned char address)
+    {
+        auto &slot = endpoints[slot_of(address)];
+        auto *c = slot.load(std::memory_order_acquire);
+        if (c == nullptr)
+        {
+            auto *fresh = new transfer_counters{};
+            if (slot.compare_exchange_strong(c, fresh, std::memory_order_acq_rel))
+            {
+                c = fresh;
+            }
+            else
+            {
+                delete fresh;
+            }
+        }
+        return *c;
+    }
+    //nullptr if the endpoint saw no transfer yet
+    const transfer_counters *find(unsigned char address) const noexcept
+    {
+        return endpoints[slot_of(address)].load(std::memory_order_acquire);
+    }
+    template <typename F>
+    void for_each(F f) const
+    {
+        for (std::size_t i = 0; i < endpoints.size(); ++i)
+        {
+            if (const auto *c = endpoints[i].load(std::memory_order_acquire))
+            {
+                f(static_cast<unsigned char>((i & LIBUSB_ENDPOINT_ADDRESS_MASK) | (i >= 16 ? LIBUSB_ENDPOINT_IN : 0)), *c);
+            }
+        }
+    }
+};
+
+//the counters of one context
+struct context_counters
+{
+    transfer_counters transfers;
+    std::atomic<std::uint64_t> event_loops{0};
+};
+
+//the counters of the context whose events the current thread handles,
+//completions are attributed to it
+inline thread_local context_counters *handling_context = nullptr;
+
+//sets handling_context for the lifetime of the object
+class handling_scope
+{
+    context_counters *previous;
+
+public:
+    explicit handling_scope(context_counters &c) noexcept : previous{handling_context}
+    {
+        handling_context = &c;
+        c.event_loops.fetch_add(1, std::memory_order_relaxed);
+    }
+    handling_scope(const handling_scope &) = delete;
+    handling_scope &operator=(const handling_scope &) = delete;
+    ~handling_scope()
+    {
+        handling_context = previous;
+    }
+};
+
+//the transfer status a synchronous call reports through its error code
+inline libusb_transfer_status status_of_error_code(int code) noexcept
+{
+    switch (code)
+    {
+    case 0:
+        return LIBUSB_TRANSFER_COMPLETED;
+    case LIBUSB_ERROR_TIMEOUT:
+        return LIBUSB_TRANSFER_TIMED_OUT;
+    case LIBUSB_ERROR_PIPE:
+        return LIBUSB_TRANSFER_STALL;
+    case LIBUSB_ERROR_NO_DEVICE:
+        return LIBUSB_TRANSFER_NO_DEVICE;
+    case LIBUSB_ERROR_OVERFLOW:
+        return LIBUSB_TRANSFER_OVERFLOW;
+    case LIBUSB_ERROR_INTERRUPTED:
+        return LIBUSB_TRANSFER_CANCELLED;
+    default:
+        return LIBUSB_TRANSFER_ERROR;
+    }
+}
+} // namespace detail
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,422 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "bulk_in_pipe.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//one buffer of the merged stream of a stream_aggregator
+struct aggregated_buffer
+{
+    std::size_t source = 0;
+    std::chrono::steady_clock::time_point timestamp{};
+    bulk_in_pipe::lease data;
+};
+
+//throughput and lag of one source of a stream_aggregator
+struct aggregator_source_stats
+{
+    std::uint64_t buffers = 0;
+    std::uint64_t bytes = 0;
+    //average since start
+    double bytes_per_second = 0.0;
+    //how far the newest timestamp of this source trails the newest timestamp of all sources
+    std::chrono::nanoseconds lag{0};
+    //longest time a buffer waited for its turn in the merged stream
+    std::chrono::nanoseconds max_delay{0};
+    //buffers which are received but not delivered yet
+    std::size_t queued = 0;
+    //buffers which arrived after a later buffer of another source was delivered
+    std::uint64_t late = 0;
+    //buffers the queue of set_queue dropped
+    std::uint64_t overruns = 0;
+    bool running = false;
+};
+
+//reads the same kind of stream from several devices and merges it into one
+//stream ordered by timestamp. every source is a bulk_in_pipe, so all reads
+//run on the event loop of the context (e.g. its event thread) and no thread
+//per device is needed.
+//every completed buffer is timestamped when libusb reports it, or by the
+//function of set_timestamp, and held back until no source can deliver an
+//earlier one any more: the sources timestamp in order, so a buffer is due
+//once every other running source has reported a later timestamp, or at the
+//latest once it is older than the reorder window.
+//the held back buffers are leases on the transfers of their pipe, so a
+//source can hold back at most transfer_count buffers before it stalls.
+//delivery happens on the thread which calls handle_events on the context
+//and on the thread which calls poll, which has to be called regularly
+//if sources may stop reporting for longer than the window.
+//the consumer runs without any lock held, so it may call poll, flush and
+//get_stats, a poll or flush from within the consumer returns right away and
+//its buffers follow once the consumer returned
+//note: after stop() the events have to be handled until in_flight() returns 0.
+//the destructor waits like the one of bulk_in_pipe until every source handed
+//back its transfers, so either another thread handles the events meanwhile or
+//the aggregator is drained first. it must not be destroyed from the consumer
+class stream_aggregator
+{
+    using clock = std::chrono::steady_clock;
+    struct entry
+    {
+        clock::time_point timestamp;
+        std::uint64_t sequence;
+        clock::time_point arrival;
+        std::size_t source;
+        bulk_in_pipe::lease data;
+    };
+    //orders the heap so the earliest timestamp is on top
+    struct later
+    {
+        bool operator()(const entry &a, const entry &b) const noexcept
+        {
+            return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.sequence > b.sequence;
+        }
+    };
+    struct source
+    {
+        std::unique_ptr<bulk_in_pipe> pipe;
+        //everything below is guarded by mtx
+        clock::time_point newest{};
+        std::uint64_t buffers = 0;
+        std::uint64_t bytes = 0;
+        clock::duration max_delay{0};
+        std::size_t queued = 0;
+        std::uint64_t late = 0;
+        std::uint64_t overruns = 0;
+    };
+
+    std::vector<source> sources;
+    std::mutex mtx;
+    //everything below is guarded by mtx
+    //only one thread delivers at a time, so buffers leave in heap order whichever thread delivers
+    bool delivering = false;
+    std::thread::id deliverer{};
+    //a flush which was asked for while another call delivered
+    bool flush_requested = false;
+    //set by the destructor, late completions are given back right away
+    bool closing = false;
+    std::condition_variable delivery_done;
+    std::vector<entry> heap;
+    std::uint64_t sequence = 0;
+    clock::time_point delivered{};
+    clock::time_point started{};
+    clock::duration window = std::chrono::milliseconds(10);
+    std::function<clock::time_point(std::size_t, clock::time_point, buffer_view)> stamp;
+    std::function<void(aggregated_buffer)> consumer;
+    std::function<bool(aggregated_buffer &)> pusher;
+    std::function<void(std::size_t, libusb_transfer_status)> on_error;
+
+    //expects the lock to be held, true if the earliest buffer may leave
+    bool due(clock::time_point now) const noexcept
+    {
+        if (heap.empty())
+        {
+            return false;
+        }
+        const auto &first = heap.front();
+        if (now - first.arrival >= window)
+        {
+            return true;
+        }
+        for (std::size_t s = 0; s < sources.size(); ++s)
+        {
+            if (s != first.source && sources[s].pipe->is_running() && sources[s].newest < first.timestamp)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    void receive(std::size_t s, clock::time_point arrival, bulk_in_pipe::lease l)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            if (closing)
+            {
+                //the lease goes back to its stopped pipe after the lock is released
+                return;
+            }
+            auto &src = sources[s];
+            auto timestamp = stamp ? stamp(s, arrival, l.get()) : arrival;
+            src.newest = std::max(src.newest, timestamp);
+            ++src.buffers;
+            src.bytes += l.size();
+            ++src.queued;
+            if (timestamp < delivered)
+            {
+                ++src.late;
+            }
+            heap.push_back(entry{timestamp, sequence++, arrival, s, std::move(l)});
+            std::push_heap(heap.begin(), heap.end(), later{});
+        }
+        drain(false);
+    }
+    //delivers the due buffers in order, or all of them
+    void drain(bool all)
+    {
+        std::unique_lock<std::mutex> lock{mtx};
+        if (delivering)
+        {
+            //the delivering call checks the heap again after every buffer, so it picks up
+            //the new ones, only a flush from another thread waits for it to deliver itself
+            if (!all || deliverer == std::this_thread::get_id())
+            {
+                flush_requested = flush_requested || all;
+                return;
+            }
+            delivery_done.wait(lock, [this] { return !delivering; });
+        }
+        delivering = true;
+        deliverer = std::this_thread::get_id();
+        try
+        {
+            for (;;)
+            {
+                all = all || flush_requested;
+                flush_requested = false;
+                auto now = clock::now();
+                if (heap.empty() || !(all || due(now)))
+                {
+                    break;
+                }
+                std::pop_heap(heap.begin(), heap.end(), later{});
+                auto &e = heap.back();
+                auto &src = sources[e.source];
+                --src.queued;
+                src.max_delay = std::max(src.max_delay, now - e.arrival);
+                delivered = std::max(delivered, e.timestamp);
+                aggregated_buffer b;
+                b.source = e.source;
+                b.timestamp = e.timestamp;
+                b.data = std::move(e.data);
+                heap.pop_back();
+                bool deliver = false;
+                if (pusher)
+                {
+                    if (!pusher(b))
+                    {
+                        ++src.overruns;
+                    }
+                }
+                else
+                {
+                    deliver = static_cast<bool>(consumer);
+                }
+                lock.unlock();
+                if (deliver)
+                {
+                    consumer(std::move(b));
+                }
+                //a dropped buffer goes back to its pipe outside the lock
+                b.data.release();
+                lock.lock();
+            }
+        }
+        catch (...)
+        {
+            if (!lock.owns_lock())
+            {
+                lock.lock();
+            }
+            delivering = false;
+            delivery_done.notify_all();
+            throw;
+        }
+        delivering = false;
+        delivery_done.notify_all();
+    }
+
+public:
+    stream_aggregator() = default;
+    stream_aggregator(const stream_aggregator &) = delete;
+    stream_aggregator &operator=(const stream_aggregator &) = delete;
+    ~stream_aggregator()
+    {
+        stop();
+        std::vector<entry> held;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            closing = true;
+            std::swap(held, heap);
+        }
+        held.clear();
+        //the pipes go first, their last completions still call receive,
+        //which needs everything else of the aggregator
+        for (auto &s : sources)
+        {
+            s.pipe.reset();
+        }
+    }
+
+    //adds a bulk IN endpoint as a source and returns its index,
+    //sources may only be added while the aggregator is stopped
+    std::size_t add_source(device_handle &dev, endpoint_address ep, std::size_t transfer_count, std::size_t transfer_size)
+    {
+        std::size_t s = sources.size();
+        sources.push_back(source{std::make_unique<bulk_in_pipe>(dev, ep, transfer_count, transfer_size)});
+        auto &pipe = *sources.back().pipe;
+        pipe.set_reader([this, s](bulk_in_pipe::lease l) { receive(s, clock::now(), std::move(l)); });
+        //a stopped source holds nothing back any more, its buffers leave on the next completion or poll
+        pipe.set_error_callback([this, s](libusb_transfer_status status) {
+            if (on_error)
+            {
+                on_error(s, status);
+            }
+        });
+        return s;
+    }
+    std::size_t source_count() const noexcept
+    {
+        return sources.size();
+    }
+    //true if all sources could allocate their transfers and buffers
+    explicit operator bool() const noexcept
+    {
+        for (auto &s : sources)
+        {
+            if (!*s.pipe)
+            {
+                return false;
+            }
+        }
+        return !sources.empty();
+    }
+
+    //called with every buffer of the merged stream in timestamp order
+    void set_callback(std::function<void(aggregated_buffer)> f)
+    {
+        consumer = std::move(f);
+    }
+    //hands every buffer of the merged stream to a queue (see queue.hpp) of aggregated_buffer,
+    //a full queue drops the buffer and counts an overrun of its source
+    template <typename Queue>
+    void set_queue(Queue &q)
+    {
+        pusher = [&q](aggregated_buffer &b) { return q.try_push(std::move(b)); };
+    }
+    //called with the index of the source, its completion time and the received data,
+    //returns the timestamp the buffer is merged by, e.g. one the device wrote into the data.
+    //the timestamps of one source have to be ascending and all sources have to use the same clock
+    void set_timestamp(std::function<std::chrono::steady_clock::time_point(std::size_t, std::chrono::steady_clock::time_point, buffer_view)> f)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        stamp = std::move(f);
+    }
+    //the longest a buffer waits for the other sources, which bounds the reordering latency
+    void set_reorder_window(std::chrono::microseconds w)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        window = std::chrono::duration_cast<clock::duration>(w);
+    }
+    //called once for every source which fails, the source is stopped at that point
+    void set_error_callback(std::function<void(std::size_t, libusb_transfer_status)> f)
+    {
+        on_error = std::move(f);
+    }
+    void set_timeout(std::chrono::milliseconds t)
+    {
+        for (auto &s : sources)
+        {
+            s.pipe->set_timeout(t);
+        }
+    }
+
+    //starts all sources, returns 0 on success or a libusb error code
+    //on failure the already started sources are stopped again
+    int start() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            started = clock::now();
+            delivered = clock::time_point{};
+            for (auto &s : sources)
+            {
+                s.newest = clock::time_point{};
+                s.buffers = 0;
+                s.bytes = 0;
+                s.max_delay = clock::duration{0};
+                s.late = 0;
+                s.overruns = 0;
+            }
+        }
+        for (auto &s : sources)
+        {
+            if (int r = s.pipe->start(); r != 0)
+            {
+                stop();
+                return r;
+            }
+        }
+        return 0;
+    }
+    //stops all sources, the buffers which are still held back are delivered by flush
+    void stop() noexcept
+    {
+        for (auto &s : sources)
+        {
+            s.pipe->stop();
+        }
+    }
+    //delivers the buffers whose window expired, returns the number of buffers still held back
+    std::size_t poll()
+    {
+        drain(false);
+        std::lock_guard<std::mutex> lock{mtx};
+        return heap.size();
+    }
+    //delivers all held back buffers right away
+    void flush()
+    {
+        drain(true);
+    }
+    //number of transfers of all sources which are currently owned by libusb
+    std::size_t in_flight() noexcept
+    {
+        std::size_t n = 0;
+        for (auto &s : sources)
+        {
+            n += s.pipe->in_flight();
+        }
+        return n;
+    }
+
+    aggregator_source_stats get_stats(std::size_t s)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        auto &src = sources[s];
+        aggregator_source_stats st;
+        st.buffers = src.buffers;
+        st.bytes = src.bytes;
+        auto elapsed = std::chrono::duration<double>(clock::now() - started).count();
+        st.bytes_per_second = elapsed > 0.0 ? static_cast<double>(src.bytes) / elapsed : 0.0;
+        clock::time_point newest{};
+        for (auto &other : sources)
+        {
+            newest = std::max(newest, other.newest);
+        }
+        auto own = std::max(src.newest, started);
+        st.lag = newest > own ? std::chrono::duration_cast<std::chrono::nanoseconds>(newest - own) : std::chrono::nanoseconds{0};
+        st.max_delay = std::chrono::duration_cast<std::chrono::nanoseconds>(src.max_delay);
+        st.queued = src.queued;
+        st.late = src.late;
+        st.overruns = src.overruns;
+        st.running = src.pipe->is_running();
+        return st;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,330 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "queue.hpp"
+#include "detail/trace_hook.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//records the transfers of the whole process into a pcap file in the format
+//of the linux usbmon interface (LINKTYPE_USB_LINUX_MMAPPED), which wireshark
+//and tcpdump read, without root rights or the usbmon kernel module.
+//every asynchronous transfer is recorded on submission and completion,
+//synchronous bulk and interrupt transfers around the call. a record is the
+//64 byte usbmon header plus at most payload_bytes of the data, written by
+//the recording thread into a lock free ring of its own, so recording costs
+//a few hundred bytes of copying and never blocks. a background thread
+//writes the rings to the file every flush interval. if a ring is full the
+//record is dropped and counted, see get_dropped, as is the first record of
+//a thread if its ring can not be allocated.
+//the records of different threads appear in the file in flush order, each
+//carries its own timestamp.
+//only one recorder can record at a time:
+//    trace_recorder rec{1 << 20, 64};
+//    rec.start("capture.pcap");
+class trace_recorder : detail::trace_sink
+{
+    static constexpr std::size_t usbmon_header_size = 64;
+    static constexpr std::size_t pcap_record_header_size = 16;
+    //usbmon numbers the transfer types differently than libusb
+    static constexpr std::uint8_t usbmon_iso = 0;
+    static constexpr std::uint8_t usbmon_interrupt = 1;
+    static constexpr std::uint8_t usbmon_control = 2;
+    static constexpr std::uint8_t usbmon_bulk = 3;
+
+    //byte ring of one recording thread, which is the only producer,
+    //and the flush thread, which is the only consumer
+    struct ring
+    {
+        std::unique_ptr<unsigned char[]> bytes;
+        std::size_t mask;
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+
+        explicit ring(std::size_t size) : bytes{new unsigned char[size]}, mask{size - 1} {}
+        void copy_in(std::size_t pos, const void *src, std::size_t n) noexcept
+        {
+            std::size_t at = pos & mask;
+            std::size_t first = std::min(n, mask + 1 - at);
+            std::memcpy(bytes.get() + at, src, first);
+            std::memcpy(bytes.get(), static_cast<const unsigned char *>(src) + first, n - first);
+        }
+    };
+    struct thread_ring
+    {
+        std::uint64_t generation = 0;
+        ring *r = nullptr;
+    };
+    static std::atomic<std::uint64_t> &generations() noexcept
+    {
+        static std::atomic<std::uint64_t> g{0};
+        return g;
+    }
+
+    std::size_t ring_size;
+    std::uint32_t payload_bytes;
+    std::chrono::milliseconds flush_interval{10};
+    std::uint64_t generation = 0;
+    std::FILE *file = nullptr;
+    std::thread flusher;
+    std::mutex mtx;
+    std::condition_variable cv;
+    //guarded by mtx
+    std::vector<std::unique_ptr<ring>> rings;
+    bool stopping = false;
+    std::atomic<std::uint64_t> records{0};
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> written{0};
+
+    ring *ring_of_this_thread()
+    {
+        thread_local thread_ring current;
+        if (current.generation != generation)
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            rings.push_back(std::make_unique<ring>(ring_size));
+            current = thread_ring{generation, rings.back().get()};
+        }
+        return current.r;
+    }
+    static void put16(unsigned char *p, std::uint16_t v) noexcept
+    {
+        std::memcpy(p, &v, sizeof(v));
+    }
+    static void put32(unsigned char *p, std::uint32_t v) noexcept
+    {
+        std::memcpy(p, &v, sizeof(v));
+    }
+    static void put64(unsigned char *p, std::uint64_t v) noexcept
+    {
+        std::memcpy(p, &v, sizeof(v));
+    }
+    static std::uint8_t usbmon_type(unsigned char transfer_type) noexcept
+    {
+        switch (transfer_type)
+        {
+        case LIBUSB_TRANSFER_TYPE_CONTROL:
+            return usbmon_control;
+        case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+            return usbmon_iso;
+        case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+            return usbmon_interrupt;
+        default:
+            return usbmon_bulk;
+        }
+    }
+
+    void record(const detail::trace_record &r) noexcept override
+    {
+        ring *rg;
+        try
+        {
+            rg = ring_of_this_thread();
+        }
+        catch (...)
+        {
+            //the first record of a thread allocates its ring, without memory the record is lost
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::uint32_t captured = std::min(r.data_length, payload_bytes);
+        std::size_t size = pcap_record_header_size + usbmon_header_size + captured;
+        std::size_t tail = rg->tail.load(std::memory_order_relaxed);
+        if (size > rg->mask + 1 - (tail - rg->head.load(std::memory_order_acquire)))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        unsigned char h[pcap_record_header_size + usbmon_header_size] = {};
+        //pcap record header
+        put32(h + 0, static_cast<std::uint32_t>(now / 1000000));
+        put32(h + 4, static_cast<std::uint32_t>(now % 1000000));
+        put32(h + 8, static_cast<std::uint32_t>(usbmon_header_size + captured));
+        put32(h + 12, static_cast<std::uint32_t>(usbmon_header_size + r.data_length));
+        //usbmon header, see Documentation/usb/usbmon.rst of the linux kernel
+        unsigned char *u = h + pcap_record_header_size;
+        put64(u + 0, r.id);
+        u[8] = static_cast<unsigned char>(r.type);
+        u[9] = usbmon_type(r.transfer_type);
+        u[10] = r.endpoint;
+        u[11] = r.device;
+        put16(u + 12, r.bus);
+        u[14] = r.setup != nullptr ? 0 : '-';
+        //as mon_bin sets it: '<' for the submission of an IN transfer and '>' for the
+        //completion of an OUT transfer, which carry no data, 'E' for a failed submission
+        bool in = (r.endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+        u[15] = r.type == 'E' ? 'E' : in ? (r.type == 'S' ? '<' : 0) : (r.type == 'C' ? '>' : 0);
+        put64(u + 16, static_cast<std::uint64_t>(now / 1000000));
+        put32(u + 24, static_cast<std::uint32_t>(now % 1000000));
+        put32(u + 28, static_cast<std::uint32_t>(r.status));
+        put32(u + 32, r.length);
+        put32(u + 36, captured);
+        if (r.setup != nullptr)
+        {
+            std::memcpy(u + 40, r.setup, LIBUSB_CONTROL_SETUP_SIZE);
+        }
+        rg->copy_in(tail, h, sizeof(h));
+        if (captured != 0)
+        {
+            rg->copy_in(tail + sizeof(h), r.data, captured);
+        }
+        rg->tail.store(tail + size, std::memory_order_release);
+        records.fetch_add(1, std::memory_order_relaxed);
+    }
+    //writes everything the rings hold to the file, only called by the flush thread or after it was joined
+    void flush_rings()
+    {
+        std::vector<ring *> all;
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            for (auto &r : rings)
+            {
+                all.push_back(r.get());
+            }
+        }
+        for (ring *r : all)
+        {
+            std::size_t head = r->head.load(std::memory_order_relaxed);
+            std::size_t tail = r->tail.load(std::memory_order_acquire);
+            std::size_t n = tail - head;
+            if (n == 0)
+            {
+                continue;
+            }
+            std::size_t at = head & r->mask;
+            std::size_t first = std::min(n, r->mask + 1 - at);
+            std::fwrite(r->bytes.get() + at, 1, first, file);
+            std::fwrite(r->bytes.get(), 1, n - first, file);
+            written.fetch_add(n, std::memory_order_relaxed);
+            r->head.store(tail, std::memory_order_release);
+        }
+        std::fflush(file);
+    }
+
+public:
+    //ring_size is the capacity of the ring of every recording thread, rounded up to a power of two,
+    //payload_bytes the most data which is recorded per event
+    explicit trace_recorder(std::size_t ring_size = 1 << 20, std::uint32_t payload_bytes = 0)
+        : ring_size{std::max<std::size_t>(detail::round_up_pow2(ring_size), 1024)}, payload_bytes{payload_bytes}
+    {
+    }
+    trace_recorder(const trace_recorder &) = delete;
+    trace_recorder &operator=(const trace_recorder &) = delete;
+    ~trace_recorder()
+    {
+        stop();
+    }
+
+    //how often the rings are written to the file
+    void set_flush_interval(std::chrono::milliseconds interval)
+    {
+        flush_interval = interval;
+    }
+
+    //creates the file and starts recording, returns 0 on success,
+    //LIBUSB_ERROR_BUSY if a recorder is recording already or LIBUSB_ERROR_IO if the file can not be written
+    int start(const char *path)
+    {
+        if (file != nullptr)
+        {
+            return LIBUSB_ERROR_BUSY;
+        }
+        file = std::fopen(path, "wb");
+        if (file == nullptr)
+        {
+            return LIBUSB_ERROR_IO;
+        }
+        //pcap file header with microsecond timestamps
+        unsigned char h[24] = {};
+        put32(h + 0, 0xa1b2c3d4);
+        put16(h + 4, 2);
+        put16(h + 6, 4);
+        put32(h + 16, static_cast<std::uint32_t>(usbmon_header_size + payload_bytes));
+        put32(h + 20, 220); //LINKTYPE_USB_LINUX_MMAPPED
+        if (std::fwrite(h, 1, sizeof(h), file) != sizeof(h))
+        {
+            std::fclose(file);
+            file = nullptr;
+            return LIBUSB_ERROR_IO;
+        }
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            rings.clear();
+            stopping = false;
+        }
+        generation = generations().fetch_add(1) + 1;
+        detail::trace_sink *expected = nullptr;
+        if (!detail::active_trace.compare_exchange_strong(expected, this))
+        {
+            std::fclose(file);
+            file = nullptr;
+            return LIBUSB_ERROR_BUSY;
+        }
+        flusher = std::thread([this] {
+            std::unique_lock<std::mutex> lock{mtx};
+            while (!stopping)
+            {
+                cv.wait_for(lock, flush_interval);
+                lock.unlock();
+                flush_rings();
+                lock.lock();
+            }
+        });
+        return 0;
+    }
+    //stops recording, writes what is left and closes the file
+    void stop()
+    {
+        if (file == nullptr)
+        {
+            return;
+        }
+        detail::trace_sink *self = this;
+        detail::active_trace.compare_exchange_strong(self, nullptr);
+        detail::trace_thread::wait_for_quiescence();
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            stopping = true;
+        }
+        cv.notify_all();
+        flusher.join();
+        flush_rings();
+        std::fclose(file);
+        file = nullptr;
+    }
+    bool is_recording() const noexcept
+    {
+        return file != nullptr;
+    }
+
+    //number of records taken and dropped because the ring of their thread was full
+    std::uint64_t get_records() const noexcept
+    {
+        return records.load(std::memory_order_relaxed);
+    }
+    std::uint64_t get_dropped() const noexcept
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+    //number of bytes written to the file after its header
+    std::uint64_t get_bytes_written() const noexcept
+    {
+        return written.load(std::memory_order_relaxed);
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
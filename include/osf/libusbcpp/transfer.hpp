@@ -1,35 +1,166 @@
 #pragma once
 #include "libusb.h"
 #include <functional>
+#include <chrono>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
 #include "sum_type.hpp"
 #include "descriptor.hpp"
+#include "device.hpp"
+#include "iso_packet.hpp"
+#include "stats.hpp"
+#include "detail/trace_hook.hpp"
 
 namespace osf
 {
 namespace libusbcpp
 {
 class device_handle;
-class transfer
+class transfer_pool;
+struct dynamic_callback
+{
+};
+
+//move only owner of a libusb_transfer
+//the callback is stored inside the transfer and called with the transfer as
+//argument once it completed. with the default dynamic_callback any callable
+//can be set through a std::function, any other Callback type is stored as
+//is and called directly, which avoids the type erasure and the allocation
+//of a capturing lambda on every completion.
+//note: libusb keeps a pointer to this object while the transfer is submitted,
+//so a transfer must neither be moved nor destroyed until its callback ran
+//with OSF_LIBUSBCPP_ENABLE_STATS every submission and completion is counted
+//on the endpoint of the device handle and on the context handling the events,
+//while a trace_recorder records they are also written to its trace
+template <typename Callback>
+class basic_transfer
 {
     friend class device_handle;
+    friend class transfer_pool;
+    using callback_type = std::conditional_t<std::is_same_v<Callback, dynamic_callback>, std::function<void(basic_transfer &)>, Callback>;
+    backend *be = nullptr;
     libusb_transfer *body = nullptr;
-    std::function<void(transfer &)> cb;
+    callback_type cb;
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+    detail::handle_counters *counters = nullptr;
+    detail::transfer_counters *submitted_to = nullptr; //the endpoint of the last submission
+    std::chrono::steady_clock::time_point submitted{};
+
+    void record_completion() noexcept
+    {
+        auto latency = std::chrono::steady_clock::now() - submitted;
+        auto status = body->status;
+        std::uint64_t bytes = static_cast<std::uint64_t>(body->actual_length);
+        if (body->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            bytes = 0;
+            for (int i = 0; i < body->num_iso_packets; ++i)
+            {
+                bytes += body->iso_packet_desc[i].actual_length;
+            }
+        }
+        if (submitted_to != nullptr)
+        {
+            submitted_to->on_complete(status, bytes, latency);
+        }
+        if (detail::handling_context != nullptr)
+        {
+            detail::handling_context->transfers.on_delivered(status, bytes, latency);
+        }
+    }
+#endif
 
     static void LIBUSB_CALL callback(libusb_transfer *tp)
     {
-        transfer *self = static_cast<transfer *>(tp->user_data);
+        basic_transfer *self = static_cast<basic_transfer *>(tp->user_data);
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        self->record_completion();
+#endif
+        detail::trace_complete(self->be, tp);
+        if constexpr (std::is_same_v<Callback, dynamic_callback>)
+        {
+            //a transfer without callback, e.g. fresh from a transfer_pool, completes silently
+            if (!self->cb)
+            {
+                return;
+            }
+        }
         self->cb(*self);
     }
-    transfer(libusb_device_handle *dev, endpoint_address ep) : body{libusb_alloc_transfer(0)}
+    basic_transfer(device_handle &h, endpoint_address ep, callback_type f = callback_type{}, int iso_packets = 0)
+        : be{h.be}, body{be->alloc_transfer(iso_packets)}, cb{std::move(f)}
     {
-        libusb_fill_bulk_transfer(body, dev, static_cast<unsigned char>(ep), nullptr, 0, &callback, static_cast<void *>(this), 0);
+        if (body != nullptr)
+        {
+            libusb_fill_bulk_transfer(body, h.dev, static_cast<unsigned char>(ep), nullptr, 0, &callback, static_cast<void *>(this), 0);
+        }
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        counters = h.counters.get();
+#endif
+    }
+    void free() noexcept
+    {
+        if (body != nullptr)
+        {
+            be->free_transfer(body);
+        }
     }
 
 public:
-    void set_callback(std::function<void(transfer &)> f)
+    basic_transfer(const basic_transfer &) = delete;
+    basic_transfer &operator=(const basic_transfer &) = delete;
+    basic_transfer(basic_transfer &&other) noexcept : be{other.be}, body{other.body}, cb{std::move(other.cb)}
+    {
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        counters = other.counters;
+        submitted_to = other.submitted_to;
+        submitted = other.submitted;
+#endif
+        other.body = nullptr;
+        if (body != nullptr)
+        {
+            body->user_data = static_cast<void *>(this); //libusb has to call back the new owner
+        }
+    }
+    basic_transfer &operator=(basic_transfer &&other) noexcept
+    {
+        free();
+        be = other.be;
+        body = other.body;
+        cb = std::move(other.cb);
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        counters = other.counters;
+        submitted_to = other.submitted_to;
+        submitted = other.submitted;
+#endif
+        other.body = nullptr;
+        if (body != nullptr)
+        {
+            body->user_data = static_cast<void *>(this);
+        }
+        return *this;
+    }
+    ~basic_transfer()
+    {
+        free();
+    }
+
+    //true if this object is in a fully formed state
+    explicit operator bool() const noexcept
+    {
+        return body != nullptr;
+    }
+
+    //only available if the callback type is assignable, which lambdas are not
+    void set_callback(callback_type f)
     {
         cb = std::move(f);
     }
+    callback_type &get_callback() noexcept
+    {
+        return cb;
+    }
     void set_buffer(unsigned char *begin, unsigned char *end)
     {
         body->buffer = begin;
@@ -39,10 +170,220 @@ public:
     {
         body->timeout = t.count();
     }
+    void set_endpoint(endpoint_address ep)
+    {
+        body->endpoint = static_cast<unsigned char>(ep);
+    }
+    //gives every packet of an isochronous transfer the same length,
+    //the buffer has to hold get_iso_packet_count() * length bytes
+    void set_iso_packet_lengths(unsigned int length)
+    {
+        libusb_set_iso_packet_lengths(body, length);
+    }
+    int get_iso_packet_count() const noexcept
+    {
+        return body->num_iso_packets;
+    }
+    //makes [begin, end) the buffer of a control transfer, which starts with the
+    //LIBUSB_CONTROL_SETUP_SIZE bytes of the setup packet followed by the data
+    //stage, and writes the setup packet. the direction bit of request_type
+    //decides whether the data stage is sent or received
+    void set_control_setup(unsigned char *begin, unsigned char *end, std::uint8_t request_type, std::uint8_t request, std::uint16_t value, std::uint16_t index)
+    {
+        libusb_fill_control_setup(begin, request_type, request, value, index, static_cast<std::uint16_t>(end - begin - LIBUSB_CONTROL_SETUP_SIZE));
+        set_buffer(begin, end);
+    }
+    //the bulk stream a transfer of type LIBUSB_TRANSFER_TYPE_BULK_STREAM belongs to
+    void set_stream_id(std::uint32_t stream_id) noexcept
+    {
+        be->transfer_set_stream_id(body, stream_id);
+    }
+    std::uint32_t get_stream_id() const noexcept
+    {
+        return be->transfer_get_stream_id(body);
+    }
+
+    //returns 0 on success or a libusb error code
+    int submit() noexcept
+    {
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        //libusb may complete the transfer and its callback reuse it before submit_transfer returns
+        auto *to = counters != nullptr ? &counters->endpoint(body->endpoint) : nullptr;
+        submitted_to = to;
+        std::int64_t n = to != nullptr ? to->on_submit() : 0;
+        submitted = std::chrono::steady_clock::now();
+#endif
+        detail::trace_submit(be, body);
+        int r = be->submit_transfer(body);
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+        if (to != nullptr)
+        {
+            if (r != 0)
+            {
+                to->on_submit_failed(r);
+            }
+            else
+            {
+                to->on_submitted(n);
+            }
+        }
+#endif
+        if (r != 0)
+        {
+            detail::trace_submit_failed(be, body, r);
+        }
+        return r;
+    }
+    //the callback is still called once the cancellation is complete
+    int cancel() noexcept
+    {
+        return be->cancel_transfer(body);
+    }
+
+    //only meaningful from within the callback
+    libusb_transfer_status get_status() const noexcept
+    {
+        return body->status;
+    }
+    //the range [begin, end) holds the data which was actually transferred,
+    //for control transfers the data stage after the setup packet
+    unsigned char *begin() const noexcept
+    {
+        return body->type == LIBUSB_TRANSFER_TYPE_CONTROL ? libusb_control_transfer_get_data(body) : body->buffer;
+    }
+    unsigned char *end() const noexcept
+    {
+        return begin() + body->actual_length;
+    }
+    //the packets of an isochronous transfer, each with its own status and data
+    //only meaningful from within the callback
+    iso_packet_range iso_packets() const noexcept
+    {
+        return iso_packet_range{body};
+    }
+    //note that the pointer is only valid as long as the transfer object lives
+    libusb_transfer *get() const noexcept
+    {
+        return body;
+    }
 };
-transfer device_handle::async_bulk_transfer(endpoint_address ep)
+
+//the libusb error code a synchronous call reports for a transfer which ended with status
+inline int status_error_code(libusb_transfer_status status) noexcept
+{
+    switch (status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+        return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+        return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+        return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return LIBUSB_ERROR_INTERRUPTED;
+    default:
+        return LIBUSB_ERROR_IO;
+    }
+}
+
+inline transfer device_handle::async_bulk_transfer(endpoint_address ep)
+{
+    return transfer(*this, ep);
+}
+template <typename Callback>
+basic_transfer<Callback> device_handle::async_bulk_transfer(endpoint_address ep, Callback cb)
+{
+    return basic_transfer<Callback>(*this, ep, std::move(cb));
+}
+namespace detail
+{
+inline void make_interrupt(libusb_transfer *body) noexcept
+{
+    if (body != nullptr)
+    {
+        body->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+    }
+}
+inline void make_bulk_stream(backend *be, libusb_transfer *body, std::uint32_t stream_id) noexcept
+{
+    if (body != nullptr)
+    {
+        body->type = LIBUSB_TRANSFER_TYPE_BULK_STREAM;
+        be->transfer_set_stream_id(body, stream_id);
+    }
+}
+inline void make_control(libusb_transfer *body) noexcept
+{
+    if (body != nullptr)
+    {
+        body->type = LIBUSB_TRANSFER_TYPE_CONTROL;
+        body->endpoint = 0;
+    }
+}
+inline void make_iso(libusb_transfer *body, int packets) noexcept
+{
+    if (body != nullptr)
+    {
+        body->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+        body->num_iso_packets = packets;
+    }
+}
+} // namespace detail
+inline transfer device_handle::async_interrupt_transfer(endpoint_address ep)
+{
+    transfer t(*this, ep);
+    detail::make_interrupt(t.get());
+    return t;
+}
+template <typename Callback>
+basic_transfer<Callback> device_handle::async_interrupt_transfer(endpoint_address ep, Callback cb)
+{
+    basic_transfer<Callback> t(*this, ep, std::move(cb));
+    detail::make_interrupt(t.get());
+    return t;
+}
+inline transfer device_handle::async_bulk_stream_transfer(endpoint_address ep, std::uint32_t stream_id)
+{
+    transfer t(*this, ep);
+    detail::make_bulk_stream(be, t.get(), stream_id);
+    return t;
+}
+template <typename Callback>
+basic_transfer<Callback> device_handle::async_bulk_stream_transfer(endpoint_address ep, std::uint32_t stream_id, Callback cb)
+{
+    basic_transfer<Callback> t(*this, ep, std::move(cb));
+    detail::make_bulk_stream(be, t.get(), stream_id);
+    return t;
+}
+inline transfer device_handle::async_iso_transfer(endpoint_address ep, int packets)
+{
+    transfer t(*this, ep, transfer::callback_type{}, packets);
+    detail::make_iso(t.get(), packets);
+    return t;
+}
+template <typename Callback>
+basic_transfer<Callback> device_handle::async_iso_transfer(endpoint_address ep, int packets, Callback cb)
+{
+    basic_transfer<Callback> t(*this, ep, std::move(cb), packets);
+    detail::make_iso(t.get(), packets);
+    return t;
+}
+inline transfer device_handle::async_control_transfer()
+{
+    transfer t(*this, endpoint_address(0));
+    detail::make_control(t.get());
+    return t;
+}
+template <typename Callback>
+basic_transfer<Callback> device_handle::async_control_transfer(Callback cb)
 {
-    return transfer(dev, ep);
+    basic_transfer<Callback> t(*this, endpoint_address(0), std::move(cb));
+    detail::make_control(t.get());
+    return t;
 }
 } // namespace libusbcpp
-} // namespace osf
\ No newline at end of file
+} // namespace osf
@@ -0,0 +1,152 @@
+#pragma once
+#include "libusb.h"
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include "descriptor.hpp"
+#include "device.hpp"
+#include "transfer.hpp"
+#include "detail/free_list.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+//a fixed set of transfers of one device handle which are allocated up front
+//and lent out as leases, returning a lease puts its transfer back into a
+//lock free free list. acquiring and releasing never allocates, so the
+//submit/complete loop does not hit the allocator or libusb_alloc_transfer.
+//every transfer can hold iso_packets isochronous packets.
+//note: the pool has to outlive its leases and a lease must not be returned
+//while its transfer is submitted
+class transfer_pool
+{
+    std::vector<transfer> transfers;
+    detail::index_free_list free_list;
+    std::atomic<std::size_t> available;
+    int iso_packets;
+
+    void release(std::size_t i) noexcept
+    {
+        free_list.push(i);
+        available.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    //move only handle to a transfer of the pool
+    class lease
+    {
+        friend class transfer_pool;
+        transfer_pool *pool = nullptr;
+        std::size_t index = 0;
+        lease(transfer_pool *p, std::size_t i) noexcept : pool{p}, index{i} {}
+
+    public:
+        lease() noexcept = default;
+        lease(const lease &) = delete;
+        lease &operator=(const lease &) = delete;
+        lease(lease &&other) noexcept : pool{other.pool}, index{other.index}
+        {
+            other.pool = nullptr;
+        }
+        lease &operator=(lease &&other) noexcept
+        {
+            reset();
+            pool = other.pool;
+            index = other.index;
+            other.pool = nullptr;
+            return *this;
+        }
+        ~lease()
+        {
+            reset();
+        }
+        //returns the transfer to the pool
+        void reset() noexcept
+        {
+            if (pool != nullptr)
+            {
+                pool->release(index);
+                pool = nullptr;
+            }
+        }
+        //false if the pool was exhausted
+        explicit operator bool() const noexcept
+        {
+            return pool != nullptr;
+        }
+        transfer &operator*() const noexcept
+        {
+            return pool->transfers[index];
+        }
+        transfer *operator->() const noexcept
+        {
+            return &pool->transfers[index];
+        }
+    };
+
+    transfer_pool(device_handle &dev, std::size_t count, int iso_packets = 0)
+        : free_list{count}, available{count}, iso_packets{iso_packets}
+    {
+        transfers.reserve(count); //the transfers must not move once created
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            transfers.push_back(transfer(dev, endpoint_address(0), transfer::callback_type{}, iso_packets));
+        }
+    }
+    transfer_pool(const transfer_pool &) = delete;
+    transfer_pool &operator=(const transfer_pool &) = delete;
+
+    //true if all transfers could be allocated
+    explicit operator bool() const noexcept
+    {
+        for (auto &t : transfers)
+        {
+            if (!t)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //takes a transfer out of the pool, the lease is empty if none is left
+    //the transfer is reset to a bulk transfer to endpoint 0 without buffer,
+    //timeout and callback, without a callback its completion is ignored
+    lease acquire() noexcept
+    {
+        std::size_t i = free_list.pop();
+        if (i == detail::index_free_list::npos)
+        {
+            return lease{};
+        }
+        available.fetch_sub(1, std::memory_order_relaxed);
+        auto &t = transfers[i];
+        auto *body = t.get();
+        body->type = LIBUSB_TRANSFER_TYPE_BULK;
+        body->flags = 0;
+        body->endpoint = 0;
+        body->buffer = nullptr;
+        body->length = 0;
+        body->timeout = 0;
+        body->num_iso_packets = iso_packets;
+        t.set_callback(nullptr);
+        return lease{this, i};
+    }
+
+    std::size_t size() const noexcept
+    {
+        return transfers.size();
+    }
+    //number of transfers which are not leased, only a snapshot while other threads use the pool
+    std::size_t get_available() const noexcept
+    {
+        return available.load(std::memory_order_relaxed);
+    }
+    int get_iso_packets() const noexcept
+    {
+        return iso_packets;
+    }
+};
+} // namespace libusbcpp
+} // namespace osf
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+//a minimal test registry, every test_*.cpp registers its cases with TEST_CASE
+//and main runs the ones of the group named on the command line
+namespace osf
+{
+namespace libusbcpp
+{
+namespace test
+{
+struct test_case
+{
+    const char *group;
+    const char *name;
+    void (*run)();
+};
+inline std::vector<test_case> &test_cases()
+{
+    static std::vector<test_case> cases;
+    return cases;
+}
+inline int &failures()
+{
+    static int n = 0;
+    return n;
+}
+struct registration
+{
+    registration(const char *group, const char *name, void (*run)())
+    {
+        test_cases().push_back(test_case{group, name, run});
+    }
+};
+} // namespace test
+} // namespace libusbcpp
+} // namespace osf
+
+#define TEST_CASE(group, name)                                                                               \
+    static void group##_##name();                                                                            \
+    static const osf::libusbcpp::test::registration group##_##name##_registration{#group, #name, group##_##name}; \
+    static void group##_##name()
+
+//records a failure and carries on with the test
+#define CHECK(expr)                                                                    \
+    do                                                                                 \
+    {                                                                                  \
+        if (!(expr))                                                                   \
+        {                                                                              \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            ++osf::libusbcpp::test::failures();                                        \
+        }                                                                              \
+    } while (false)
@@ -1,4 +1,23 @@
-int main()
+#include "check.hpp"
+
+//runs the tests of the group given as the first argument, or all of them
+int main(int argc, char **argv)
 {
-    return 0;
-}
\ No newline at end of file
+    using namespace osf::libusbcpp::test;
+    int count = 0;
+    for (auto &t : test_cases())
+    {
+        if (argc < 2 || std::strcmp(argv[1], t.group) == 0)
+        {
+            std::printf("%s.%s\n", t.group, t.name);
+            t.run();
+            ++count;
+        }
+    }
+    if (count == 0)
+    {
+        std::fprintf(stderr, "no tests in %s\n", argc < 2 ? "any group" : argv[1]);
+        return 1;
+    }
+    return failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <osf/libusbcpp.hpp>
+#include <osf/libusbcpp/sim_backend.hpp>
+#include <functional>
+#include <memory>
+#include <utility>
+#include "check.hpp"
+
+namespace osf
+{
+namespace libusbcpp
+{
+namespace test
+{
+//opens the only device with the given vendor id and claims interface 0
+inline device_handle open_first(context &ctx, std::uint16_t vendor_id = 0x1234)
+{
+    auto handles = open_if(ctx, [=](const libusb_device_descriptor &d) { return d.idVendor == vendor_id; });
+    CHECK(handles.size() == 1);
+    CHECK(handles[0].claim(0) == 0);
+    return std::move(handles[0]);
+}
+
+//an IN endpoint which sends the bytes 0, 1, 2, ... wrapping at 256
+inline sim::endpoint_config counting_source(unsigned char address)
+{
+    sim::endpoint_config ep{};
+    ep.address = address;
+    auto next = std::make_shared<unsigned char>(0);
+    ep.source = [next](unsigned char *data, int length) {
+        for (int i = 0; i < length; ++i)
+        {
+            data[i] = (*next)++;
+        }
+        return length;
+    };
+    return ep;
+}
+
+//checks that the received bytes continue the sequence of counting_source
+struct counting_check
+{
+    unsigned char expected = 0;
+    std::size_t received = 0;
+    bool in_order = true;
+
+    void operator()(const unsigned char *begin, const unsigned char *end)
+    {
+        for (auto p = begin; p != end; ++p)
+        {
+            in_order = in_order && *p == expected;
+            ++expected;
+        }
+        received += static_cast<std::size_t>(end - begin);
+    }
+};
+} // namespace test
+} // namespace libusbcpp
+} // namespace osf
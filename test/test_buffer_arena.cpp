@@ -0,0 +1,98 @@
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+TEST_CASE(buffer_arena, exhaustion)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    buffer_arena arena(h, 1000, 4);
+    CHECK(static_cast<bool>(arena));
+    CHECK(arena.size() == 4 && arena.get_slab_size() == 1000);
+    std::vector<buffer_arena::slab> slabs;
+    for (int i = 0; i < 4; ++i)
+    {
+        slabs.push_back(arena.acquire());
+        CHECK(static_cast<bool>(slabs.back()));
+        CHECK(slabs.back().size() == 1000 && slabs.back().end() - slabs.back().begin() == 1000);
+        //slabs are 64 byte aligned and do not overlap
+        CHECK(reinterpret_cast<std::uintptr_t>(slabs.back().begin()) % 64 == 0);
+        std::memset(slabs.back().begin(), i, slabs.back().size());
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        CHECK(slabs[i].begin()[0] == i && slabs[i].end()[-1] == i);
+    }
+    CHECK(arena.get_available() == 0);
+    CHECK(!arena.acquire());
+    //a released slab is handed out again
+    unsigned char *released = slabs[2].begin();
+    slabs[2].reset();
+    CHECK(!slabs[2]);
+    CHECK(arena.get_available() == 1);
+    auto again = arena.acquire();
+    CHECK(again && again.begin() == released);
+    //moving hands the slab over without releasing it
+    buffer_arena::slab moved;
+    moved = std::move(again);
+    CHECK(!again && moved && arena.get_available() == 0);
+    slabs.clear();
+    moved.reset();
+    CHECK(arena.get_available() == 4);
+}
+
+TEST_CASE(buffer_arena, heap_fallback)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    //the simulated bus has no device memory, so the arena falls back to the heap
+    buffer_arena arena(h, 2 * buffer_arena::page_size, 3);
+    CHECK(static_cast<bool>(arena));
+    CHECK(!arena.is_device_memory());
+    auto s = arena.acquire();
+    auto t = arena.acquire();
+    //slabs of whole pages are page aligned
+    CHECK(reinterpret_cast<std::uintptr_t>(s.begin()) % buffer_arena::page_size == 0);
+    CHECK(reinterpret_cast<std::uintptr_t>(t.begin()) % buffer_arena::page_size == 0);
+    //the pipes report the fallback of their arena, see disk_sink
+    bulk_in_pipe pipe(h, endpoint_address(0x81), 2, 4096);
+    CHECK(!pipe.is_device_memory());
+    //an empty arena has no memory and hands out nothing
+    buffer_arena empty(h, 64, 0);
+    CHECK(!empty);
+    CHECK(!empty.acquire());
+}
+
+TEST_CASE(buffer_arena, concurrent_slabs)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    buffer_arena arena(h, 256, 8);
+    std::vector<std::thread> threads;
+    for (int k = 0; k < 4; ++k)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100000; ++i)
+            {
+                auto a = arena.acquire();
+                auto b = arena.acquire();
+                CHECK(!a || !b || a.begin() != b.begin());
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    CHECK(arena.get_available() == 8);
+}
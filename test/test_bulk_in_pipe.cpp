@@ -0,0 +1,122 @@
+#include <atomic>
+#include <deque>
+#include <thread>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+sim::device_config source_device()
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    cfg.interfaces[0].endpoints.push_back(test::counting_source(0x82));
+    return cfg;
+}
+} // namespace
+
+TEST_CASE(bulk_in_pipe, delivers_in_order)
+{
+    sim::backend bus;
+    bus.add_device(source_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    bulk_in_pipe pipe(h, endpoint_address(0x82), 4, 4096);
+    CHECK(static_cast<bool>(pipe));
+    test::counting_check check;
+    pipe.set_callback([&](const unsigned char *begin, const unsigned char *end) { check(begin, end); });
+    CHECK(pipe.start() == 0);
+    CHECK(pipe.start() == LIBUSB_ERROR_BUSY);
+    while (check.received < 1000000)
+    {
+        handle_events(ctx);
+    }
+    pipe.stop();
+    while (pipe.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    CHECK(check.in_order);
+}
+
+TEST_CASE(bulk_in_pipe, leases)
+{
+    sim::backend bus;
+    bus.add_device(source_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    bulk_in_pipe pipe(h, endpoint_address(0x82), 8, 1024);
+    std::deque<bulk_in_pipe::lease> held;
+    test::counting_check check;
+    pipe.set_reader([&](bulk_in_pipe::lease l) {
+        check(l.begin(), l.end());
+        held.push_back(std::move(l));
+        if (held.size() > 5)
+        {
+            held.pop_front();
+        }
+    });
+    CHECK(pipe.start() == 0);
+    while (check.received < 100000)
+    {
+        handle_events(ctx);
+    }
+    CHECK(pipe.get_leased() == 5);
+    //the held buffers are not overwritten while they are leased
+    CHECK(held.front().data()[0] == static_cast<unsigned char>(check.expected - 5 * 1024));
+    pipe.stop();
+    held.clear();
+    CHECK(pipe.get_leased() == 0);
+    while (pipe.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    CHECK(check.in_order);
+}
+
+TEST_CASE(bulk_in_pipe, error_stops)
+{
+    sim::backend bus;
+    auto cfg = source_device();
+    cfg.interfaces[0].endpoints.back().errors.every_nth = 10;
+    bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    bulk_in_pipe pipe(h, endpoint_address(0x82), 4, 512);
+    int errors = 0;
+    pipe.set_error_callback([&](libusb_transfer_status status) {
+        CHECK(status == LIBUSB_TRANSFER_ERROR);
+        ++errors;
+    });
+    CHECK(pipe.start() == 0);
+    while (pipe.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    CHECK(errors == 1);
+    CHECK(!pipe.is_running());
+}
+
+TEST_CASE(bulk_in_pipe, destroyed_while_running)
+{
+    sim::backend bus;
+    bus.add_device(source_device());
+    {
+        context ctx{bus};
+        CHECK(ctx.start_event_thread() == 0);
+        auto h = test::open_first(ctx);
+        std::atomic<std::size_t> received{0};
+        {
+            bulk_in_pipe pipe(h, endpoint_address(0x82), 8, 4096);
+            pipe.set_callback([&](const unsigned char *begin, const unsigned char *end) { received += static_cast<std::size_t>(end - begin); });
+            CHECK(pipe.start() == 0);
+            while (received.load() < 100000)
+            {
+                std::this_thread::yield();
+            }
+            //the destructor waits until the event thread handed back every transfer
+        }
+        CHECK(bus.allocated_transfers() == 0);
+    }
+    CHECK(bus.open_handles() == 0);
+}
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//a super speed device whose OUT endpoint records the length of every write
+struct recording_device
+{
+    sim::backend bus;
+    std::vector<int> writes;
+    std::vector<unsigned char> data;
+
+    recording_device()
+    {
+        sim::device_config cfg{};
+        cfg.vendor_id = 0x1234;
+        cfg.speed = LIBUSB_SPEED_SUPER;
+        cfg.bcd_usb = 0x0300;
+        sim::endpoint_config out{};
+        out.address = 0x01;
+        out.max_packet_size = 1024;
+        out.sink = [this](const unsigned char *d, int length) {
+            writes.push_back(length);
+            data.insert(data.end(), d, d + length);
+        };
+        sim::interface_config intf{};
+        intf.endpoints = {out};
+        cfg.interfaces.push_back(intf);
+        bus.add_device(cfg);
+    }
+};
+
+void wait_idle(context &ctx, bulk_out_pipe &pipe)
+{
+    while (pipe.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+}
+} // namespace
+
+TEST_CASE(bulk_out_pipe, coalesces_small_writes)
+{
+    recording_device dev;
+    context ctx{dev.bus};
+    auto h = test::open_first(ctx);
+    bulk_out_pipe pipe(h, endpoint_address(0x01), 4, 4096);
+    CHECK(static_cast<bool>(pipe));
+    CHECK(pipe.get_packet_size() == 1024);
+    unsigned char counter = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        unsigned char chunk[10];
+        for (auto &b : chunk)
+        {
+            b = counter++;
+        }
+        std::size_t taken = 0;
+        while ((taken += pipe.write(chunk + taken, chunk + 10)) != 10)
+        {
+            handle_events(ctx);
+        }
+    }
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK(dev.data.size() == 10000);
+    CHECK(dev.writes.size() < 100);
+    test::counting_check check;
+    check(dev.data.data(), dev.data.data() + dev.data.size());
+    CHECK(check.in_order);
+    CHECK(pipe.get_bytes_sent() == 10000);
+}
+
+TEST_CASE(bulk_out_pipe, zero_length_packet_after_full_buffers)
+{
+    recording_device dev;
+    context ctx{dev.bus};
+    auto h = test::open_first(ctx);
+    bulk_out_pipe pipe(h, endpoint_address(0x01), 4, 2048);
+    //the pipe is busy, so the full buffers go out without the flush rules
+    std::vector<unsigned char> block(2 * 2048, 1);
+    CHECK(pipe.write(block.data(), block.data() + block.size()) == block.size());
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK((dev.writes == std::vector<int>{2048, 2048, 0}));
+    //nothing new was written, so there is nothing to terminate
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK(dev.writes.size() == 3);
+}
+
+TEST_CASE(bulk_out_pipe, zero_length_packet_of_flushed_buffer)
+{
+    recording_device dev;
+    context ctx{dev.bus};
+    auto h = test::open_first(ctx);
+    bulk_out_pipe pipe(h, endpoint_address(0x01), 4, 4096);
+    pipe.set_flush_deadline(std::chrono::seconds(10));
+    std::vector<unsigned char> block(1024, 1);
+    CHECK(pipe.write(block.data(), block.data() + block.size()) == block.size());
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK((dev.writes == std::vector<int>{1024, 0}));
+    //a short packet ends the write by itself
+    CHECK(pipe.write(block.data(), block.data() + 100) == 100);
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK((dev.writes == std::vector<int>{1024, 0, 100}));
+}
+
+TEST_CASE(bulk_out_pipe, zero_length_packet_waits_for_a_slot)
+{
+    recording_device dev;
+    context ctx{dev.bus};
+    auto h = test::open_first(ctx);
+    bulk_out_pipe pipe(h, endpoint_address(0x01), 2, 1024);
+    std::vector<unsigned char> block(2 * 1024, 1);
+    CHECK(pipe.write(block.data(), block.data() + block.size()) == block.size());
+    //both slots are in flight, the zero length packet follows once one is free
+    CHECK(pipe.flush() == 0);
+    CHECK(pipe.write(block.data(), block.data() + 10) == 0);
+    wait_idle(ctx, pipe);
+    CHECK(pipe.write(block.data(), block.data() + 10) == 10);
+    CHECK(pipe.flush() == 0);
+    wait_idle(ctx, pipe);
+    CHECK((dev.writes == std::vector<int>{1024, 1024, 0, 10}));
+}
+
+TEST_CASE(bulk_out_pipe, destroyed_while_running)
+{
+    sim::backend bus;
+    //a slow endpoint, so the transfers are still in flight when the pipe goes away
+    bus.add_device(sim::loopback_device(0x1234, 0x5678, 1e6));
+    {
+        context ctx{bus};
+        CHECK(ctx.start_event_thread() == 0);
+        auto h = test::open_first(ctx);
+        {
+            bulk_out_pipe pipe(h, endpoint_address(0x01), 4, 4096);
+            std::vector<unsigned char> data(16384, 0x55);
+            CHECK(pipe.write(data.data(), data.data() + data.size()) == data.size());
+            CHECK(pipe.in_flight() != 0);
+            //the destructor waits until the event thread handed back every transfer
+        }
+        CHECK(bus.allocated_transfers() == 0);
+        //the event thread would now complete transfers which were freed too early
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    CHECK(bus.open_handles() == 0);
+}
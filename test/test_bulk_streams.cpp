@@ -0,0 +1,114 @@
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//loopback_device at super speed with bulk streams on both endpoints
+sim::device_config stream_device(std::uint32_t max_streams)
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    cfg.speed = LIBUSB_SPEED_SUPER;
+    cfg.bcd_usb = 0x0300;
+    for (auto &ep : cfg.interfaces[0].endpoints)
+    {
+        ep.max_streams = max_streams;
+    }
+    return cfg;
+}
+
+const std::vector<endpoint_address> both{endpoint_address(0x01), endpoint_address(0x81)};
+
+//the number of streams granted or the error
+int alloc(device_handle &h, std::uint32_t n, const std::vector<endpoint_address> &eps)
+{
+    return h.alloc_streams(n, eps)([](bulk_streams &s) { return static_cast<int>(s.size()); }, [](osf::error e) { return static_cast<int>(e); });
+}
+} // namespace
+
+TEST_CASE(bulk_streams, alloc)
+{
+    sim::backend bus;
+    bus.add_device(stream_device(4));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    {
+        auto r = h.alloc_streams(8, both);
+        r(
+            [&](bulk_streams &s) {
+                //the device grants fewer streams than requested
+                CHECK(s.size() == 4);
+                //an endpoint has one set of streams at a time
+                CHECK(alloc(h, 2, {endpoint_address(0x81)}) == LIBUSB_ERROR_INVALID_PARAM);
+                bulk_streams moved{std::move(s)};
+                CHECK(!s && moved && moved.size() == 4);
+                CHECK(moved.free() == 0);
+                CHECK(!moved && moved.free() == 0);
+                CHECK(alloc(h, 2, both) == 2);
+            },
+            [](osf::error) { CHECK(false); });
+    }
+    //freed on destruction
+    CHECK(alloc(h, 8, both) == 4);
+    CHECK(alloc(h, 0, both) == LIBUSB_ERROR_INVALID_PARAM);
+}
+
+TEST_CASE(bulk_streams, unsupported)
+{
+    sim::backend bus;
+    bus.add_device(stream_device(0));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    CHECK(alloc(h, 4, both) == LIBUSB_ERROR_INVALID_PARAM);
+}
+
+TEST_CASE(bulk_streams, pipes)
+{
+    sim::backend bus;
+    bus.add_device(stream_device(4));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    auto r = h.alloc_streams(4, both);
+    r(
+        [&](bulk_streams &streams) {
+            //stream 1 gets no data and must not hold up stream 2 on the same endpoint
+            bulk_in_pipe idle(h, endpoint_address(0x81), 1, 2, 512);
+            bulk_in_pipe in(h, endpoint_address(0x81), 2, 2, 512);
+            bulk_out_pipe out(h, endpoint_address(0x01), 2, 2, 512);
+            std::size_t idle_received = 0;
+            std::vector<unsigned char> received;
+            idle.set_callback([&](const unsigned char *begin, const unsigned char *end) { idle_received += static_cast<std::size_t>(end - begin); });
+            in.set_callback([&](const unsigned char *begin, const unsigned char *end) { received.insert(received.end(), begin, end); });
+            CHECK(idle.start() == 0);
+            CHECK(in.start() == 0);
+            std::vector<unsigned char> data(3000);
+            for (std::size_t i = 0; i < data.size(); ++i)
+            {
+                data[i] = static_cast<unsigned char>(i);
+            }
+            //write only takes what fits into the free transfers
+            const unsigned char *next = data.data();
+            while (received.size() < data.size())
+            {
+                next += out.write(next, data.data() + data.size());
+                out.flush();
+                handle_events(ctx);
+            }
+            CHECK(received == data);
+            CHECK(idle_received == 0);
+            //a stream which was not allocated
+            auto t = h.async_bulk_stream_transfer(endpoint_address(0x01), 9);
+            CHECK(t.get_stream_id() == 9);
+            CHECK(t.submit() != 0);
+            idle.stop();
+            in.stop();
+            while (idle.in_flight() != 0 || in.in_flight() != 0 || out.in_flight() != 0)
+            {
+                handle_events(ctx);
+            }
+            CHECK(streams.free() == 0);
+        },
+        [](osf::error) { CHECK(false); });
+    CHECK(bus.allocated_transfers() == 0);
+}
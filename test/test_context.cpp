@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <chrono>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+TEST_CASE(context, wrap_sys_device)
+{
+    sim::backend bus;
+    auto id = bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    bus.add_device(sim::loopback_device(0x1234, 0x5679));
+    int fd = bus.open_sys_device(id);
+    CHECK(fd >= 0);
+    {
+        context ctx{bus, device_discovery::disabled};
+        CHECK(static_cast<bool>(ctx));
+        //nothing is enumerated
+        auto list = ctx.get_device_list();
+        CHECK(list.begin() == list.end());
+        ctx.wrap_sys_device(fd)(
+            [](device_handle &h) {
+                h.get_device().get_device_descriptor()([](const libusb_device_descriptor &d) { CHECK(d.idProduct == 0x5678); }, [](osf::error) { CHECK(false); });
+                CHECK(h.claim(0) == 0);
+                unsigned char out[64];
+                std::fill(out, out + sizeof(out), 0x5a);
+                unsigned char in[64] = {};
+                h.bulk_transfer(endpoint_address(0x01), out, out + sizeof(out), std::chrono::milliseconds(100))([](unsigned char *) {}, [](osf::error) { CHECK(false); });
+                h.bulk_transfer(endpoint_address(0x81), in, in + sizeof(in), std::chrono::milliseconds(100))(
+                    [&](unsigned char *end) { CHECK(end == in + sizeof(in) && std::equal(in, end, out)); },
+                    [](osf::error) { CHECK(false); });
+            },
+            [](osf::error) { CHECK(false); });
+        //a descriptor which does not stand for a device
+        ctx.wrap_sys_device(fd + 1000)([](device_handle &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NOT_FOUND); });
+    }
+    bus.close_sys_device(fd);
+    CHECK(bus.open_handles() == 0);
+}
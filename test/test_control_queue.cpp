@@ -0,0 +1,182 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <vector>
+#include <osf/libusbcpp/control_queue.hpp>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//a device with 256 registers of 4 bytes, request 1 writes register wValue and request 2 reads it
+sim::device_config register_device(std::shared_ptr<std::array<std::uint32_t, 256>> regs, std::shared_ptr<bool> in_order)
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    auto last = std::make_shared<int>(-1);
+    cfg.control = [=](const libusb_control_setup &s, unsigned char *data) -> int {
+        if (s.wValue >= regs->size() || s.wLength != 4)
+        {
+            return LIBUSB_ERROR_PIPE;
+        }
+        if (s.bRequest == 1 && !(s.bmRequestType & LIBUSB_ENDPOINT_IN))
+        {
+            *in_order = *in_order && s.wValue == *last + 1;
+            *last = s.wValue;
+            std::memcpy(&(*regs)[s.wValue], data, 4);
+            return 4;
+        }
+        if (s.bRequest == 2 && (s.bmRequestType & LIBUSB_ENDPOINT_IN))
+        {
+            std::memcpy(data, &(*regs)[s.wValue], 4);
+            return 4;
+        }
+        return LIBUSB_ERROR_PIPE;
+    };
+    return cfg;
+}
+} // namespace
+
+TEST_CASE(control_queue, in_order)
+{
+    auto regs = std::make_shared<std::array<std::uint32_t, 256>>();
+    auto in_order = std::make_shared<bool>(true);
+    sim::backend bus;
+    auto cfg = register_device(regs, in_order);
+    cfg.control_latency = std::chrono::microseconds(100);
+    bus.add_device(cfg);
+    context ctx{bus};
+    CHECK(ctx.start_event_thread() == 0);
+    auto h = test::open_first(ctx);
+    {
+        control_queue q{h, 8};
+        CHECK(static_cast<bool>(q));
+        std::future<control_queue::write_result> last;
+        for (std::uint16_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t v = i * 3u;
+            last = q.write(0x40, 1, i, 0, reinterpret_cast<unsigned char *>(&v), reinterpret_cast<unsigned char *>(&v) + 4);
+        }
+        last.get()([](std::size_t n) { CHECK(n == 4); }, [](osf::error) { CHECK(false); });
+        CHECK(*in_order);
+        CHECK((*regs)[255] == 255 * 3u);
+        q.read(0x40, 2, 7, 0, 4).get()(
+            [](std::vector<unsigned char> &d) {
+                std::uint32_t v = 0;
+                CHECK(d.size() == 4);
+                std::memcpy(&v, d.data(), 4);
+                CHECK(v == 21);
+            },
+            [](osf::error) { CHECK(false); });
+        q.read(0x40, 9, 0, 0, 4).get()([](std::vector<unsigned char> &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_PIPE); });
+    }
+    ctx.stop_event_thread();
+}
+
+TEST_CASE(control_queue, too_long)
+{
+    sim::backend bus;
+    bus.add_device(register_device(std::make_shared<std::array<std::uint32_t, 256>>(), std::make_shared<bool>(true)));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    std::vector<unsigned char> big(0x10000);
+    control_queue q{h};
+    //the length does not fit into wLength, nothing must be copied or submitted
+    auto f = q.write(0x40, 1, 0, 0, big.data(), big.data() + big.size());
+    CHECK(f.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    f.get()([](std::size_t) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_INVALID_PARAM); });
+    CHECK(q.in_flight() == 0);
+    h.control_transfer(0x40, 1, 0, 0, big.data(), big.data() + big.size(), std::chrono::milliseconds(100))(
+        [](unsigned char *) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_INVALID_PARAM); });
+}
+
+TEST_CASE(control_queue, destroyed_while_busy)
+{
+    sim::backend bus;
+    auto cfg = register_device(std::make_shared<std::array<std::uint32_t, 256>>(), std::make_shared<bool>(true));
+    cfg.control_latency = std::chrono::milliseconds(5);
+    bus.add_device(cfg);
+    context ctx{bus};
+    CHECK(ctx.start_event_thread() == 0);
+    auto h = test::open_first(ctx);
+    std::vector<std::future<control_queue::write_result>> results;
+    {
+        control_queue q{h, 4};
+        std::uint32_t v = 0;
+        for (std::uint16_t i = 0; i < 16; ++i)
+        {
+            results.push_back(q.write(0x40, 1, i, 0, reinterpret_cast<unsigned char *>(&v), reinterpret_cast<unsigned char *>(&v) + 4));
+        }
+        CHECK(q.in_flight() == 4);
+        //the destructor waits until the event thread handed back every transfer
+    }
+    CHECK(bus.allocated_transfers() == 0);
+    for (auto &r : results)
+    {
+        CHECK(r.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    }
+    ctx.stop_event_thread();
+}
+
+TEST_CASE(control_queue, bus_time)
+{
+    sim::backend bus;
+    auto cfg = register_device(std::make_shared<std::array<std::uint32_t, 256>>(), std::make_shared<bool>(true));
+    //12 bytes of every request take 64us at low speed, which queuing can not hide
+    cfg.speed = LIBUSB_SPEED_LOW;
+    bus.add_device(cfg);
+    context ctx{bus};
+    CHECK(ctx.start_event_thread() == 0);
+    auto h = test::open_first(ctx);
+    {
+        control_queue q{h, 16};
+        auto started = std::chrono::steady_clock::now();
+        std::future<control_queue::write_result> last;
+        std::uint32_t v = 0;
+        for (std::uint16_t i = 0; i < 32; ++i)
+        {
+            last = q.write(0x40, 1, i, 0, reinterpret_cast<unsigned char *>(&v), reinterpret_cast<unsigned char *>(&v) + 4);
+        }
+        last.wait();
+        CHECK(std::chrono::steady_clock::now() - started >= std::chrono::microseconds(32 * 64));
+    }
+    ctx.stop_event_thread();
+}
+
+TEST_CASE(control_queue, unplugged)
+{
+    sim::backend bus;
+    auto cfg = register_device(std::make_shared<std::array<std::uint32_t, 256>>(), std::make_shared<bool>(true));
+    cfg.control_latency = std::chrono::milliseconds(5);
+    auto id = bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    control_queue q{h, 2};
+    std::vector<std::future<control_queue::write_result>> results;
+    std::uint32_t v = 0;
+    for (std::uint16_t i = 0; i < 6; ++i)
+    {
+        results.push_back(q.write(0x40, 1, i, 0, reinterpret_cast<unsigned char *>(&v), reinterpret_cast<unsigned char *>(&v) + 4));
+    }
+    bus.remove_device(id);
+    while (q.in_flight() != 0)
+    {
+        handle_events(ctx, std::chrono::milliseconds(10));
+    }
+    //the requests which were still waiting fail instead of waiting forever
+    CHECK(q.queued() == 0);
+    bool ready = true;
+    for (auto &r : results)
+    {
+        ready = ready && r.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    CHECK(ready);
+    if (!ready)
+    {
+        q.cancel();
+        return;
+    }
+    results.back().get()([](std::size_t) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NO_DEVICE); });
+}
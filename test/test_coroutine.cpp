@@ -0,0 +1,203 @@
+#include <osf/libusbcpp/coroutine.hpp>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+//built as its own C++20 executable, see CMakeLists.txt
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+//a coroutine which starts right away and is not awaited by anyone
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend()
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+//resumes the coroutines later on the test thread instead of on the thread which handles the events
+struct queued_executor
+{
+    std::deque<std::coroutine_handle<>> *queue;
+
+    void post(std::coroutine_handle<> h) const
+    {
+        queue->push_back(h);
+    }
+};
+
+task round_trip(transfer_pool &pool, int count, int &done, int &errors)
+{
+    unsigned char out[512];
+    unsigned char in[512];
+    for (int i = 0; i < count; ++i)
+    {
+        std::memset(out, i, sizeof(out));
+        auto w = co_await async_write(pool, endpoint_address(0x01), out, out + sizeof(out), 1000ms);
+        w([&](unsigned char *end) { CHECK(end == out + sizeof(out)); }, [&](osf::error) { ++errors; });
+        auto r = co_await async_read(pool, endpoint_address(0x81), in, in + sizeof(in), 1000ms);
+        r([&](unsigned char *end) { CHECK(end == in + sizeof(in) && std::memcmp(in, out, sizeof(in)) == 0); }, [&](osf::error) { ++errors; });
+    }
+    ++done;
+}
+
+task read_once(transfer_pool &pool, std::chrono::milliseconds timeout, queued_executor ex, int &result)
+{
+    unsigned char in[64];
+    auto r = co_await async_read(pool, endpoint_address(0x81), in, in + sizeof(in), timeout, ex);
+    result = r([](unsigned char *) { return 0; }, [](osf::error e) { return static_cast<int>(e); });
+}
+
+task read_descriptor(transfer_pool &pool, int &length, int &vendor_id)
+{
+    unsigned char buffer[LIBUSB_CONTROL_SETUP_SIZE + LIBUSB_DT_DEVICE_SIZE];
+    auto r = co_await async_control(pool, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_DEVICE << 8, 0, buffer, buffer + sizeof(buffer), 100ms);
+    length = r([&](unsigned char *end) { return static_cast<int>(end - buffer - LIBUSB_CONTROL_SETUP_SIZE); }, [](osf::error e) { return static_cast<int>(e); });
+    vendor_id = buffer[LIBUSB_CONTROL_SETUP_SIZE + 8] | buffer[LIBUSB_CONTROL_SETUP_SIZE + 9] << 8;
+}
+
+task control_without_setup(transfer_pool &pool, int &result)
+{
+    unsigned char buffer[4];
+    auto r = co_await async_control(pool, LIBUSB_ENDPOINT_IN, LIBUSB_REQUEST_GET_STATUS, 0, 0, buffer, buffer + sizeof(buffer), 100ms);
+    result = r([](unsigned char *) { return 0; }, [](osf::error e) { return static_cast<int>(e); });
+}
+
+//handles the events and resumes the queued coroutines until result was set
+void run(context &ctx, std::deque<std::coroutine_handle<>> &queue, const int &result)
+{
+    while (result == 1)
+    {
+        handle_events(ctx, 10ms);
+        while (!queue.empty())
+        {
+            auto h = queue.front();
+            queue.pop_front();
+            h.resume();
+        }
+    }
+}
+} // namespace
+
+TEST_CASE(coroutine, round_trip)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 4);
+    int done = 0;
+    int errors = 0;
+    round_trip(pool, 100, done, errors);
+    round_trip(pool, 100, done, errors);
+    while (done < 2)
+    {
+        handle_events(ctx);
+    }
+    CHECK(errors == 0);
+    CHECK(pool.get_available() == 4);
+}
+
+TEST_CASE(coroutine, timeout)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 1);
+    std::deque<std::coroutine_handle<>> queue;
+    //nothing was written to the loopback, so the read times out
+    int result = 1;
+    read_once(pool, 5ms, queued_executor{&queue}, result);
+    CHECK(result == 1);
+    run(ctx, queue, result);
+    CHECK(result == LIBUSB_ERROR_TIMEOUT);
+    CHECK(pool.get_available() == 1);
+}
+
+TEST_CASE(coroutine, exhausted_pool)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 1);
+    std::deque<std::coroutine_handle<>> queue;
+    int first = 1;
+    int second = 1;
+    read_once(pool, 20ms, queued_executor{&queue}, first);
+    //the only transfer is in flight, so the second read completes without suspending
+    read_once(pool, 20ms, queued_executor{&queue}, second);
+    CHECK(second == LIBUSB_ERROR_NO_MEM);
+    run(ctx, queue, first);
+    CHECK(first == LIBUSB_ERROR_TIMEOUT);
+    CHECK(pool.get_available() == 1);
+}
+
+TEST_CASE(coroutine, control)
+{
+    sim::backend bus;
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    cfg.control = [](const libusb_control_setup &s, unsigned char *data) -> int {
+        if (s.bRequest != LIBUSB_REQUEST_GET_DESCRIPTOR || s.wValue != LIBUSB_DT_DEVICE << 8)
+        {
+            return LIBUSB_ERROR_PIPE;
+        }
+        std::memset(data, 0, LIBUSB_DT_DEVICE_SIZE);
+        data[0] = LIBUSB_DT_DEVICE_SIZE;
+        data[1] = LIBUSB_DT_DEVICE;
+        data[8] = 0x34;
+        data[9] = 0x12;
+        return LIBUSB_DT_DEVICE_SIZE;
+    };
+    bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 1);
+    int length = 1;
+    int vendor_id = 0;
+    read_descriptor(pool, length, vendor_id);
+    while (length == 1)
+    {
+        handle_events(ctx);
+    }
+    CHECK(length == LIBUSB_DT_DEVICE_SIZE);
+    CHECK(vendor_id == 0x1234);
+    //without room for the setup packet nothing is submitted
+    int result = 1;
+    control_without_setup(pool, result);
+    CHECK(result == LIBUSB_ERROR_INVALID_PARAM);
+}
+#else
+//the compiler lacks coroutines, so there is nothing to test
+TEST_CASE(coroutine, unsupported)
+{
+}
+#endif
@@ -0,0 +1,96 @@
+#include <optional>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+sim::endpoint_config endpoint(unsigned char address, libusb_endpoint_transfer_type type, std::uint16_t max_packet_size)
+{
+    sim::endpoint_config ep{};
+    ep.address = address;
+    ep.type = type;
+    ep.max_packet_size = max_packet_size;
+    return ep;
+}
+
+//interface 0 of loopback_device plus interface 1 with an interrupt endpoint
+//and alternate setting 1 of interface 1 with two isochronous endpoints instead
+std::optional<descriptor_index> build_index(sim::backend &bus, context &ctx)
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    sim::interface_config intf{};
+    intf.number = 1;
+    intf.endpoints = {endpoint(0x83, LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT, 64)};
+    cfg.interfaces.push_back(intf);
+    intf.alternate_setting = 1;
+    intf.interface_class = LIBUSB_CLASS_HID;
+    intf.endpoints = {endpoint(0x84, LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS, 1024), endpoint(0x85, LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS, 512)};
+    cfg.interfaces.push_back(intf);
+    bus.add_device(cfg);
+    std::optional<descriptor_index> index;
+    for (auto d : ctx.get_device_list())
+    {
+        d.get_active_config_descriptor()([&](config_descriptor &c) { index.emplace(c); }, [](osf::error) { CHECK(false); });
+    }
+    return index;
+}
+
+int address_of(osf::sum_type<endpoint_info, osf::error> r)
+{
+    return r([](endpoint_info &ep) { return static_cast<int>(ep.address); }, [](osf::error e) { return static_cast<int>(e); });
+}
+} // namespace
+
+TEST_CASE(descriptor_index, layout)
+{
+    sim::backend bus;
+    context ctx{bus};
+    auto index = build_index(bus, ctx);
+    CHECK(index.has_value());
+    CHECK(index->interface_count() == 2);
+    CHECK(index->altsetting_count() == 3);
+    CHECK(index->endpoint_count() == 5);
+    //the endpoints of an alternate setting are adjacent
+    CHECK(index->get_altsetting(2).endpoint_count == 2);
+    CHECK(index->get_endpoint(index->first_endpoint_of(2)).address == 0x84);
+    CHECK(index->get_endpoint(index->first_endpoint_of(2) + 1).address == 0x85);
+    index->find_altsetting(1, 1)([](altsetting_info &a) { CHECK(a.interface_class == LIBUSB_CLASS_HID && a.endpoint_count == 2); }, [](osf::error) { CHECK(false); });
+    index->find_altsetting(1, 2)([](altsetting_info &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NOT_FOUND); });
+}
+
+TEST_CASE(descriptor_index, by_kind)
+{
+    sim::backend bus;
+    context ctx{bus};
+    auto index = build_index(bus, ctx);
+    CHECK(address_of(index->find_endpoint(0, LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK, LIBUSB_ENDPOINT_IN)) == 0x81);
+    CHECK(address_of(index->find_endpoint(0, LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK, LIBUSB_ENDPOINT_OUT)) == 0x01);
+    CHECK(address_of(index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT, LIBUSB_ENDPOINT_IN)) == 0x83);
+    //the first endpoint of the kind wins
+    CHECK(address_of(index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS, LIBUSB_ENDPOINT_IN, 1)) == 0x84);
+    index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS, LIBUSB_ENDPOINT_IN, 1)(
+        [](endpoint_info &ep) {
+            CHECK(ep.get_type() == LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS && ep.is_in());
+            CHECK(ep.max_packet_size == 1024 && ep.interface_number == 1 && ep.alternate_setting == 1);
+        },
+        [](osf::error) { CHECK(false); });
+    //misses: the kind only exists in another alternate setting, an unknown setting or interface
+    CHECK(address_of(index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS, LIBUSB_ENDPOINT_IN)) == LIBUSB_ERROR_NOT_FOUND);
+    CHECK(address_of(index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT, LIBUSB_ENDPOINT_OUT)) == LIBUSB_ERROR_NOT_FOUND);
+    CHECK(address_of(index->find_endpoint(1, LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT, LIBUSB_ENDPOINT_IN, 3)) == LIBUSB_ERROR_NOT_FOUND);
+    CHECK(address_of(index->find_endpoint(5, LIBUSB_ENDPOINT_TRANSFER_TYPE_BULK, LIBUSB_ENDPOINT_IN)) == LIBUSB_ERROR_NOT_FOUND);
+}
+
+TEST_CASE(descriptor_index, by_address)
+{
+    sim::backend bus;
+    context ctx{bus};
+    auto index = build_index(bus, ctx);
+    CHECK(address_of(index->find_endpoint(endpoint_address(0x81))) == 0x81);
+    CHECK(address_of(index->find_endpoint(endpoint_address(0x01))) == 0x01);
+    index->find_endpoint(endpoint_address(0x83))([](endpoint_info &ep) { CHECK(ep.interface_number == 1 && ep.alternate_setting == 0); }, [](osf::error) { CHECK(false); });
+    //only the default alternate settings are indexed by address, and the direction counts
+    CHECK(address_of(index->find_endpoint(endpoint_address(0x84))) == LIBUSB_ERROR_NOT_FOUND);
+    CHECK(address_of(index->find_endpoint(endpoint_address(0x03))) == LIBUSB_ERROR_NOT_FOUND);
+}
@@ -0,0 +1,44 @@
+#include <stdexcept>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+constexpr auto supported = make_static_device_match_table([] {
+    return std::array{
+        device_id{0x1234, 0x0001, 0},
+        device_id{0x1234, 0x0002, 1},
+        device_id{0x5678, 0x0001},
+    };
+});
+static_assert(supported.size() == 3);
+static_assert(supported.contains(0x1234, 0x0002));
+static_assert(!supported.contains(0x1234, 0x0003));
+static_assert(supported.find(0x1234, 0x0002)->interface_number == 1);
+} // namespace
+
+TEST_CASE(device_match_table, open_if)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x0002));
+    bus.add_device(sim::loopback_device(0x1234, 0x0009));
+    bus.add_device(sim::loopback_device(0x5678, 0x0001));
+    context ctx{bus};
+    CHECK(open_if(ctx, supported).size() == 2);
+}
+
+TEST_CASE(device_match_table, runtime_errors)
+{
+    bool thrown = false;
+    try
+    {
+        auto table = make_device_match_table({device_id{1, 2}, device_id{1, 2}});
+        (void)table;
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
@@ -0,0 +1,120 @@
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//five devices of vendor 1 behind hub port 1 of bus 2, the device at port i has product 10 + i
+void add_hub(sim::backend &bus)
+{
+    for (std::uint8_t i = 1; i <= 5; ++i)
+    {
+        auto cfg = sim::loopback_device(1, static_cast<std::uint16_t>(10 + i));
+        cfg.bus_number = 2;
+        cfg.device_address = i;
+        cfg.port_numbers = {1, i};
+        bus.add_device(cfg);
+    }
+}
+
+int product_id(device_handle &h)
+{
+    return h.get_device().get_device_descriptor()([](const libusb_device_descriptor &d) { return static_cast<int>(d.idProduct); }, [](osf::error) { return -1; });
+}
+} // namespace
+
+TEST_CASE(device_query, where)
+{
+    sim::backend bus;
+    add_hub(bus);
+    auto hid = sim::loopback_device(2, 1);
+    hid.interfaces[0].interface_class = LIBUSB_CLASS_HID;
+    bus.add_device(hid);
+    context ctx{bus};
+    int seen = 0;
+    int matched = 0;
+    auto q = device_query<>{ctx.get_device_list()}
+                 .where([&](const device_probe &) { ++seen; return true; })
+                 .where(match_vid_pid{1, 13})
+                 .where([&](const device_probe &) { ++matched; return true; });
+    int n = 0;
+    for (auto &p : q)
+    {
+        CHECK(p.descriptor()->idProduct == 13);
+        ++n;
+    }
+    CHECK(n == 1);
+    CHECK(seen == 6);
+    //later filters only see the devices the earlier ones accepted
+    CHECK(matched == 1);
+    n = 0;
+    for (auto &p : device_query<>{ctx.get_device_list()}.where(match_class{LIBUSB_CLASS_HID}))
+    {
+        CHECK(p.descriptor()->idVendor == 2);
+        ++n;
+    }
+    CHECK(n == 1);
+}
+
+TEST_CASE(device_query, lazy)
+{
+    sim::backend bus;
+    add_hub(bus);
+    context ctx{bus};
+    int seen = 0;
+    auto q = device_query<>{ctx.get_device_list()}.where([&](const device_probe &) { ++seen; return true; }).where(match_vid_pid{1, 12});
+    q.first()([](device &d) { CHECK(d.get_device_address() == 2); }, [](osf::error) { CHECK(false); });
+    //the devices after the first match are not looked at
+    CHECK(seen == 2);
+    //the descriptor is read on first use and kept
+    for (auto &p : q)
+    {
+        const auto *d = p.descriptor();
+        CHECK(d != nullptr && d == p.descriptor());
+        p.get_device_descriptor()([](const libusb_device_descriptor &desc) { CHECK(desc.idProduct == 12); }, [](osf::error) { CHECK(false); });
+    }
+}
+
+TEST_CASE(device_query, port_path)
+{
+    sim::backend bus;
+    add_hub(bus);
+    context ctx{bus};
+    device_query<>{ctx.get_device_list()}.where(match_port_path{2, {1, 4}}).open_first()(
+        [](device_handle &h) { CHECK(product_id(h) == 14); },
+        [](osf::error) { CHECK(false); });
+    //a prefix of the path or another bus is no match
+    auto prefix = device_query<>{ctx.get_device_list()}.where(match_port_path{2, {1}});
+    CHECK(prefix.begin() == prefix.end());
+    auto other_bus = device_query<>{ctx.get_device_list()}.where(match_port_path{1, {1, 4}});
+    CHECK(other_bus.begin() == other_bus.end());
+}
+
+TEST_CASE(device_query, no_match)
+{
+    sim::backend bus;
+    add_hub(bus);
+    context ctx{bus};
+    auto q = device_query<>{ctx.get_device_list()}.where(match_vid_pid{9, 9});
+    CHECK(q.begin() == q.end());
+    q.first()([](device &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NOT_FOUND); });
+    q.open_first()([](device_handle &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NOT_FOUND); });
+}
+
+TEST_CASE(device_query, open_first)
+{
+    sim::backend bus;
+    auto gone = bus.add_device(sim::loopback_device(3, 1));
+    auto gone_too = bus.add_device(sim::loopback_device(3, 2));
+    bus.add_device(sim::loopback_device(3, 3));
+    context ctx{bus};
+    device_query<> q{ctx.get_device_list()};
+    bus.remove_device(gone);
+    bus.remove_device(gone_too);
+    //the matches which do not open are skipped
+    q.open_first()([](device_handle &h) { CHECK(product_id(h) == 3); }, [](osf::error) { CHECK(false); });
+    //and the error of the last one is passed on
+    auto r = std::move(q).where([](const device_probe &p) { return p.descriptor()->idProduct != 3; }).open_first();
+    r([](device_handle &) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NO_DEVICE); });
+    CHECK(bus.open_handles() == 0);
+}
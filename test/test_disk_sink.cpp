@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <osf/libusbcpp/disk_sink.hpp>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//streams size bytes of counting_source into files of file_size bytes and checks them
+void capture(disk_sink_method method, std::size_t transfer_size, std::uint64_t file_size, std::size_t size)
+{
+    sim::backend bus;
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    cfg.interfaces[0].endpoints.push_back(test::counting_source(0x82));
+    bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    std::vector<std::pair<std::string, std::uint64_t>> files;
+    disk_sink sink{"disk_sink_test", file_size, 16};
+    sink.set_method(method);
+    sink.set_file_callback([&](const std::string &path, std::uint64_t length) { files.emplace_back(path, length); });
+    bulk_in_pipe pipe(h, endpoint_address(0x82), 8, transfer_size);
+    sink.attach(pipe);
+    CHECK(sink.start() == 0);
+    CHECK(pipe.start() == 0);
+    while (sink.get_stats().buffers * transfer_size < size)
+    {
+        handle_events(ctx);
+    }
+    pipe.stop();
+    while (pipe.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    sink.stop();
+    auto stats = sink.get_stats();
+    CHECK(sink.get_error() == 0);
+    CHECK(files.size() == stats.files);
+    test::counting_check check;
+    for (auto &f : files)
+    {
+        std::ifstream in{f.first, std::ios::binary};
+        std::vector<unsigned char> data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        CHECK(data.size() == f.second);
+        check(data.data(), data.data() + data.size());
+        std::remove(f.first.c_str());
+    }
+    CHECK(check.received == stats.bytes);
+    if (stats.dropped_bytes == 0)
+    {
+        CHECK(check.in_order);
+    }
+}
+} // namespace
+
+TEST_CASE(disk_sink, io_uring)
+{
+    capture(disk_sink_method::io_uring, 65536, 0, 4 << 20);
+    //unaligned buffers go through the staging chunks
+    capture(disk_sink_method::io_uring, 5000, 1 << 20, 4 << 20);
+}
+
+TEST_CASE(disk_sink, mmap)
+{
+    capture(disk_sink_method::mmap, 65536, 1 << 20, 4 << 20);
+}
@@ -0,0 +1,133 @@
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+sim::device_config source_device()
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    auto src = test::counting_source(0x82);
+    src.latency = std::chrono::microseconds(200);
+    cfg.interfaces[0].endpoints.push_back(src);
+    return cfg;
+}
+
+//waits on the pollfds of the context like an external event loop would, then handles what is ready
+void poll_once(context &ctx)
+{
+    std::vector<pollfd> fds;
+    for (auto &p : ctx.get_pollfds())
+    {
+        fds.push_back(pollfd{p.fd, p.events, 0});
+    }
+    int wait_ms = -1;
+    std::chrono::microseconds next{0};
+    if (!ctx.pollfds_handle_timeouts() && ctx.get_next_timeout(next) == 1)
+    {
+        wait_ms = static_cast<int>((next.count() + 999) / 1000);
+    }
+    ::poll(fds.data(), fds.size(), wait_ms);
+    handle_events(ctx, std::chrono::microseconds(0));
+}
+} // namespace
+
+TEST_CASE(event_loop, event_thread)
+{
+    sim::backend bus;
+    bus.add_device(source_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    CHECK(!ctx.has_event_thread());
+    CHECK(ctx.start_event_thread() == 0);
+    CHECK(ctx.start_event_thread() == LIBUSB_ERROR_BUSY);
+    CHECK(ctx.has_event_thread());
+    {
+        bulk_in_pipe pipe(h, endpoint_address(0x82), 4, 4096);
+        std::atomic<std::size_t> received{0};
+        std::atomic<bool> on_event_thread{true};
+        auto test_thread = std::this_thread::get_id();
+        pipe.set_callback([&](const unsigned char *begin, const unsigned char *end) {
+            on_event_thread = on_event_thread && std::this_thread::get_id() != test_thread;
+            received += static_cast<std::size_t>(end - begin);
+        });
+        CHECK(pipe.start() == 0);
+        while (received < (1u << 20))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pipe.stop();
+        while (pipe.in_flight() != 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(on_event_thread);
+    }
+    //the thread is woken up instead of waiting out its timeout
+    auto started = std::chrono::steady_clock::now();
+    ctx.stop_event_thread();
+    CHECK(std::chrono::steady_clock::now() - started < std::chrono::milliseconds(500));
+    CHECK(!ctx.has_event_thread());
+    ctx.stop_event_thread();
+    CHECK(ctx.start_event_thread() == 0);
+    ctx.stop_event_thread();
+    CHECK(bus.allocated_transfers() == 0);
+}
+
+TEST_CASE(event_loop, pollfds)
+{
+    sim::backend bus;
+    bus.add_device(source_device());
+    {
+        context ctx{bus};
+        int added = 0;
+        int removed = 0;
+        ctx.set_pollfd_notifiers([&](int, short) { ++added; }, [&](int) { ++removed; });
+        auto h = test::open_first(ctx);
+        auto fds = ctx.get_pollfds();
+        CHECK(!fds.empty());
+        for (auto &p : fds)
+        {
+            CHECK(p.fd >= 0 && (p.events & POLLIN) != 0);
+        }
+        bulk_in_pipe pipe(h, endpoint_address(0x82), 4, 4096);
+        test::counting_check check;
+        pipe.set_callback([&](const unsigned char *begin, const unsigned char *end) { check(begin, end); });
+        CHECK(pipe.start() == 0);
+        while (check.received < (1u << 20))
+        {
+            poll_once(ctx);
+        }
+        pipe.stop();
+        while (pipe.in_flight() != 0)
+        {
+            poll_once(ctx);
+        }
+        CHECK(check.in_order);
+        //nothing was written to the loopback, so only the timeout completes the read,
+        //which the loop has to wake up for through get_next_timeout
+        int status = -1;
+        auto t = h.async_bulk_transfer(endpoint_address(0x81), [&](auto &done) { status = done.get_status(); });
+        unsigned char in[64];
+        t.set_buffer(in, in + sizeof(in));
+        t.set_timeout(std::chrono::milliseconds(20));
+        CHECK(t.submit() == 0);
+        std::chrono::microseconds next{0};
+        CHECK(ctx.get_next_timeout(next) == 1);
+        CHECK(next <= std::chrono::milliseconds(20));
+        while (status == -1)
+        {
+            poll_once(ctx);
+        }
+        CHECK(status == LIBUSB_TRANSFER_TIMED_OUT);
+        CHECK(ctx.get_next_timeout(next) == 0);
+        //the simulated bus keeps its single eventfd
+        CHECK(added == 0 && removed == 0);
+    }
+    CHECK(bus.open_handles() == 0);
+}
@@ -0,0 +1,110 @@
+#include <osf/libusbcpp/queue.hpp>
+#include <thread>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+using namespace std::chrono_literals;
+
+namespace
+{
+//a report of 8 bytes every millisecond, the first byte counts
+sim::device_config interrupt_device()
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    sim::endpoint_config ep{};
+    ep.address = 0x84;
+    ep.type = LIBUSB_ENDPOINT_TRANSFER_TYPE_INTERRUPT;
+    ep.max_packet_size = 16;
+    ep.interval = 4;
+    auto next = std::make_shared<unsigned char>(0);
+    ep.source = [next](unsigned char *data, int length) {
+        data[0] = (*next)++;
+        return std::min(length, 8);
+    };
+    cfg.interfaces[0].endpoints.push_back(ep);
+    return cfg;
+}
+
+void wait_idle(interrupt_poller &poller)
+{
+    while (poller.in_flight() != 0)
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+}
+} // namespace
+
+TEST_CASE(interrupt_poller, queue)
+{
+    sim::backend bus;
+    bus.add_device(interrupt_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    interrupt_poller poller(h, endpoint_address(0x84), 16);
+    CHECK(static_cast<bool>(poller));
+    spsc_queue<interrupt_event> q(64);
+    poller.set_queue(q);
+    CHECK(ctx.start_event_thread() == 0);
+    CHECK(poller.start() == 0);
+    unsigned char expected = 0;
+    bool in_order = true;
+    for (int n = 0; n < 50;)
+    {
+        if (auto e = q.try_pop())
+        {
+            in_order = in_order && e->size == 8 && e->data[0] == expected++;
+            ++n;
+        }
+        else
+        {
+            std::this_thread::sleep_for(100us);
+        }
+    }
+    poller.stop();
+    wait_idle(poller);
+    ctx.stop_event_thread();
+    CHECK(in_order);
+    CHECK(poller.get_overruns() == 0);
+    CHECK(poller.get_jitter().samples >= 49);
+}
+
+TEST_CASE(interrupt_poller, restart_does_not_count_the_pause)
+{
+    sim::backend bus;
+    bus.add_device(interrupt_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    interrupt_poller poller(h, endpoint_address(0x84), 16);
+    CHECK(ctx.start_event_thread() == 0);
+    CHECK(poller.start() == 0);
+    std::this_thread::sleep_for(20ms);
+    poller.stop();
+    wait_idle(poller);
+    std::this_thread::sleep_for(100ms);
+    CHECK(poller.start() == 0);
+    std::this_thread::sleep_for(20ms);
+    poller.stop();
+    wait_idle(poller);
+    ctx.stop_event_thread();
+    auto j = poller.get_jitter();
+    CHECK(j.samples > 0);
+    CHECK(j.max_interval < 100ms);
+}
+
+TEST_CASE(interrupt_poller, destroyed_while_running)
+{
+    sim::backend bus;
+    bus.add_device(interrupt_device());
+    {
+        context ctx{bus};
+        CHECK(ctx.start_event_thread() == 0);
+        auto h = test::open_first(ctx);
+        {
+            interrupt_poller poller(h, endpoint_address(0x84), 16, 4);
+            CHECK(poller.start() == 0);
+            std::this_thread::sleep_for(10ms);
+        }
+        CHECK(bus.allocated_transfers() == 0);
+    }
+    CHECK(bus.open_handles() == 0);
+}
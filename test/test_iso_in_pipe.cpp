@@ -0,0 +1,80 @@
+#include <atomic>
+#include <thread>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+using namespace std::chrono_literals;
+
+namespace
+{
+//high speed endpoint with two additional transactions per microframe
+sim::device_config iso_device()
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    auto iso = test::counting_source(0x83);
+    iso.type = LIBUSB_ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS;
+    iso.max_packet_size = 1024 | (2 << 11);
+    iso.interval = 1;
+    cfg.interfaces[0].endpoints.push_back(iso);
+    return cfg;
+}
+} // namespace
+
+TEST_CASE(iso_in_pipe, transfers_for)
+{
+    CHECK(iso_in_pipe::transfers_for(5ms, 8, 125us) == 6);
+    CHECK(iso_in_pipe::transfers_for(0ms, 8, 125us) == 2);
+    CHECK(iso_in_pipe::transfers_for(5ms, 8, 0us) == 2);
+}
+
+TEST_CASE(iso_in_pipe, streams_packets)
+{
+    sim::backend bus;
+    bus.add_device(iso_device());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    iso_in_pipe pipe(h, endpoint_address(0x83), iso_in_pipe::transfers_for(5ms, 8, 125us), 8);
+    CHECK(static_cast<bool>(pipe));
+    CHECK(pipe.get_packet_size() == 3 * 1024);
+    test::counting_check check;
+    std::atomic<std::size_t> packets{0};
+    pipe.set_callback([&](iso_packet_range r) {
+        for (auto p : r)
+        {
+            check(p.begin(), p.end());
+            ++packets;
+        }
+    });
+    CHECK(ctx.start_event_thread() == 0);
+    CHECK(pipe.start() == 0);
+    while (packets.load() < 800)
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+    pipe.stop();
+    while (pipe.in_flight() != 0)
+    {
+        std::this_thread::sleep_for(1ms);
+    }
+    ctx.stop_event_thread();
+    CHECK(check.in_order);
+    CHECK(pipe.get_packet_errors() == 0);
+}
+
+TEST_CASE(iso_in_pipe, destroyed_while_running)
+{
+    sim::backend bus;
+    bus.add_device(iso_device());
+    {
+        context ctx{bus};
+        CHECK(ctx.start_event_thread() == 0);
+        auto h = test::open_first(ctx);
+        {
+            iso_in_pipe pipe(h, endpoint_address(0x83), 4, 8);
+            CHECK(pipe.start() == 0);
+            std::this_thread::sleep_for(10ms);
+        }
+        CHECK(bus.allocated_transfers() == 0);
+    }
+    CHECK(bus.open_handles() == 0);
+}
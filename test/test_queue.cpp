@@ -0,0 +1,107 @@
+#include <osf/libusbcpp/queue.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+
+using namespace osf::libusbcpp;
+
+TEST_CASE(queue, spsc_capacity)
+{
+    spsc_queue<int> q(5);
+    CHECK(q.capacity() == 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        CHECK(q.try_push(i));
+    }
+    CHECK(!q.try_push(8));
+    CHECK(q.size() == 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        auto v = q.try_pop();
+        CHECK(v && *v == i);
+    }
+    CHECK(!q.try_pop());
+    //cells and mask, the consumers line and the producers line
+    CHECK(sizeof(spsc_queue<int>) == 3 * detail::cache_line);
+}
+
+TEST_CASE(queue, spsc_threads)
+{
+    spsc_queue<std::size_t> q(64);
+    constexpr std::size_t count = 100000;
+    std::thread producer([&] {
+        for (std::size_t i = 0; i < count;)
+        {
+            if (q.try_push(i))
+            {
+                ++i;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    bool in_order = true;
+    for (std::size_t i = 0; i < count;)
+    {
+        if (auto v = q.try_pop())
+        {
+            in_order = in_order && *v == i;
+            ++i;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(in_order);
+    CHECK(q.empty());
+}
+
+TEST_CASE(queue, mpmc_threads)
+{
+    mpmc_queue<std::size_t> q(64);
+    constexpr std::size_t per_producer = 50000;
+    std::atomic<std::size_t> sum{0};
+    std::atomic<std::size_t> popped{0};
+    std::vector<std::thread> threads;
+    for (int k = 0; k < 2; ++k)
+    {
+        threads.emplace_back([&] {
+            for (std::size_t i = 1; i <= per_producer;)
+            {
+                if (q.try_push(i))
+                {
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&] {
+            while (popped.load() < 2 * per_producer)
+            {
+                if (auto v = q.try_pop())
+                {
+                    sum += *v;
+                    ++popped;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    CHECK(sum.load() == 2 * (per_producer * (per_producer + 1) / 2));
+    CHECK(q.empty());
+}
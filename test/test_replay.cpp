@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <osf/libusbcpp/sim_replay.hpp>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//reads up to count transfers of 64 bytes from the IN endpoint, the first byte of each
+std::vector<int> read_all(device_handle &h, unsigned char ep, int count)
+{
+    std::vector<int> out;
+    for (int i = 0; i < count; ++i)
+    {
+        unsigned char in[64] = {};
+        h.bulk_transfer(endpoint_address(ep), in, in + 64, std::chrono::milliseconds(50))(
+            [&](unsigned char *end) { out.push_back(end == in ? -1 : in[0]); },
+            [&](osf::error e) { out.push_back(static_cast<int>(e)); });
+    }
+    return out;
+}
+} // namespace
+
+TEST_CASE(replay, script)
+{
+    auto script = std::make_shared<sim::replay_script>();
+    script->timing = sim::replay_timing::as_fast_as_possible;
+    script->completions.push_back(sim::replay_completion{std::chrono::nanoseconds(0), LIBUSB_TRANSFER_COMPLETED, 64, {7}});
+    script->completions.push_back(sim::replay_completion{std::chrono::nanoseconds(0), LIBUSB_TRANSFER_STALL, 0, {}});
+    script->completions.push_back(sim::replay_completion{std::chrono::nanoseconds(0), LIBUSB_TRANSFER_COMPLETED, 64, {9}});
+    sim::backend bus;
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    sim::endpoint_config ep{};
+    ep.address = 0x82;
+    ep.replay = script;
+    cfg.interfaces[0].endpoints.push_back(ep);
+    auto id = bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    //the played out script makes the transfers wait, so the last one times out
+    auto got = read_all(h, 0x82, 4);
+    CHECK((got == std::vector<int>{7, LIBUSB_ERROR_PIPE, 9, LIBUSB_ERROR_TIMEOUT}));
+    CHECK(bus.replayed(id, 0x82) == 3);
+    bus.restart_replay(id);
+    CHECK(read_all(h, 0x82, 1) == std::vector<int>{7});
+}
+
+TEST_CASE(replay, recorded_capture)
+{
+    const char *path = "replay_test.pcap";
+    {
+        sim::backend bus;
+        bus.add_device(sim::loopback_device(0x1234, 0x5678));
+        context ctx{bus};
+        auto h = test::open_first(ctx);
+        trace_recorder rec{1 << 16, 64};
+        CHECK(rec.start(path) == 0);
+        for (unsigned char i = 1; i <= 5; ++i)
+        {
+            unsigned char out[64];
+            std::fill(out, out + 64, i);
+            h.bulk_transfer(endpoint_address(0x01), out, out + 64, std::chrono::milliseconds(100))([](unsigned char *) {}, [](osf::error) { CHECK(false); });
+            CHECK(read_all(h, 0x81, 1) == std::vector<int>{i});
+        }
+        rec.stop();
+    }
+    sim::replay_trace trace;
+    sim::load_trace(path)([&](sim::replay_trace &t) { trace = std::move(t); }, [](osf::error) { CHECK(false); });
+    std::remove(path);
+    CHECK(trace.devices.size() == 1);
+    const auto *dev = trace.find(1, 1);
+    CHECK(dev != nullptr);
+    if (dev == nullptr)
+    {
+        return;
+    }
+    sim::backend bus;
+    auto cfg = sim::replay_device(*dev, sim::replay_timing::as_fast_as_possible);
+    cfg.vendor_id = 0x1234;
+    auto id = bus.add_device(cfg);
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    //nothing is written this time, the IN endpoint plays the recorded data back
+    CHECK((read_all(h, 0x81, 5) == std::vector<int>{1, 2, 3, 4, 5}));
+    CHECK(bus.replayed(id, 0x81) == 5);
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+using test::open_first;
+
+TEST_CASE(sim_backend, loopback_bulk)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    {
+        context ctx{bus};
+        auto h = open_first(ctx);
+        unsigned char out[1000];
+        for (int i = 0; i < 1000; ++i)
+        {
+            out[i] = static_cast<unsigned char>(i);
+        }
+        h.bulk_transfer(endpoint_address(0x01), out, out + 1000, std::chrono::milliseconds(100))([&](unsigned char *end) { CHECK(end == out + 1000); }, [](osf::error) { CHECK(false); });
+        unsigned char in[2000] = {};
+        h.bulk_transfer(endpoint_address(0x81), in, in + 2000, std::chrono::milliseconds(100))(
+            [&](unsigned char *end) {
+                CHECK(end == in + 1000);
+                CHECK(std::equal(in, in + 1000, out));
+            },
+            [](osf::error) { CHECK(false); });
+    }
+    CHECK(bus.open_handles() == 0);
+    CHECK(bus.allocated_transfers() == 0);
+}
+
+TEST_CASE(sim_backend, timeout)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = open_first(ctx);
+    //nothing was written, so the loopback endpoint has nothing to return
+    unsigned char in[64];
+    auto started = std::chrono::steady_clock::now();
+    h.bulk_transfer(endpoint_address(0x81), in, in + 64, std::chrono::milliseconds(20))([](unsigned char *) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_TIMEOUT); });
+    CHECK(std::chrono::steady_clock::now() - started >= std::chrono::milliseconds(20));
+}
+
+TEST_CASE(sim_backend, error_injection)
+{
+    sim::backend bus;
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    sim::endpoint_config src{};
+    src.address = 0x82;
+    src.errors.status = LIBUSB_TRANSFER_STALL;
+    src.errors.every_nth = 3;
+    cfg.interfaces[0].endpoints.push_back(src);
+    bus.add_device(cfg);
+    context ctx{bus};
+    auto h = open_first(ctx);
+    unsigned char in[64];
+    int completed = 0;
+    int stalled = 0;
+    for (int i = 0; i < 9; ++i)
+    {
+        h.bulk_transfer(endpoint_address(0x82), in, in + 64, std::chrono::milliseconds(100))([&](unsigned char *) { ++completed; }, [&](osf::error e) {
+            CHECK(static_cast<int>(e) == LIBUSB_ERROR_PIPE);
+            ++stalled;
+        });
+    }
+    CHECK(completed == 6);
+    CHECK(stalled == 3);
+}
+
+TEST_CASE(sim_backend, unplug)
+{
+    sim::backend bus;
+    auto id = bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = open_first(ctx);
+    bus.remove_device(id);
+    unsigned char out[64] = {};
+    h.bulk_transfer(endpoint_address(0x01), out, out + 64, std::chrono::milliseconds(100))([](unsigned char *) { CHECK(false); }, [](osf::error e) { CHECK(static_cast<int>(e) == LIBUSB_ERROR_NO_DEVICE); });
+    CHECK(open_if(ctx, [](const libusb_device_descriptor &) { return true; }).empty());
+}
+
+TEST_CASE(sim_backend, hotplug)
+{
+    sim::backend bus;
+    context ctx{bus};
+    CHECK(ctx.enable_device_registry() == 0);
+    const auto *registry = ctx.get_device_registry();
+    CHECK(registry->size() == 0);
+    auto id = bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    handle_events(ctx, std::chrono::milliseconds(100));
+    CHECK(registry->size() == 1);
+    auto handles = registry->open_if([](const libusb_device_descriptor &d) { return d.idVendor == 0x1234; });
+    CHECK(handles.size() == 1);
+    bus.remove_device(id);
+    handle_events(ctx, std::chrono::milliseconds(100));
+    CHECK(registry->size() == 0);
+}
+
+TEST_CASE(sim_backend, discovery_per_context)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    auto any = [](const libusb_device_descriptor &) { return true; };
+    context hidden{bus, device_discovery::disabled};
+    CHECK(hidden);
+    CHECK(open_if(hidden, any).empty());
+    //disabling the discovery of one context must not leak into the next one
+    context visible{bus};
+    CHECK(open_if(visible, any).size() == 1);
+}
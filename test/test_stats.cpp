@@ -0,0 +1,42 @@
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+#ifdef OSF_LIBUSBCPP_ENABLE_STATS
+TEST_CASE(stats, in_flight)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    int done = 0;
+    auto write = h.async_bulk_transfer(endpoint_address(0x01), [&](auto &) { ++done; });
+    unsigned char out[64] = {};
+    write.set_buffer(out, out + 64);
+    CHECK(write.submit() == 0);
+    while (done == 0)
+    {
+        handle_events(ctx);
+    }
+    auto s = h.get_stats(endpoint_address(0x01));
+    CHECK(s.submitted == 1 && s.completed == 1);
+    CHECK(s.in_flight == 0 && s.max_in_flight == 1);
+}
+
+TEST_CASE(stats, failed_submission)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    //the device has no such endpoint
+    auto t = h.async_bulk_transfer(endpoint_address(0x85), [](auto &) {});
+    unsigned char in[64];
+    t.set_buffer(in, in + 64);
+    CHECK(t.submit() == LIBUSB_ERROR_NOT_FOUND);
+    auto s = h.get_stats(endpoint_address(0x85));
+    CHECK(s.submitted == 0 && s.in_flight == 0);
+    CHECK(s.max_in_flight == 0);
+    CHECK(s.get_submit_errors(LIBUSB_ERROR_NOT_FOUND) == 1);
+}
+#endif
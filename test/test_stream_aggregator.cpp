@@ -0,0 +1,118 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+sim::device_config two_sources()
+{
+    auto cfg = sim::loopback_device(0x1234, 0x5678);
+    cfg.interfaces[0].endpoints.push_back(test::counting_source(0x82));
+    cfg.interfaces[0].endpoints.push_back(test::counting_source(0x83));
+    return cfg;
+}
+} // namespace
+
+TEST_CASE(stream_aggregator, merges_in_order)
+{
+    sim::backend bus;
+    bus.add_device(two_sources());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    stream_aggregator agg;
+    agg.add_source(h, endpoint_address(0x82), 4, 1024);
+    agg.add_source(h, endpoint_address(0x83), 4, 1024);
+    CHECK(static_cast<bool>(agg));
+    test::counting_check check[2];
+    std::chrono::steady_clock::time_point last{};
+    bool ordered = true;
+    std::size_t buffers = 0;
+    agg.set_callback([&](aggregated_buffer b) {
+        ordered = ordered && b.timestamp >= last;
+        last = b.timestamp;
+        check[b.source](b.data.begin(), b.data.end());
+        ++buffers;
+    });
+    CHECK(agg.start() == 0);
+    while (buffers < 1000)
+    {
+        handle_events(ctx);
+    }
+    agg.stop();
+    while (agg.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    agg.flush();
+    CHECK(ordered);
+    CHECK(check[0].in_order && check[1].in_order);
+    CHECK(agg.get_stats(0).queued == 0 && agg.get_stats(1).queued == 0);
+}
+
+TEST_CASE(stream_aggregator, consumer_may_poll_and_flush)
+{
+    sim::backend bus;
+    bus.add_device(two_sources());
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    stream_aggregator agg;
+    agg.add_source(h, endpoint_address(0x82), 4, 1024);
+    agg.add_source(h, endpoint_address(0x83), 4, 1024);
+    std::size_t buffers = 0;
+    std::chrono::steady_clock::time_point last{};
+    bool ordered = true;
+    //both calls used to deadlock on the lock which serialized the delivery
+    agg.set_callback([&](aggregated_buffer b) {
+        ordered = ordered && b.timestamp >= last;
+        last = b.timestamp;
+        ++buffers;
+        agg.poll();
+        if (buffers % 10 == 0)
+        {
+            agg.flush();
+        }
+        agg.get_stats(b.source);
+    });
+    CHECK(agg.start() == 0);
+    while (buffers < 200)
+    {
+        handle_events(ctx);
+    }
+    agg.stop();
+    while (agg.in_flight() != 0)
+    {
+        handle_events(ctx);
+    }
+    agg.flush();
+    CHECK(ordered);
+    CHECK(agg.poll() == 0);
+}
+
+TEST_CASE(stream_aggregator, destroyed_while_running)
+{
+    sim::backend bus;
+    bus.add_device(two_sources());
+    {
+        context ctx{bus};
+        CHECK(ctx.start_event_thread() == 0);
+        auto h = test::open_first(ctx);
+        std::atomic<std::size_t> buffers{0};
+        {
+            stream_aggregator agg;
+            agg.add_source(h, endpoint_address(0x82), 4, 1024);
+            agg.add_source(h, endpoint_address(0x83), 4, 1024);
+            agg.set_callback([&](aggregated_buffer) { ++buffers; });
+            CHECK(agg.start() == 0);
+            while (buffers.load() < 1000)
+            {
+                std::this_thread::yield();
+            }
+            //the destructor waits until the event thread handed back every transfer
+        }
+        CHECK(bus.allocated_transfers() == 0);
+    }
+    CHECK(bus.open_handles() == 0);
+}
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+namespace
+{
+//the usbmon headers of a capture, each followed by its captured data
+struct usbmon_record
+{
+    char type;
+    unsigned char endpoint;
+    char flag_data;
+    std::vector<unsigned char> data;
+};
+
+std::vector<usbmon_record> read_capture(const char *path)
+{
+    std::ifstream f{path, std::ios::binary};
+    std::vector<unsigned char> bytes{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+    std::vector<usbmon_record> out;
+    for (std::size_t at = 24; at + 16 + 64 <= bytes.size();)
+    {
+        std::uint32_t incl;
+        std::memcpy(&incl, &bytes[at + 8], sizeof(incl));
+        const unsigned char *u = &bytes[at + 16];
+        out.push_back(usbmon_record{static_cast<char>(u[8]), u[10], static_cast<char>(u[15]), std::vector<unsigned char>(u + 64, u + incl)});
+        at += 16 + incl;
+    }
+    return out;
+}
+} // namespace
+
+TEST_CASE(trace_recorder, usbmon_flags)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    const char *path = "trace_recorder_test.pcap";
+    {
+        trace_recorder rec{1 << 16, 16};
+        CHECK(rec.start(path) == 0);
+        unsigned char out[4] = {1, 2, 3, 4};
+        unsigned char in[4] = {};
+        h.bulk_transfer(endpoint_address(0x01), out, out + 4, std::chrono::milliseconds(100))([](unsigned char *) {}, [](osf::error) { CHECK(false); });
+        h.bulk_transfer(endpoint_address(0x81), in, in + 4, std::chrono::milliseconds(100))([](unsigned char *) {}, [](osf::error) { CHECK(false); });
+        rec.stop();
+        CHECK(rec.get_records() == 4);
+        CHECK(rec.get_dropped() == 0);
+    }
+    auto records = read_capture(path);
+    std::remove(path);
+    CHECK(records.size() == 4);
+    if (records.size() != 4)
+    {
+        return;
+    }
+    //OUT data goes with the submission, its completion is marked '>'
+    CHECK(records[0].type == 'S' && records[0].endpoint == 0x01 && records[0].flag_data == 0 && records[0].data.size() == 4);
+    CHECK(records[1].type == 'C' && records[1].flag_data == '>' && records[1].data.empty());
+    //IN data goes with the completion, its submission is marked '<'
+    CHECK(records[2].type == 'S' && records[2].endpoint == 0x81 && records[2].flag_data == '<' && records[2].data.empty());
+    CHECK(records[3].type == 'C' && records[3].flag_data == 0 && records[3].data.size() == 4 && records[3].data[3] == 4);
+}
+
+TEST_CASE(trace_recorder, stop_while_recording)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    const char *path = "trace_recorder_test.pcap";
+    std::atomic<bool> done{false};
+    //other threads keep recording while the recorder starts and stops
+    std::thread writer([&] {
+        unsigned char out[64] = {};
+        while (!done.load())
+        {
+            h.bulk_transfer(endpoint_address(0x01), out, out + 64, std::chrono::milliseconds(100))([](unsigned char *) {}, [](osf::error) {});
+            std::this_thread::yield();
+        }
+    });
+    for (int i = 0; i < 20; ++i)
+    {
+        trace_recorder rec{1 << 16, 64};
+        CHECK(rec.start(path) == 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        rec.stop();
+        CHECK(!detail::tracing());
+    }
+    done.store(true);
+    writer.join();
+    std::remove(path);
+}
@@ -0,0 +1,80 @@
+#include <thread>
+#include <vector>
+#include "sim_fixture.hpp"
+
+using namespace osf::libusbcpp;
+
+TEST_CASE(transfer_pool, exhaustion)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 8);
+    CHECK(static_cast<bool>(pool));
+    {
+        std::vector<transfer_pool::lease> leases;
+        for (int i = 0; i < 8; ++i)
+        {
+            leases.push_back(pool.acquire());
+            CHECK(static_cast<bool>(leases.back()));
+        }
+        CHECK(!pool.acquire());
+        CHECK(pool.get_available() == 0);
+    }
+    CHECK(pool.get_available() == 8);
+}
+
+TEST_CASE(transfer_pool, concurrent_leases)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 8);
+    std::vector<std::thread> threads;
+    for (int k = 0; k < 4; ++k)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100000; ++i)
+            {
+                auto a = pool.acquire();
+                auto b = pool.acquire();
+                CHECK(!a || !b || &*a != &*b);
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    CHECK(pool.get_available() == 8);
+}
+
+TEST_CASE(transfer_pool, without_callback)
+{
+    sim::backend bus;
+    bus.add_device(sim::loopback_device(0x1234, 0x5678));
+    context ctx{bus};
+    auto h = test::open_first(ctx);
+    transfer_pool pool(h, 2);
+    unsigned char out[64] = {1, 2, 3};
+    //the write has no callback, its completion must not call the empty one
+    auto write = pool.acquire();
+    write->set_endpoint(endpoint_address(0x01));
+    write->set_buffer(out, out + 64);
+    CHECK(write->submit() == 0);
+    auto l = pool.acquire();
+    int done = 0;
+    l->set_endpoint(endpoint_address(0x81));
+    unsigned char in[64];
+    l->set_buffer(in, in + 64);
+    l->set_callback([&](transfer &t) { done = t.get_status() == LIBUSB_TRANSFER_COMPLETED ? 1 : 2; });
+    CHECK(l->submit() == 0);
+    while (done == 0)
+    {
+        handle_events(ctx);
+    }
+    CHECK(done == 1);
+    CHECK(in[2] == 3);
+}